@@ -0,0 +1,51 @@
+/**
+ * Times each stage of FeatherTrace::Fault on the device, and the cost of MARK
+ * in CPU cycles. Build with -DFEATHERTRACE_BENCHMARK=1, which uses TC4 and TC5
+ * as the cycle counter. Send 'f' over Serial to time a call to FeatherTrace::Fault,
+ * or 'h' to time a hard fault, and the timing is printed after the reset.
+ * tools/host/ft_bench times the same stages on a computer.
+ */
+#include "FeatherTrace.h"
+FEATHERTRACE_BIND_ALL()
+
+#if !FEATHERTRACE_BENCHMARK
+#error Build this sketch with -DFEATHERTRACE_BENCHMARK=1
+#endif
+
+static const uint32_t ITERATIONS = 10000;
+static volatile uint32_t sink = 0;
+
+/** Run fn ITERATIONS times and return the average number of cycles per call */
+template<typename F>
+static uint32_t time_cycles(F fn) {
+    const uint32_t start = FeatherTrace::GetCycles();
+    for (uint32_t i = 0; i < ITERATIONS; i++)
+        fn();
+    const uint32_t end = FeatherTrace::GetCycles();
+    return (end - start) / ITERATIONS;
+}
+
+void setup() {
+    Serial.begin(115200);
+    while(!Serial);
+    FeatherTrace::PrintFaultTiming(Serial);
+    const uint32_t loop_cycles = time_cycles([]() { sink++; });
+    const uint32_t mark_cycles = time_cycles([]() { sink++; MARK; });
+    Serial.print("MARK: ");
+    Serial.print(mark_cycles - loop_cycles);
+    Serial.println(" cycles");
+    Serial.println("Send 'f' to time FeatherTrace::Fault, or 'h' to time a hard fault");
+    FeatherTrace::StartWDT(FeatherTrace::WDTTimeout::WDT_8S);
+}
+
+void loop() {
+    MARK;
+    if (!Serial.available())
+        return;
+    const char c = Serial.read();
+    if (c == 'f')
+        FeatherTrace::Fault(FeatherTrace::FAULT_USER);
+    else if (c == 'h')
+        // an unaligned word access is a hard fault on the Cortex-M0+
+        *reinterpret_cast<volatile uint32_t*>(reinterpret_cast<uintptr_t>(&sink) + 1) = 0;
+}
@@ -0,0 +1,45 @@
+/**
+ * Measures the cost of MARK with the current build flags, so the different
+ * FEATHERTRACE_MEMCHECK policies can be compared. Build this sketch once per
+ * policy (ex. -DFEATHERTRACE_MEMCHECK=FEATHERTRACE_MEMCHECK_CANARY) and compare
+ * the reported time per MARK.
+ */
+#include "FeatherTrace.h"
+FEATHERTRACE_BIND_ALL()
+
+extern "C" char* sbrk(int incr);
+
+static const uint32_t ITERATIONS = 100000;
+static volatile uint32_t sink = 0;
+
+/** Run fn ITERATIONS times and return the average time per call in nanoseconds */
+template<typename F>
+static uint32_t time_ns(F fn) {
+    const uint32_t start = micros();
+    for (uint32_t i = 0; i < ITERATIONS; i++)
+        fn();
+    const uint32_t end = micros();
+    return (end - start) * 1000UL / ITERATIONS;
+}
+
+void setup() {
+    Serial.begin(115200);
+    while(!Serial);
+    FeatherTrace::PrintFault(Serial);
+    Serial.print("Memory check policy: ");
+    Serial.println(FEATHERTRACE_MEMCHECK);
+    const uint32_t loop_ns = time_ns([]() { sink++; });
+    const uint32_t mark_ns = time_ns([]() { sink++; MARK; });
+    const uint32_t sbrk_ns = time_ns([]() { sink += reinterpret_cast<uint32_t>(sbrk(0)); });
+    Serial.print("Empty loop: ");
+    Serial.print(loop_ns);
+    Serial.println(" ns");
+    Serial.print("MARK: ");
+    Serial.print(mark_ns - loop_ns);
+    Serial.println(" ns");
+    Serial.print("sbrk(0), as used by FEATHERTRACE_MEMCHECK_ALWAYS: ");
+    Serial.print(sbrk_ns - loop_ns);
+    Serial.println(" ns");
+}
+
+void loop() {}
@@ -1,5 +1,6 @@
 #pragma once
 
+#ifdef ARDUINO
 #include <Arduino.h>
 #include <Adafruit_ASFcore.h>
 #include <reset.h>
@@ -8,11 +9,14 @@
 #undef Max
 #undef min
 #undef max
+#else
+// host build, see FeatherTraceHAL_Linux.cpp
+#include "FeatherTracePrint.h"
+#endif
 #include <atomic>
+#include "FeatherTraceConfig.h"
 #include "ShortFile.h"
 
-#define MAX_STRACE 32
-
 /**
  * Welcome to FeatherTrace
  * For more information on how to use this library, please see the [README](../README.md).
@@ -49,6 +53,53 @@ namespace FeatherTrace {
         FAULT_USER = 5
     };
 
+#if FEATHERTRACE_HEAP_HOOKS
+    /** Heap counters kept if FEATHERTRACE_HEAP_HOOKS is set, see FeatherTrace::GetHeapStats */
+    struct HeapStats {
+        /** Bytes currently allocated, including malloc's padding */
+        uint32_t live_bytes;
+        /** The most bytes allocated at once since boot */
+        uint32_t peak_bytes;
+        /** Number of successful calls to malloc, calloc, and realloc */
+        uint32_t alloc_count;
+        /**
+         * Number of calls to free with a non-null pointer, plus the blocks replaced
+         * or freed by realloc, so alloc_count - free_count is the number of live blocks
+         */
+        uint32_t free_count;
+        /** Number of calls to malloc, calloc, and realloc that returned null */
+        uint32_t failed_count;
+        /**
+         * Estimate of the largest block that can be allocated: the space between the
+         * heap and the stack, ignoring freed blocks malloc could reuse.
+         */
+        uint32_t largest_free;
+    };
+
+    /** A recent allocation, see FeatherTrace::GetHeapSites */
+    struct HeapSite {
+        /** Return address of the call to malloc or realloc */
+        uint32_t caller;
+        /** Number of bytes requested */
+        uint32_t size;
+    };
+#endif
+
+#if FEATHERTRACE_LOG_ENTRIES > 0
+    /** An event recorded by FT_LOG */
+    struct LogEntry {
+        /**
+         * The address of the format string passed to FT_LOG, which can be read from
+         * the ELF file (see `recover_trace decode-log`). 0 if the entry is empty.
+         */
+        uint32_t token;
+        /** The number of valid entries in args */
+        uint32_t arg_count;
+        /** The arguments to FT_LOG, floating point values are stored as a float */
+        uint32_t args[FEATHERTRACE_LOG_MAX_ARGS];
+    };
+#endif
+
     /** Struct containg information about the last fault. */
     struct FaultData {
         /** The cause of the fault. */
@@ -59,6 +110,7 @@ namespace FeatherTrace {
          * for more information about this number.
          */
         uint32_t interrupt_type;
+#if FEATHERTRACE_SAVE_REGISTERS
         /** 
          * Register dump grabed from the saved exception context, will only be valid if 
          * interrupt_type != 0. Formatted according to http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.dui0662a/CHDBIBGJ.html,
@@ -68,22 +120,89 @@ namespace FeatherTrace {
          * index 14: Link register
          * index 15: Program counter
          * Registers r0, r1, r2, r3, r12, lr, and PC are grabbed from the saved
-         * execution context on the stack, all others are saved immediately after 
+         * execution context on the stack, all others are saved immediately after
          * entering the exception.
          */
         uint32_t regs[16];
         /** Program status register grabbed from the saved exception context, will only be valid if interrupt_type != 0 */
         uint32_t xpsr;
+#endif
         /** Whether or not the fault happened while FeatherTrace was recording line information (1 if so, 0 if not) */
         uint8_t is_corrupted;
-        /** Number of times FeatherTrace has detected a failure since the device was last programmed */
+        /** 
+         * Number of times FeatherTrace has detected a failure since the device was last programmed.
+         * This value also serves as the sequence number of the fault in the log.
+         */
         uint32_t failnum;
         /** The line number of the last MARK statement before failure (for a memory fault will be the MARK where the fault happened) */
         int32_t line;
         /** The filename where this line was taken from, may be corrupted if is_corrupted is 1 */
         char file[64];
+        /** 
+         * The site ID of the last MARK statement before failure if FEATHERTRACE_SITE_IDS is set, 0 if not.
+         * When set line will be 0 and file will be empty.
+         */
+        uint32_t site;
         /** A list of addresses forming a backtrace to where the fault happened, starting from the most nested address and ending with a zero. */
         uint32_t stacktrace[MAX_STRACE];
+#if FEATHERTRACE_MARK_HISTORY > 0
+        /** The number of valid entries in mark_history */
+        uint32_t mark_history_len;
+        /** 
+         * The last MARKs before failure, oldest first. If FEATHERTRACE_SITE_IDS is set
+         * each entry is a site ID, otherwise use FeatherTrace::GetMarkLine and
+         * FeatherTrace::GetMarkFile to decode an entry.
+         */
+        uint32_t mark_history[FEATHERTRACE_MARK_HISTORY];
+#endif
+#if FEATHERTRACE_STACK_WINDOW > 0
+        /** Address of the first word in stack_window, the stack pointer at the time of failure */
+        uint32_t stack_window_addr;
+        /** 
+         * Number of valid bytes in stack_window. Less than FEATHERTRACE_STACK_WINDOW if the stack was
+         * shallower, and 0 if interrupt_type == 0 (the stack is only saved for exceptions).
+         */
+        uint32_t stack_window_len;
+        /** Copy of the stack starting at stack_window_addr, to be unwound by tools/host */
+        uint32_t stack_window[FEATHERTRACE_STACK_WINDOW / 4];
+#endif
+#if FEATHERTRACE_WDT_CHANNELS > 0
+        /**
+         * Name of the watchdog channel that missed its deadline if cause is FeatherTrace::FAULT_HUNG,
+         * empty if the watchdog was triggered because MARK was not called.
+         */
+        char starved_channel[16];
+#endif
+#if FEATHERTRACE_STACK_PAINT
+        /** The deepest stack usage seen before the fault in bytes, see FeatherTrace::ScanStack */
+        uint32_t stack_high_water;
+#endif
+#if FEATHERTRACE_SLEEP_WDT
+        /** The number of times the device woke from FeatherTrace::SleepWDT between boot and the fault */
+        uint32_t wake_count;
+#endif
+#if FEATHERTRACE_SIGNATURE
+        /**
+         * FNV-1a hash of cause, then site if it isn't 0 (otherwise file and line), then each
+         * address in stacktrace, see FEATHERTRACE_SIGNATURE. tools/recover_trace computes the
+         * same hash from any fault record, and groups signatures by the functions in the stacktrace.
+         */
+        uint32_t signature;
+#endif
+#if FEATHERTRACE_HEAP_HOOKS
+        /** The heap counters at the time of failure, only saved if cause is FeatherTrace::FAULT_OUTOFMEMORY */
+        HeapStats heap_stats;
+        /** The number of valid entries in heap_sites */
+        uint32_t heap_sites_len;
+        /** The last allocations before failure, oldest first. Only saved if cause is FeatherTrace::FAULT_OUTOFMEMORY */
+        HeapSite heap_sites[FEATHERTRACE_HEAP_SITES];
+#endif
+#if FEATHERTRACE_LOG_ENTRIES > 0
+        /** The number of valid entries in log */
+        uint32_t log_len;
+        /** The last FT_LOG events before failure, oldest first */
+        LogEntry log[FEATHERTRACE_LOG_SAVED];
+#endif
     };
 
     /**
@@ -112,7 +231,109 @@ namespace FeatherTrace {
      * is called, you must start it again with FeatherTrace::StartWDT.
      */
     void StopWDT();
-    
+
+    /**
+     * Start the watchdog timer like FeatherTrace::StartWDT, but without
+     * waiting. Each write to the watchdog takes a few milliseconds to
+     * reach its slow clock, and StartWDT spends that time spinning.
+     * This function makes the first write and returns, and
+     * FeatherTrace::WDTReady makes the rest: call it (ex. in loop)
+     * until it returns true. Hangs are not detected until then.
+     * @param timeout Timeout to use for the WDT.
+     */
+    void StartWDTAsync(const WDTTimeout timeout);
+
+    /**
+     * Stop the watchdog timer like FeatherTrace::StopWDT, but without
+     * waiting, see FeatherTrace::StartWDTAsync. The watchdog keeps
+     * running until FeatherTrace::WDTReady returns true, so check
+     * it before going to sleep.
+     */
+    void StopWDTAsync();
+
+    /**
+     * Continue starting or stopping the watchdog after
+     * FeatherTrace::StartWDTAsync or FeatherTrace::StopWDTAsync.
+     * This function never waits for the watchdog.
+     * @return true once the watchdog has been started or stopped.
+     */
+    bool WDTReady();
+
+#if FEATHERTRACE_SLEEP_WDT
+    /**
+     * Keep the watchdog running through a sleep of up to sleep_ms
+     * milliseconds, instead of stopping it with FeatherTrace::StopWDT.
+     * The watchdog clock is slowed down by a power of two so its timeout
+     * is at least sleep_ms, and it is kept running in standby. If the
+     * device has not woken up and called MARK by then, a
+     * FeatherTrace::FAULT_HUNG fault is triggered.
+     *
+     * The first MARK after waking up puts the watchdog back to the
+     * timeout passed to FeatherTrace::StartWDT, and counts a wake (see
+     * FaultData::wake_count). Call this just before sleeping, and
+     * FeatherTrace::WakeWDT when waking up if the first MARK may be
+     * a long way away. Does nothing if the watchdog isn't running.
+     *
+     * Requires FEATHERTRACE_SLEEP_WDT.
+     * @param sleep_ms Longest expected sleep, up to about 4.6 hours with FeatherTrace::WDTTimeout::WDT_8S.
+     */
+    void SleepWDT(const uint32_t sleep_ms);
+
+    /**
+     * Put the watchdog back to normal after FeatherTrace::SleepWDT, without
+     * waiting for the next MARK. Does nothing if the watchdog isn't asleep.
+     *
+     * Requires FEATHERTRACE_SLEEP_WDT.
+     */
+    void WakeWDT();
+
+    /**
+     * Get the number of times the device has woken from FeatherTrace::SleepWDT since boot.
+     *
+     * Requires FEATHERTRACE_SLEEP_WDT.
+     */
+    uint32_t GetWakeCount();
+#endif
+
+#if FEATHERTRACE_WDT_CHANNELS > 0
+    /** Handle to a watchdog channel, returned by FeatherTrace::RegisterWDTChannel */
+    typedef uint8_t WDTChannel;
+
+    /** Returned by FeatherTrace::RegisterWDTChannel if there are no channels left */
+    constexpr WDTChannel WDT_CHANNEL_INVALID = 0xFF;
+
+    /**
+     * Register a watchdog channel, allowing a single task (ex. a radio) to be
+     * watched separately from the rest of the program. Once registered, the
+     * channel must be fed with FeatherTrace::FeedWDTChannel at least once
+     * every deadline_ms, or the next watchdog early warning will trigger a
+     * fault with cause FeatherTrace::FAULT_HUNG, even if MARK has been called.
+     * The name of the channel is saved in FaultData::starved_channel.
+     *
+     * Channels are checked in the watchdog interrupt, so a missed deadline
+     * is detected up to one watchdog period late.
+     *
+     * Requires FEATHERTRACE_WDT_CHANNELS to be set.
+     * @param name Name of the channel, at most 15 characters are saved. Must be a static string.
+     * @param deadline_ms Maximum time between calls to FeatherTrace::FeedWDTChannel.
+     * @return A handle to the channel, or FeatherTrace::WDT_CHANNEL_INVALID if FEATHERTRACE_WDT_CHANNELS are already registered.
+     */
+    WDTChannel RegisterWDTChannel(const char* name, const uint32_t deadline_ms);
+
+    /**
+     * Stop watching a channel registered with FeatherTrace::RegisterWDTChannel,
+     * ex. before a task goes idle. The channel may be reused by a later registration.
+     * @param channel The channel to stop watching.
+     */
+    void UnregisterWDTChannel(const WDTChannel channel);
+
+    /**
+     * Feed a watchdog channel, resetting its deadline.
+     * @param channel Handle returned by FeatherTrace::RegisterWDTChannel.
+     */
+    void FeedWDTChannel(const WDTChannel channel);
+#endif
+
     /**
      * Set a callback function to be called whenever FeatherTrace triggered.
      * This function should be a volatile void function.
@@ -130,8 +351,9 @@ namespace FeatherTrace {
      * serial monitor) in a human readable format. This function is 
      * useful if you are debugging with the serial monitor.
      * @param where The print stream to output to (ex. Serial).
+     * @param index Which fault to print, 0 for the newest, 1 for the one before it, etc.
      */
-    void PrintFault(Print& where);
+    void PrintFault(Print& where, const size_t index = 0);
 
     /**
      * Returns whether or not FeatherTrace has detected a fault since
@@ -140,13 +362,51 @@ namespace FeatherTrace {
      */
     bool DidFault();
 
+#if FEATHERTRACE_DEFERRED_COMMIT
+    /**
+     * Write a fault saved to RAM by FEATHERTRACE_DEFERRED_COMMIT to the flash log,
+     * if there is one. This function is called automatically by the functions
+     * that read the fault log, and before main if FEATHERTRACE_COMMIT_ON_BOOT is used.
+     * @note This function performs a flash erase and write, and may take a few milliseconds.
+     * @return true if a fault was waiting to be written, false if not.
+     */
+    bool CommitFault();
+#endif
+
+    /**
+     * Returns the number of faults stored in the flash log, at most
+     * FEATHERTRACE_LOG_SLOTS. Use with FeatherTrace::GetFault to
+     * iterate through the fault history.
+     * @return The number of faults that can be read with FeatherTrace::GetFault.
+     */
+    size_t GetFaultCount();
+
     /**
      * Returns a FeatherTrace::FaultData struct containing information
-     * about the last fault to occur. If no fault has occured, this
-     * function will return a struct of all zeros.
-     * @return Fault information from the last fault, or zero.
+     * about a fault in the flash log, by default the last fault to occur.
+     * If no such fault has occured, this function will return a struct 
+     * of all zeros.
+     * @param index Which fault to get, 0 for the newest, 1 for the one before it, etc.
+     * @return Fault information from the fault, or zero.
+     */
+    FaultData GetFault(const size_t index = 0);
+
+    /**
+     * Decodes the line number from an entry in FaultData::mark_history.
+     * Line numbers are stored in 14 bits, so lines past 16383 will wrap.
+     * @param entry The mark history entry to decode.
+     * @return The line number of the MARK.
+     */
+    inline int GetMarkLine(const uint32_t entry) { return static_cast<int>(entry & 0x3FFF); }
+
+    /**
+     * Decodes the filename from an entry in FaultData::mark_history. The
+     * filename is stored as a pointer into flash, and as a result is only
+     * valid if the sketch has not been changed since the fault.
+     * @param entry The mark history entry to decode.
+     * @return The filename of the MARK.
      */
-    FaultData GetFault();
+    inline const char* GetMarkFile(const uint32_t entry) { return reinterpret_cast<const char*>(static_cast<uintptr_t>(entry >> 14)); }
 
     /**
      * Returns the string representation of the appropriete fault cause,
@@ -173,8 +433,238 @@ namespace FeatherTrace {
      */
     void Fault(FaultCause cause);
 
+#if FEATHERTRACE_PROFILER
+    /** A single address counted by the profiler */
+    struct ProfileEntry {
+        /** The program counter (or return address for callers) that was sampled, 0 if the entry is empty */
+        uint32_t address;
+        /** Number of samples where this address was executing */
+        uint32_t self;
+        /** Number of samples where this address was executing or on the stack, only different from self if FEATHERTRACE_PROFILER_DEPTH > 1 */
+        uint32_t inclusive;
+    };
+
+    /**
+     * Start sampling the program counter using TC3. Each sample counts the
+     * address that was interrupted (and its callers if FEATHERTRACE_PROFILER_DEPTH > 1)
+     * in a fixed size table, which can be printed with FeatherTrace::PrintProfile.
+     * 
+     * Requires FEATHERTRACE_PROFILER and FEATHERTRACE_BIND_PROFILER().
+     * @param hz Number of samples to take per second, at least 1.
+     */
+    void StartProfiler(const uint32_t hz);
+
+    /** Stop sampling, the samples taken so far are kept. */
+    void StopProfiler();
+
+    /** Clear all samples taken by the profiler. */
+    void ClearProfile();
+
+    /**
+     * Copy the profiler table, sorted by number of self samples (most first).
+     * @param out Array to copy entries into.
+     * @param max_entries Size of out.
+     * @return The number of entries written.
+     */
+    size_t GetProfile(ProfileEntry* out, const size_t max_entries);
+
+    /**
+     * Prints the addresses with the most samples to a print stream, in a format
+     * that can be decoded with `recover_trace decode-profile`.
+     * @param where The print stream to output to (ex. Serial).
+     * @param max_entries Maximum number of addresses to print, at most 32.
+     */
+    void PrintProfile(Print& where, const size_t max_entries = 20);
+#endif
+
+#if FEATHERTRACE_STACK_PAINT
+    /**
+     * Check part of the stack painted before main for the deepest stack usage.
+     * Each call checks at most max_words words, continuing from where the last
+     * call stopped, so it is fast enough to call often. This function is also
+     * called every time the watchdog is fed, and the stack is completely scanned
+     * when a fault happens.
+     *
+     * Requires FEATHERTRACE_STACK_PAINT.
+     * @param max_words Maximum number of words to check.
+     * @return The deepest stack usage found so far in bytes, see FeatherTrace::GetStackHighWater.
+     */
+    uint32_t ScanStack(const size_t max_words = FEATHERTRACE_STACK_SCAN_WORDS);
+
+    /**
+     * Get the deepest stack usage found by FeatherTrace::ScanStack so far, without scanning.
+     * This may be lower than the real value until the scan has checked the whole stack.
+     * @return The stack usage in bytes, or 0 if the stack could not be painted.
+     */
+    uint32_t GetStackHighWater();
+#endif
+
+#if FEATHERTRACE_HEAP_HOOKS
+    /**
+     * Get the heap counters kept by the malloc, realloc, and free wrappers.
+     * Requires FEATHERTRACE_HEAP_HOOKS and the --wrap linker flags.
+     * @return A copy of the counters.
+     */
+    HeapStats GetHeapStats();
+
+    /**
+     * Copy the callers of the most recent allocations, oldest first.
+     * @param out Array to copy entries into.
+     * @param max_entries Size of out.
+     * @return The number of entries written, at most FEATHERTRACE_HEAP_SITES.
+     */
+    size_t GetHeapSites(HeapSite* out, const size_t max_entries);
+#endif
+
+#if FEATHERTRACE_MARK_LATENCY
+    /** Number of buckets in MarkLatency::buckets, one per bit of a microsecond count */
+    constexpr size_t MARK_LATENCY_BUCKETS = 32;
+
+    /** Where a MARK was placed, used by MarkLatency */
+    struct MarkLocation {
+        /** The line number of the MARK, 0 if FEATHERTRACE_SITE_IDS is set */
+        int32_t line;
+        /** The filename of the MARK, nullptr if FEATHERTRACE_SITE_IDS is set */
+        const char* file;
+        /** The site ID of the MARK if FEATHERTRACE_SITE_IDS is set, 0 if not */
+        uint32_t site;
+    };
+
+    /** Time between consecutive MARKs, measured if FEATHERTRACE_MARK_LATENCY is set */
+    struct MarkLatency {
+        /** Number of gaps measured */
+        uint32_t count;
+        /**
+         * Histogram of gaps in microseconds: bucket i counts gaps from 2^i to 2^(i+1) - 1
+         * microseconds (bucket 0 also counts gaps of 0).
+         */
+        uint32_t buckets[MARK_LATENCY_BUCKETS];
+        /** The longest gap in microseconds */
+        uint32_t worst_us;
+        /** The MARK at the start of the longest gap */
+        MarkLocation worst_from;
+        /** The MARK at the end of the longest gap */
+        MarkLocation worst_to;
+    };
+
+    /**
+     * Get the time between MARKs measured since boot (or FeatherTrace::ClearMarkLatency).
+     * Use this to choose a WDTTimeout: the watchdog will trigger if the time between
+     * two MARKs is longer than the timeout, so pick one comfortably above worst_us.
+     * Requires FEATHERTRACE_MARK_LATENCY.
+     * @return A copy of the measurements.
+     */
+    MarkLatency GetMarkLatency();
+
+    /**
+     * Clear the measurements taken so far. The next gap is measured from the
+     * next MARK, so call this after sleeping to avoid counting the sleep.
+     */
+    void ClearMarkLatency();
+
+    /**
+     * Prints the longest gap between MARKs and the histogram of gaps to a print stream.
+     * @param where The print stream to output to (ex. Serial).
+     */
+    void PrintMarkLatency(Print& where);
+#endif
+
+#if FEATHERTRACE_BENCHMARK
+    /** Stages of FeatherTrace::Fault timed if FEATHERTRACE_BENCHMARK is set, in the order they run */
+    enum FaultStage : uint8_t {
+        /** Stopping the watchdog, which waits for it to synchronize */
+        STAGE_STOP_WDT,
+        /** Unwinding the stack and saving the registers */
+        STAGE_CAPTURE,
+        /** Filling in the cause, MARK information, and optional features */
+        STAGE_BUILD,
+        /** Encoding the record */
+        STAGE_ENCODE,
+        /** Finding the newest record in the flash log */
+        STAGE_FIND,
+        /** Erasing flash rows */
+        STAGE_ERASE,
+        /** Writing flash pages */
+        STAGE_WRITE,
+        /** The function passed to FeatherTrace::SetCallback */
+        STAGE_CALLBACK,
+        STAGE_COUNT
+    };
+
+    /** Time taken by the last fault, measured if FEATHERTRACE_BENCHMARK is set */
+    struct FaultTiming {
+        /** Cycles spent in each FaultStage, 0 for stages that didn't run (ex. STAGE_ERASE if no row needed erasing) */
+        uint32_t cycles[STAGE_COUNT];
+        /** Cycles from deciding to fault to the reset, including time not in any stage */
+        uint32_t total;
+        /** Cycles per second, to convert cycles to time */
+        uint32_t cycles_per_second;
+    };
+
+    /**
+     * Get the time taken by each stage of the last fault. The timing is kept
+     * in RAM that is not cleared on reset, so this works after the fault.
+     * Requires FEATHERTRACE_BENCHMARK.
+     * @param out[out] The timing of the last fault.
+     * @return false if no fault has been timed since power on.
+     */
+    bool GetFaultTiming(FaultTiming& out);
+
+    /**
+     * Prints the time taken by each stage of the last fault to a print stream.
+     * @param where The print stream to output to (ex. Serial).
+     */
+    void PrintFaultTiming(Print& where);
+
+    /**
+     * Get the cycle counter used by FeatherTrace::GetFaultTiming, to time
+     * other code (ex. MARK) the same way. Wraps around every 2^32 cycles.
+     */
+    uint32_t GetCycles();
+#endif
+
+#if FEATHERTRACE_LOG_ENTRIES > 0
+    /**
+     * Copy the newest FT_LOG events, oldest first.
+     * @param out Array to copy entries into.
+     * @param max_entries Size of out.
+     * @return The number of entries written, at most FEATHERTRACE_LOG_ENTRIES.
+     */
+    size_t GetLog(LogEntry* out, const size_t max_entries);
+
+    /**
+     * Prints the FT_LOG events kept in RAM to a print stream, oldest first, in
+     * a format that can be decoded with `recover_trace decode-log`.
+     * @param where The print stream to output to (ex. Serial).
+     */
+    void PrintLog(Print& where);
+
+    /** Private utility function called by FT_LOG */
+    void log_words(const char* format, const uint32_t* args, const uint32_t count);
+
+    /** Private utility functions to store an FT_LOG argument in a word */
+    inline uint32_t log_arg(const float value) { uint32_t word; __builtin_memcpy(&word, &value, sizeof(word)); return word; }
+    inline uint32_t log_arg(const double value) { return log_arg(static_cast<float>(value)); }
+    template<typename T>
+    inline uint32_t log_arg(T* value) { return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(value)); }
+    template<typename T>
+    inline uint32_t log_arg(const T value) { return static_cast<uint32_t>(value); }
+
+    /** Private utility function called by FT_LOG */
+    template<typename... Args>
+    inline void log(const char* format, const Args... args) {
+        static_assert(sizeof...(Args) <= FEATHERTRACE_LOG_MAX_ARGS, "FT_LOG takes at most FEATHERTRACE_LOG_MAX_ARGS arguments");
+        // one extra word so the array is never empty
+        const uint32_t words[sizeof...(Args) + 1] = { log_arg(args)..., 0 };
+        log_words(format, words, sizeof...(Args));
+    }
+#endif
+
     /** Private utility function called by the MARK macro */
     void mark(const int line = __builtin_LINE(), const char* file = _ShortFilePrivate::past_last_slash(__builtin_FILE()));
+
+    /** Private utility function called by the MARK macro if FEATHERTRACE_SITE_IDS is set */
+    void mark_site(const uint32_t site);
 }
 
 /** 
@@ -193,10 +683,37 @@ namespace FeatherTrace {
  * where the failure happened when the program faults.
  * 
  * This macro is a proxy for FeatherTrace::_Mark, allowing it to 
- * grab the line # and filename.
+ * grab the line # and filename. If FEATHERTRACE_SITE_IDS is set,
+ * the line # and filename are instead hashed into a site ID at 
+ * compile time.
  */
+#if FEATHERTRACE_USE_SITE_IDS
+#define MARK { FeatherTrace::mark_site(__SITE_ID__); }
+#else
 #define MARK { FeatherTrace::mark(); }
+#endif
+
+/**
+ * Macro to record an event in a ring buffer that survives a reset, and is saved
+ * with every fault. For example:
+ * ```C++
+ * FT_LOG("radio: send %d bytes to %x", len, addr);
+ * ```
+ * Only the address of the format string and up to FEATHERTRACE_LOG_MAX_ARGS
+ * arguments are stored, so FT_LOG is much faster than printing. The format
+ * string is applied on a computer by `recover_trace`, which reads it from the
+ * ELF file. Arguments are stored as 32-bit words: use %s only for strings in flash,
+ * and floating point values are stored as a float.
+ *
+ * Requires FEATHERTRACE_LOG_ENTRIES, otherwise FT_LOG does nothing.
+ */
+#if FEATHERTRACE_LOG_ENTRIES > 0
+#define FT_LOG(format, ...) { FeatherTrace::log("" format, ##__VA_ARGS__); }
+#else
+#define FT_LOG(format, ...) { }
+#endif
 
+#ifdef ARDUINO_ARCH_SAMD
 /// This struct definition mimics the internal structures of libgcc in
 /// arm-none-eabi binary. It's not portable and might break in the future.
 struct core_regs
@@ -223,6 +740,72 @@ typedef struct
 /** Global instance of saved CPU registers to be used by our interupt handler */
 extern phase2_vrs p_main_context;
 
+#if FEATHERTRACE_PROFILER
+/** Global instance of saved CPU registers to be used by the profiler interrupt handler */
+extern phase2_vrs p_profile_context;
+#endif
+
+/**
+ * Defines a naked interrupt handler _name in Thumbv2 ASM. Saves r4-r14 to _context.core.r[4:14]
+ * then calls _target with the stack pointer not currently in use and the exception return code.
+ * Local numeric labels are used so that more than one handler can be defined in a file.
+ * 
+ * This function was translated from the OpenMRN implementation here:
+ * https://github.com/bakerstu/openmrn/blob/0d051659af093e03d883a9ea003773ae58ace62a/src/freertos_drivers/common/cpu_profile.hxx#L334-L362
+ * Changes were made for Thumb compatibility, but the functionality
+ * is the same.
+ */
+#define FEATHERTRACE_NAKED_HANDLER(_name, _context, _target) \
+    static void __attribute__((__naked__)) _name() \
+    { \
+        __asm volatile(".thumb\n" \
+                        ".syntax unified\n" \
+                        /* store r0-r14 to _context.core */ \
+                        "mov  r0, %0 \n" \
+                        "str  r4, [r0, #4*4] \n" \
+                        "str  r5, [r0, #5*4] \n" \
+                        "str  r6, [r0, #6*4] \n" \
+                        "str  r7, [r0, #7*4] \n" \
+                        "movs  r1, #8*4\n" \
+                        "add r0, r1\n" \
+                        "mov r1, r8\n" \
+                        "str r1, [r0, #0]\n" \
+                        "mov r1, r9\n" \
+                        "str r1, [r0, #1*4]\n" \
+                        "mov r1, r10\n" \
+                        "str r1, [r0, #2*4]\n" \
+                        "mov r1, r11\n" \
+                        "str r1, [r0, #3*4]\n" \
+                        "mov r1, r12\n" \
+                        "str r1, [r0, #4*4]\n" \
+                        "mov r1, r13\n" \
+                        "str r1, [r0, #5*4]\n" \
+                        "mov r1, r14\n" \
+                        "str r1, [r0, #6*4]\n" \
+                        : \
+                        : "r"(_context.core.r) \
+                        : "r0", "r1"); \
+        __asm volatile( ".thumb\n" \
+                        ".syntax unified\n" \
+                        /* write the correct stack pointer to r0 */ \
+                        " mov   r1, lr\n" \
+                        " movs   r7, #4\n" \
+                        " tst   r1, r7\n" \
+                        " bne 1f\n" \
+                        " mrs r0, msp\n" \
+                        " b 2f\n" \
+                        "1: \n" \
+                        " mrs r0, psp\n" \
+                        "2:\n" \
+                        " mov r1, lr \n" \
+                        /* call _target */ \
+                        " ldr r2,  =" #_target "  \n" \
+                        " bx  r2  \n" \
+                        : \
+                        : \
+                        : "r0", "r1", "r2"); \
+    }
+
 extern "C" {
     /**
      * Given a stack pointer, save the registers popped to it during the exception
@@ -242,66 +825,46 @@ extern "C" {
      * in use.
      * 
      * @note This function must be called through an exception. Do not call it directly!
-     * This function was translated from the OpenMRN implementation here:
-     * https://github.com/bakerstu/openmrn/blob/0d051659af093e03d883a9ea003773ae58ace62a/src/freertos_drivers/common/cpu_profile.hxx#L334-L362     * Changes were made for Thumb compatibility, but the functionality
-     * is the same.
-     */
-    static void __attribute__((__naked__)) p_handler()
-    {
-        __asm volatile(".thumb\n"
-                        ".syntax unified\n"
-                        // store r0-r14 to main_context.core
-                        "mov  r0, %0 \n"
-                        "str  r4, [r0, #4*4] \n"
-                        "str  r5, [r0, #5*4] \n"
-                        "str  r6, [r0, #6*4] \n"
-                        "str  r7, [r0, #7*4] \n"
-                        "movs  r1, #8*4\n"
-                        "add r0, r1\n"
-                        "mov r1, r8\n"
-                        "str r1, [r0, #0]\n"
-                        "mov r1, r9\n"
-                        "str r1, [r0, #1*4]\n"
-                        "mov r1, r10\n"
-                        "str r1, [r0, #2*4]\n"
-                        "mov r1, r11\n"
-                        "str r1, [r0, #3*4]\n"
-                        "mov r1, r12\n"
-                        "str r1, [r0, #4*4]\n"
-                        "mov r1, r13\n"
-                        "str r1, [r0, #5*4]\n"
-                        "mov r1, r14\n"
-                        "str r1, [r0, #6*4]\n"
-                        :
-                        : "r"(p_main_context.core.r)
-                        : "r0", "r1");
-        __asm volatile( ".thumb\n"
-                        ".syntax unified\n"
-                        // write the correct stack pointer to r0
-                        " mov   r1, lr\n"
-                        " movs   r7, #4\n"
-                        " tst   r1, r7\n"
-                        " bne a\n"
-                        " mrs r0, msp\n"
-                        " b done\n"
-                        "a: \n"
-                        " mrs r0, psp\n"
-                        "done:\n"
-                        " mov r1, lr \n"
-                        // call p_load_monitor_interrupt_handler
-                        " ldr r2,  =p_load_monitor_interrupt_handler  \n"
-                        " bx  r2  \n"
-                        :
-                        :
-                        : "r0", "r1", "r2");
-    }
+     */
+    FEATHERTRACE_NAKED_HANDLER(p_handler, p_main_context, p_load_monitor_interrupt_handler)
+
+#if FEATHERTRACE_PROFILER
+    /**
+     * Given a stack pointer, save the registers popped to it during the exception
+     * into p_profile_context and record a profiler sample.
+     * 
+     * @note Do not call this function outside of p_profile_handler!
+     * @param exception_args The stack pointer to unwind (MSP or PSP)
+     * @param exception_return_code unused.
+     */
+    volatile void __attribute__((__noinline__)) p_profile_interrupt_handler(
+        volatile unsigned *exception_args, unsigned exception_return_code);
+
+    /**
+     * Interrupt handler in Thumbv2 ASM for the profiler timer. Saves r4-r14 to 
+     * p_profile_context.core.r[4:14] then calls p_profile_interrupt_handler.
+     * 
+     * @note This function must be called through an exception. Do not call it directly!
+     */
+    FEATHERTRACE_NAKED_HANDLER(p_profile_handler, p_profile_context, p_profile_interrupt_handler)
+#endif
 }
 
+/** Set a naked FeatherTrace handler to trigger on a specified interrupt */
+#define FEATHERTRACE_BIND_HANDLER_TO(_name, _handler) extern "C" {\
+    void _name() __attribute__ ((alias(#_handler))); }
+
 /** Set p_handler to trigger on a specified interrupt */
-#define FEATHERTRACE_BIND_HANDLER(_name) extern "C" {\
-    void _name() __attribute__ ((alias("p_handler"))); }
+#define FEATHERTRACE_BIND_HANDLER(_name) FEATHERTRACE_BIND_HANDLER_TO(_name, p_handler)
 
 /** Bind p_handler to HardFault and WDT, which is the default for FeatherTrace functionality */
 #define FEATHERTRACE_BIND_ALL() \
     FEATHERTRACE_BIND_HANDLER(HardFault_Handler) \
     FEATHERTRACE_BIND_HANDLER(WDT_Handler)
+
+#if FEATHERTRACE_PROFILER
+/** Bind p_profile_handler to TC3, which is used as the profiler sample timer */
+#define FEATHERTRACE_BIND_PROFILER() \
+    FEATHERTRACE_BIND_HANDLER_TO(TC3_Handler, p_profile_handler)
+#endif
+#endif // ARDUINO_ARCH_SAMD
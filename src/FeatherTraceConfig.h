@@ -0,0 +1,338 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Build flags for FeatherTrace, shared by the device and host builds.
+ * Every flag can be set from the command line (ex. -DFEATHERTRACE_LOG_SLOTS=8),
+ * and most must be set for both the sketch and FeatherTrace.
+ */
+
+/**
+ * Maximum number of stack frames recorded for a fault (ex. -DMAX_STRACE=64).
+ * Frames are compressed when they are saved to flash, so deeper traces take
+ * little extra flash, see FEATHERTRACE_STRACE_BYTES.
+ * 
+ * This flag must be set for both the sketch and FeatherTrace.
+ */
+#ifndef MAX_STRACE
+#define MAX_STRACE 32
+#endif
+
+/**
+ * Maximum number of bytes of flash used by the stacktrace of each fault. Each frame
+ * is stored as the distance from the frame before it, which usually takes 2-3 bytes,
+ * and frames that don't fit are dropped starting from the deepest. The default
+ * (32 * 5) fits the default MAX_STRACE of 32 frames even if every distance takes
+ * the longest varint (5 bytes), so no frame is ever dropped without changing MAX_STRACE.
+ */
+#ifndef FEATHERTRACE_STRACE_BYTES
+#define FEATHERTRACE_STRACE_BYTES (32 * 5)
+#endif
+
+/**
+ * Build flag (ex. -DFEATHERTRACE_SAVE_REGISTERS=0) to stop saving the registers
+ * from the exception context with each fault, which removes FaultData::regs and
+ * FaultData::xpsr and saves up to 87 bytes of flash per fault. Registers are still
+ * used to unwind the stack. 1 (the default) saves them.
+ * 
+ * This flag must be set for both the sketch and FeatherTrace.
+ */
+#ifndef FEATHERTRACE_SAVE_REGISTERS
+#define FEATHERTRACE_SAVE_REGISTERS 1
+#endif
+
+/**
+ * Build flag (ex. -DFEATHERTRACE_SITE_IDS) to make MARK store a single 32-bit
+ * site ID computed at compile time from the filename and line number, instead
+ * of the line number and a filename pointer. This makes MARK a single word
+ * store, and the resulting fault is never marked as corrupted. Site IDs can be
+ * translated back into file:line with `recover_trace decode-site`.
+ * 
+ * This flag must be set for both the sketch and FeatherTrace.
+ */
+#ifdef FEATHERTRACE_SITE_IDS
+#define FEATHERTRACE_USE_SITE_IDS 1
+#else
+#define FEATHERTRACE_USE_SITE_IDS 0
+#endif
+
+/**
+ * Build flag (ex. -DFEATHERTRACE_MARK_HISTORY=64) to keep a ring of the last
+ * N MARKs in RAM that is not cleared on reset, and save it with every fault.
+ * N must be a power of two, or 0 to disable (the default).
+ * 
+ * This flag must be set for both the sketch and FeatherTrace.
+ */
+#ifndef FEATHERTRACE_MARK_HISTORY
+#define FEATHERTRACE_MARK_HISTORY 0
+#endif
+
+/**
+ * Build flag (ex. -DFEATHERTRACE_LOG_SLOTS=8) to set the size of the flash log,
+ * in the number of the largest possible faults it can hold. Each fault is written
+ * just after the newest one, so rows are only erased when the log wraps around,
+ * and since most faults are much smaller than the largest possible fault, the log
+ * usually holds many more. Each slot uses 512 bytes of flash without extra features.
+ */
+#ifndef FEATHERTRACE_LOG_SLOTS
+#define FEATHERTRACE_LOG_SLOTS 4
+#endif
+
+/**
+ * Build flag (ex. -DFEATHERTRACE_LOG_BYTES=4096) to set the size of the flash log
+ * in bytes instead, which must be a multiple of 256 and hold at least one of the
+ * largest possible faults. 0 (the default) uses FEATHERTRACE_LOG_SLOTS.
+ */
+#ifndef FEATHERTRACE_LOG_BYTES
+#define FEATHERTRACE_LOG_BYTES 0
+#endif
+
+/** Write a deferred fault to flash before main runs */
+#define FEATHERTRACE_COMMIT_ON_BOOT 1
+/** Only write a deferred fault to flash when FeatherTrace::CommitFault or a function reading the fault log is called */
+#define FEATHERTRACE_COMMIT_MANUAL 2
+
+/**
+ * Build flag (ex. -DFEATHERTRACE_DEFERRED_COMMIT=FEATHERTRACE_COMMIT_ON_BOOT) to make
+ * FeatherTrace::Fault save the fault to a CRC protected block of RAM that is not cleared
+ * on reset instead of flash, and reset immediately. The fault is written to flash after
+ * the reset, which shortens the time the fault handler takes. Faults will be lost if 
+ * power is removed before they are written. Only the first fault is kept until it is written,
+ * later ones are only counted in failnum. 0 (the default) writes to flash in the fault handler.
+ */
+#ifndef FEATHERTRACE_DEFERRED_COMMIT
+#define FEATHERTRACE_DEFERRED_COMMIT 0
+#endif
+
+/** Check for a heap/stack collision on every MARK (the default) */
+#define FEATHERTRACE_MEMCHECK_ALWAYS 0
+/** Check for a heap/stack collision every FEATHERTRACE_MEMCHECK_INTERVAL MARKs */
+#define FEATHERTRACE_MEMCHECK_EVERY_N 1
+/** Check for a heap/stack collision in the watchdog early warning interrupt, requires FeatherTrace::StartWDT */
+#define FEATHERTRACE_MEMCHECK_WDT 2
+/** 
+ * Check a guard word placed FEATHERTRACE_STACK_SIZE bytes below the top of the stack on every MARK.
+ * This check is a single load and compare, and will fault if the stack grows past FEATHERTRACE_STACK_SIZE
+ * or if the heap is written past the guard word. If the guard word can't be placed (the heap is
+ * already past it at startup) MARK checks the heap like FEATHERTRACE_MEMCHECK_ALWAYS instead.
+ */
+#define FEATHERTRACE_MEMCHECK_CANARY 3
+
+/**
+ * Build flag (ex. -DFEATHERTRACE_MEMCHECK=FEATHERTRACE_MEMCHECK_CANARY) to select how
+ * FeatherTrace detects FeatherTrace::FAULT_OUTOFMEMORY. Checking the heap on every MARK
+ * requires a call to sbrk, which can double the cost of MARK.
+ */
+#ifndef FEATHERTRACE_MEMCHECK
+#define FEATHERTRACE_MEMCHECK FEATHERTRACE_MEMCHECK_ALWAYS
+#endif
+
+/** Number of MARKs between checks for FEATHERTRACE_MEMCHECK_EVERY_N, must be a power of two */
+#ifndef FEATHERTRACE_MEMCHECK_INTERVAL
+#define FEATHERTRACE_MEMCHECK_INTERVAL 16
+#endif
+
+/** Number of bytes reserved for the stack for FEATHERTRACE_MEMCHECK_CANARY */
+#ifndef FEATHERTRACE_STACK_SIZE
+#define FEATHERTRACE_STACK_SIZE 8192
+#endif
+
+/**
+ * Build flag (ex. -DFEATHERTRACE_PROFILER=1) to enable the sampling profiler,
+ * see FeatherTrace::StartProfiler. The profiler uses TC3, and must be bound
+ * with FEATHERTRACE_BIND_PROFILER().
+ */
+#ifndef FEATHERTRACE_PROFILER
+#define FEATHERTRACE_PROFILER 0
+#endif
+
+/** Number of addresses the profiler can count, must be a power of two */
+#ifndef FEATHERTRACE_PROFILER_SLOTS
+#define FEATHERTRACE_PROFILER_SLOTS 256
+#endif
+
+/** 
+ * Number of stack frames recorded by each profiler sample. 1 records only the
+ * interrupted program counter, larger values also unwind the stack to count
+ * inclusive samples for callers (which is much slower).
+ */
+#ifndef FEATHERTRACE_PROFILER_DEPTH
+#define FEATHERTRACE_PROFILER_DEPTH 1
+#endif
+
+/**
+ * Build flag (ex. -DFEATHERTRACE_BUILTIN_UNWINDER=1) to record fault stacktraces
+ * with the unwinder in FeatherTraceUnwind.h instead of libgcc. The builtin
+ * unwinder only reads flash and RAM, and gives up after FEATHERTRACE_UNWIND_BUDGET
+ * steps, so a corrupted stack can't cause a second fault in the fault handler.
+ */
+#ifndef FEATHERTRACE_BUILTIN_UNWINDER
+#define FEATHERTRACE_BUILTIN_UNWINDER 0
+#endif
+
+/** Maximum number of unwind instructions and memory reads used by the builtin unwinder */
+#ifndef FEATHERTRACE_UNWIND_BUDGET
+#define FEATHERTRACE_UNWIND_BUDGET 2048
+#endif
+
+/**
+ * Number of bytes of the stack to save in the fault record for exceptions, starting
+ * from the interrupted stack pointer (ex. -DFEATHERTRACE_STACK_WINDOW=256).
+ * The saved window and registers can be unwound on a computer with tools/host,
+ * giving traces deeper than MAX_STRACE. Must be a multiple of 4, 0 to disable.
+ */
+#ifndef FEATHERTRACE_STACK_WINDOW
+#define FEATHERTRACE_STACK_WINDOW 0
+#endif
+
+/**
+ * Set to 0 to skip unwinding the stack on the device for exceptions, so
+ * FaultData::stacktrace only contains the program counter and link register.
+ * This makes the fault handler much faster, and is meant to be used with
+ * FEATHERTRACE_STACK_WINDOW.
+ */
+#ifndef FEATHERTRACE_DEVICE_UNWIND
+#define FEATHERTRACE_DEVICE_UNWIND 1
+#endif
+
+/**
+ * Build flag (ex. -DFEATHERTRACE_WDT_CHANNELS=4) to set the maximum number of
+ * watchdog channels that can be registered with FeatherTrace::RegisterWDTChannel.
+ * Each channel has its own deadline, and the watchdog is only fed if MARK has
+ * been called and every channel has been fed within its deadline. 0 to disable (the default).
+ */
+#ifndef FEATHERTRACE_WDT_CHANNELS
+#define FEATHERTRACE_WDT_CHANNELS 0
+#endif
+
+/**
+ * Set to 1 to enable FeatherTrace::SleepWDT, which slows the watchdog down to
+ * keep it running through a long sleep. The first MARK after waking puts the
+ * watchdog back to normal, so this adds a check to every MARK. The number of
+ * wakes is saved with every fault.
+ * 
+ * This flag must be set for both the sketch and FeatherTrace.
+ */
+#ifndef FEATHERTRACE_SLEEP_WDT
+#define FEATHERTRACE_SLEEP_WDT 0
+#endif
+
+/**
+ * Set to 1 to timestamp every MARK with HAL::Micros, keeping a histogram of the
+ * time between consecutive MARKs and the longest gap, see FeatherTrace::GetMarkLatency.
+ * This adds a call to micros() to every MARK, so it is disabled by default.
+ */
+#ifndef FEATHERTRACE_MARK_LATENCY
+#define FEATHERTRACE_MARK_LATENCY 0
+#endif
+
+/**
+ * Set to 1 to time each stage of FeatherTrace::Fault with a cycle counter, see
+ * FeatherTrace::GetFaultTiming. On the SAMD21 this uses TC4 and TC5 as a 32-bit
+ * counter at the CPU clock, so they can't be used by the sketch (ex. by Servo).
+ * Disabled by default.
+ */
+#ifndef FEATHERTRACE_BENCHMARK
+#define FEATHERTRACE_BENCHMARK 0
+#endif
+
+/**
+ * Set to 1 to paint the unused stack with a pattern before main, so the deepest
+ * stack usage can be found with FeatherTrace::ScanStack and saved with every fault.
+ */
+#ifndef FEATHERTRACE_STACK_PAINT
+#define FEATHERTRACE_STACK_PAINT 0
+#endif
+
+/**
+ * Number of words checked by each call to FeatherTrace::ScanStack, which is
+ * also called every time the watchdog is fed if FEATHERTRACE_STACK_PAINT is set.
+ */
+#ifndef FEATHERTRACE_STACK_SCAN_WORDS
+#define FEATHERTRACE_STACK_SCAN_WORDS 64
+#endif
+
+/**
+ * Set to 1 to count allocations made with malloc, calloc, realloc, and free, and keep
+ * the callers of the last FEATHERTRACE_HEAP_SITES allocations. The counters are
+ * saved with FeatherTrace::FAULT_OUTOFMEMORY faults, see FeatherTrace::GetHeapStats.
+ * The calls are intercepted with the linker, so the sketch must also be linked with:
+ * -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=free -Wl,--wrap=realloc
+ */
+#ifndef FEATHERTRACE_HEAP_HOOKS
+#define FEATHERTRACE_HEAP_HOOKS 0
+#endif
+
+/** Number of allocation callers kept by FEATHERTRACE_HEAP_HOOKS, must be a power of two */
+#ifndef FEATHERTRACE_HEAP_SITES
+#define FEATHERTRACE_HEAP_SITES 8
+#endif
+
+/**
+ * Build flag (ex. -DFEATHERTRACE_LOG_ENTRIES=64) to keep the last N FT_LOG events
+ * in RAM that is not cleared on reset. N must be a power of two, or 0 to disable
+ * (the default), in which case FT_LOG does nothing.
+ * 
+ * This flag must be set for both the sketch and FeatherTrace.
+ */
+#ifndef FEATHERTRACE_LOG_ENTRIES
+#define FEATHERTRACE_LOG_ENTRIES 0
+#endif
+
+/** Number of the newest FT_LOG events saved with every fault, at most FEATHERTRACE_LOG_ENTRIES */
+#ifndef FEATHERTRACE_LOG_SAVED
+#define FEATHERTRACE_LOG_SAVED 8
+#endif
+
+/** Maximum number of arguments to FT_LOG, each is stored as a single word */
+#define FEATHERTRACE_LOG_MAX_ARGS 4
+
+/**
+ * Set to 1 to save a signature with every fault: a hash of the cause, the MARK
+ * site (or file and line), and the stacktrace, see FeatherTrace::FaultData::signature.
+ * Faults from the same bug have the same signature, so a device can report just
+ * the signature instead of the whole record. The stacktrace is hashed as addresses,
+ * so signatures only match between devices running the same build. Disabled by default.
+ */
+#ifndef FEATHERTRACE_SIGNATURE
+#define FEATHERTRACE_SIGNATURE 0
+#endif
+
+namespace FeatherTrace {
+    /**
+     * The build flags above as constants, for code that would rather use
+     * `if (FeatherTrace::Config::save_registers)` than the preprocessor. See
+     * FeatherTraceRecord.h for the size of a fault record and the flash log.
+     */
+    struct Config {
+        /** See MAX_STRACE */
+        static constexpr size_t trace_depth = MAX_STRACE;
+        /** See FEATHERTRACE_STRACE_BYTES */
+        static constexpr size_t trace_bytes = FEATHERTRACE_STRACE_BYTES;
+        /** See FEATHERTRACE_SAVE_REGISTERS */
+        static constexpr bool save_registers = FEATHERTRACE_SAVE_REGISTERS != 0;
+        /** See FEATHERTRACE_MARK_HISTORY */
+        static constexpr size_t mark_history = FEATHERTRACE_MARK_HISTORY;
+        /** See FEATHERTRACE_STACK_WINDOW */
+        static constexpr size_t stack_window = FEATHERTRACE_STACK_WINDOW;
+        /** See FEATHERTRACE_SLEEP_WDT */
+        static constexpr bool sleep_wdt = FEATHERTRACE_SLEEP_WDT != 0;
+        /** See FEATHERTRACE_SIGNATURE */
+        static constexpr bool signature = FEATHERTRACE_SIGNATURE != 0;
+        /** See FEATHERTRACE_LOG_ENTRIES */
+        static constexpr size_t log_entries = FEATHERTRACE_LOG_ENTRIES;
+        /** See FEATHERTRACE_LOG_SAVED, 0 if FT_LOG is disabled */
+        static constexpr size_t log_saved = FEATHERTRACE_LOG_ENTRIES > 0 ? FEATHERTRACE_LOG_SAVED : 0;
+        /** See FEATHERTRACE_HEAP_SITES, 0 if FEATHERTRACE_HEAP_HOOKS is disabled */
+        static constexpr size_t heap_sites = FEATHERTRACE_HEAP_HOOKS ? FEATHERTRACE_HEAP_SITES : 0;
+        /** See FEATHERTRACE_LOG_SLOTS */
+        static constexpr size_t log_slots = FEATHERTRACE_LOG_SLOTS;
+        /** See FEATHERTRACE_LOG_BYTES */
+        static constexpr size_t log_bytes = FEATHERTRACE_LOG_BYTES;
+    };
+
+    static_assert(Config::trace_depth >= 2, "MAX_STRACE must be at least 2");
+    static_assert(Config::trace_bytes >= 5, "FEATHERTRACE_STRACE_BYTES must hold at least one frame");
+    static_assert(Config::log_bytes % 256 == 0, "FEATHERTRACE_LOG_BYTES must be a multiple of 256");
+}
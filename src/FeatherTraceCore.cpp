@@ -0,0 +1,1340 @@
+#include "FeatherTraceCore.h"
+#include "FeatherTraceHAL.h"
+#if FEATHERTRACE_HEAP_HOOKS
+#include <malloc.h>
+#endif
+
+/** Size of an NVM row, the smallest amount of flash that can be erased */
+static constexpr size_t FLASH_ROW_SIZE = 256;
+
+/**
+ * Check for a completely written record at an offset in the flash log.
+ * @return The size of the record in bytes, or 0 if there isn't one.
+ */
+static inline size_t flash_record_at(const size_t offset) {
+    return FeatherTrace::Record::CheckRecord(FeatherTrace::HAL::GetFlashLog() + offset, FLASH_LOG_SIZE - offset);
+}
+
+/** Get the header of a record in the flash log checked with flash_record_at or scan_log */
+static inline const RecordHeader& flash_header_at(const size_t offset) {
+    return *reinterpret_cast<const RecordHeader*>(FeatherTrace::HAL::GetFlashLog() + offset);
+}
+
+/** A well-formed record header in the flash log, found by scan_log. The CRC may not match. */
+struct LogEntry {
+    uint32_t offset;
+    uint32_t failnum;
+};
+
+/** Most headers the flash log can hold, if every record was empty */
+static constexpr size_t MAX_LOG_ENTRIES = FLASH_LOG_SIZE / sizeof(RecordHeader);
+
+/**
+ * Find every well-formed record header in the flash log in a single pass, checking
+ * the CRC of none of them, so callers only pay for the CRCs of the records they use.
+ * Headers are skipped over by their length, so only a header with a corrupted length
+ * can hide the records after it (RecordHeader::head is written last, so an interrupted
+ * write can't).
+ * @param entries[out] The headers, oldest (lowest failnum) first.
+ * @return The number of headers found.
+ */
+static size_t scan_log(LogEntry (&entries)[MAX_LOG_ENTRIES]) {
+    size_t count = 0;
+    for (size_t offset = 0; offset + sizeof(RecordHeader) <= FLASH_LOG_SIZE; ) {
+        const size_t size = FeatherTrace::Record::CheckHeader(FeatherTrace::HAL::GetFlashLog() + offset, FLASH_LOG_SIZE - offset);
+        if (size == 0) {
+            offset += 4;
+            continue;
+        }
+        // records are written in failnum order, so only the ones after a wrap move more than a step
+        const uint32_t failnum = flash_header_at(offset).failnum;
+        size_t i = count++;
+        for (; i > 0 && entries[i - 1].failnum > failnum; i--)
+            entries[i] = entries[i - 1];
+        entries[i] = { static_cast<uint32_t>(offset), failnum };
+        offset += size;
+    }
+    return count;
+}
+
+/**
+ * Find a record in the flash log by age, using failnum as the sequence number.
+ * @param index 0 for the newest record, 1 for the one before it, etc.
+ * @return The offset of the record, or FLASH_LOG_SIZE if there are not that many records.
+ */
+static size_t find_record(const size_t index) {
+    LogEntry entries[MAX_LOG_ENTRIES];
+    size_t valid = 0;
+    for (size_t i = scan_log(entries); i > 0; i--) {
+        if (flash_record_at(entries[i - 1].offset) != 0 && valid++ == index)
+            return entries[i - 1].offset;
+    }
+    return FLASH_LOG_SIZE;
+}
+
+/**
+ * Find the newest record in the flash log, without the memory scan_log needs, for the
+ * fault handler. A pass over the headers finds the highest failnum, and only that record's
+ * CRC is checked. If it fails (rare), the next pass looks for the highest below it.
+ * @param size_out[out] Set to the size of the record in bytes.
+ * @return The offset of the record, or FLASH_LOG_SIZE if there are none.
+ */
+static size_t find_newest(size_t& size_out) {
+    uint32_t below = UINT32_MAX;
+    while (true) {
+        size_t found = FLASH_LOG_SIZE;
+        for (size_t offset = 0; offset + sizeof(RecordHeader) <= FLASH_LOG_SIZE; ) {
+            const size_t size = FeatherTrace::Record::CheckHeader(FeatherTrace::HAL::GetFlashLog() + offset, FLASH_LOG_SIZE - offset);
+            if (size == 0) {
+                offset += 4;
+                continue;
+            }
+            const uint32_t failnum = flash_header_at(offset).failnum;
+            if (failnum < below && (found == FLASH_LOG_SIZE || failnum > flash_header_at(found).failnum))
+                found = offset;
+            offset += size;
+        }
+        if (found == FLASH_LOG_SIZE)
+            return FLASH_LOG_SIZE;
+        size_out = flash_record_at(found);
+        if (size_out != 0)
+            return found;
+        below = flash_header_at(found).failnum;
+    }
+}
+
+/** Global atmoic bool to check if the watchdog has been fed, we use a boolean instead of WDT_Reset because watchdog synchronization is slow */
+static volatile std::atomic_bool should_feed_watchdog(false);
+/** Value of wdt_configured_period before the watchdog is configured */
+static constexpr uint8_t WDT_UNCONFIGURED = 0xFF;
+/** True if the watchdog should be running, see FeatherTrace::Core::RequestWatchdog */
+static volatile bool wdt_target_enabled = false;
+/** FeatherTrace::WDTTimeout the watchdog should be running with */
+static volatile uint8_t wdt_target_period = WDT_UNCONFIGURED;
+/** FeatherTrace::WDTTimeout the watchdog was last configured with */
+static volatile uint8_t wdt_configured_period = WDT_UNCONFIGURED;
+/** FeatherTrace::WDTTimeout the early warning was last configured for, set after wdt_configured_period */
+static volatile uint8_t wdt_configured_warning = WDT_UNCONFIGURED;
+/** True if the watchdog counter should be reset once the watchdog is done synchronizing */
+static volatile bool wdt_clear_pending = false;
+#if FEATHERTRACE_SLEEP_WDT
+/** True between FeatherTrace::Core::SleepWatchdog and WakeWatchdog, checked by MARK */
+static volatile bool wdt_asleep = false;
+/** Number of times FeatherTrace::Core::WakeWatchdog has woken the watchdog */
+static volatile uint32_t wdt_wake_count = 0;
+#endif
+/** Global atomic bool to specify that last_line or last_file are being written to, determines if a fault happened while they were being written */
+static volatile std::atomic_bool is_being_written(false);
+/** Global variable to store the last line MARKed, written by FeatherTrace::_Mark and read by FeatherTrace::HandleFault */
+static volatile int last_line = 0;
+/** Global variable to store the last filename, written by FeatherTrace::_Mark and read by FeatherTrace::HandleFault */
+static volatile const char* last_file = "";
+/** Global variable to store the last MARK site ID if FEATHERTRACE_SITE_IDS is set, written by FeatherTrace::mark_site */
+static volatile uint32_t last_site = 0;
+#if FEATHERTRACE_MARK_HISTORY > 0
+static_assert((FEATHERTRACE_MARK_HISTORY & (FEATHERTRACE_MARK_HISTORY - 1)) == 0, "FEATHERTRACE_MARK_HISTORY must be a power of two");
+
+/** Magic number indicating mark_history survived a reset, instead of containing garbage from power up */
+static constexpr uint32_t MARK_HISTORY_MAGIC = 0x4D48494Eu;
+
+/**
+ * Ring buffer of the last MARKs, written by FeatherTrace::mark and read by FeatherTrace::Fault.
+ * This is stored in the .noinit section so it is not cleared by the startup code, which allows the
+ * history to survive a reset.
+ */
+static struct {
+    uint32_t magic;
+    uint32_t index;
+    uint32_t marks[FEATHERTRACE_MARK_HISTORY];
+} mark_history __attribute__((section(".noinit")));
+
+/** Clear mark_history if it contains garbage from power up, run before main */
+static void __attribute__((constructor)) init_mark_history() {
+    if (mark_history.magic != MARK_HISTORY_MAGIC) {
+        mark_history.index = 0;
+        for (size_t i = 0; i < FEATHERTRACE_MARK_HISTORY; i++)
+            mark_history.marks[i] = 0;
+        mark_history.magic = MARK_HISTORY_MAGIC;
+    }
+}
+
+/**
+ * Pack a line and filename into a single word for mark_history: the low 14 bits
+ * store the line, and the upper 18 bits store the filename pointer (which is in
+ * flash, and the SAMD21 has at most 256KB of flash).
+ */
+static inline uint32_t mark_history_entry(const int line, const char* file) {
+    return (static_cast<uint32_t>(reinterpret_cast<uintptr_t>(file)) << 14) | (static_cast<uint32_t>(line) & 0x3FFF);
+}
+#endif
+
+#if FEATHERTRACE_WDT_CHANNELS > 0
+static_assert(FEATHERTRACE_WDT_CHANNELS < FeatherTrace::WDT_CHANNEL_INVALID, "FEATHERTRACE_WDT_CHANNELS must be less than 255");
+
+/** A watchdog channel registered with FeatherTrace::RegisterWDTChannel */
+typedef struct {
+    /** Name of the channel, nullptr if this channel is not registered */
+    const char* name;
+    uint32_t deadline_ms;
+    /** HAL::Millis() when the channel was last fed, written by FeatherTrace::FeedWDTChannel */
+    volatile uint32_t last_fed;
+} wdt_channel_t;
+
+/** Registered watchdog channels, checked in the watchdog interrupt by FeatherTrace::Fault */
+static volatile wdt_channel_t wdt_channels[FEATHERTRACE_WDT_CHANNELS];
+#endif
+
+#if FEATHERTRACE_HEAP_HOOKS
+static_assert((FEATHERTRACE_HEAP_SITES & (FEATHERTRACE_HEAP_SITES - 1)) == 0, "FEATHERTRACE_HEAP_SITES must be a power of two");
+
+/** Heap counters and recent allocations, written by the malloc, realloc, and free wrappers */
+static struct {
+    FeatherTrace::HeapStats stats;
+    uint32_t index;
+    FeatherTrace::HeapSite sites[FEATHERTRACE_HEAP_SITES];
+} heap_hooks = {};
+
+/**
+ * Count a block of memory added to or removed from the heap. Blocks allocated
+ * inside the C library were never counted, so freeing one can remove more than
+ * live_bytes holds: stop at 0 instead of wrapping around, which would also
+ * leave peak_bytes near 4GB for the rest of the run.
+ */
+static inline void heap_count(const uint32_t allocated, const uint32_t freed) {
+    const uint32_t live = heap_hooks.stats.live_bytes + allocated;
+    heap_hooks.stats.live_bytes = live > freed ? live - freed : 0;
+    if (heap_hooks.stats.live_bytes > heap_hooks.stats.peak_bytes)
+        heap_hooks.stats.peak_bytes = heap_hooks.stats.live_bytes;
+}
+
+/** Count an allocation, and remember who made it */
+static inline void heap_count_alloc(void* ptr, const size_t size, void* caller) {
+    if (ptr == nullptr) {
+        heap_hooks.stats.failed_count++;
+        return;
+    }
+    heap_hooks.stats.alloc_count++;
+    FeatherTrace::HeapSite& site = heap_hooks.sites[heap_hooks.index++ & (FEATHERTRACE_HEAP_SITES - 1)];
+    site.caller = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(caller));
+    site.size = static_cast<uint32_t>(size);
+}
+
+extern "C" {
+    void* __real_malloc(size_t size);
+    void* __real_calloc(size_t count, size_t size);
+    void* __real_realloc(void* ptr, size_t size);
+    void __real_free(void* ptr);
+
+    /** Called instead of malloc if the sketch is linked with -Wl,--wrap=malloc */
+    void* __wrap_malloc(size_t size) {
+        void* const ptr = __real_malloc(size);
+        if (ptr != nullptr)
+            heap_count(malloc_usable_size(ptr), 0);
+        heap_count_alloc(ptr, size, __builtin_return_address(0));
+        return ptr;
+    }
+
+    /** Called instead of calloc if the sketch is linked with -Wl,--wrap=calloc */
+    void* __wrap_calloc(size_t count, size_t size) {
+        void* const ptr = __real_calloc(count, size);
+        if (ptr != nullptr)
+            heap_count(malloc_usable_size(ptr), 0);
+        heap_count_alloc(ptr, count * size, __builtin_return_address(0));
+        return ptr;
+    }
+
+    /** Called instead of realloc if the sketch is linked with -Wl,--wrap=realloc */
+    void* __wrap_realloc(void* ptr, size_t size) {
+        const uint32_t old_size = ptr != nullptr ? malloc_usable_size(ptr) : 0;
+        void* const result = __real_realloc(ptr, size);
+        if (result != nullptr) {
+            heap_count(malloc_usable_size(result), old_size);
+            heap_count_alloc(result, size, __builtin_return_address(0));
+            // the old block is replaced (even if it didn't move), so allocs - frees stays the number of live blocks
+            if (ptr != nullptr)
+                heap_hooks.stats.free_count++;
+        }
+        // realloc(ptr, 0) frees ptr
+        else if (size == 0) {
+            if (ptr != nullptr)
+                heap_hooks.stats.free_count++;
+            heap_count(0, old_size);
+        }
+        else
+            heap_count_alloc(nullptr, size, nullptr);
+        return result;
+    }
+
+    /** Called instead of free if the sketch is linked with -Wl,--wrap=free */
+    void __wrap_free(void* ptr) {
+        if (ptr != nullptr) {
+            heap_hooks.stats.free_count++;
+            heap_count(0, malloc_usable_size(ptr));
+        }
+        __real_free(ptr);
+    }
+}
+#endif
+
+#if FEATHERTRACE_LOG_ENTRIES > 0
+static_assert((FEATHERTRACE_LOG_ENTRIES & (FEATHERTRACE_LOG_ENTRIES - 1)) == 0, "FEATHERTRACE_LOG_ENTRIES must be a power of two");
+static_assert(FEATHERTRACE_LOG_SAVED <= FEATHERTRACE_LOG_ENTRIES, "FEATHERTRACE_LOG_SAVED must be at most FEATHERTRACE_LOG_ENTRIES");
+
+/** Magic number indicating event_log survived a reset, instead of containing garbage from power up */
+static constexpr uint32_t EVENT_LOG_MAGIC = 0x46544C47u;
+/** Number of words in an event_log entry, a header followed by the arguments */
+static constexpr size_t LOG_ENTRY_WORDS = 1 + FEATHERTRACE_LOG_MAX_ARGS;
+
+/**
+ * Ring buffer of the last FT_LOG events, written by FeatherTrace::log_words and read by
+ * FeatherTrace::Fault. This is stored in the .noinit section so it survives a reset.
+ */
+static struct {
+    uint32_t magic;
+    volatile uint32_t index;
+    volatile uint32_t entries[FEATHERTRACE_LOG_ENTRIES][LOG_ENTRY_WORDS];
+} event_log __attribute__((section(".noinit")));
+
+/** Clear event_log if it contains garbage from power up, run before main */
+static void __attribute__((constructor)) init_event_log() {
+    if (event_log.magic != EVENT_LOG_MAGIC) {
+        event_log.index = 0;
+        for (size_t i = 0; i < FEATHERTRACE_LOG_ENTRIES; i++)
+            event_log.entries[i][0] = 0;
+        event_log.magic = EVENT_LOG_MAGIC;
+    }
+}
+
+/**
+ * Pack the format string address and argument count into the first word of an entry:
+ * the low 28 bits store the address, and the upper 4 bits store the argument count.
+ * A header of 0 marks an entry that is empty or still being written.
+ */
+static inline uint32_t log_header(const char* format, const uint32_t count) {
+    return (static_cast<uint32_t>(reinterpret_cast<uintptr_t>(format)) & 0x0FFFFFFF) | (count << 28);
+}
+
+/** Copy the newest FT_LOG entries oldest first in the event_log format, skipping incomplete entries */
+static size_t copy_event_log(uint32_t (*out)[LOG_ENTRY_WORDS], const size_t max_entries) {
+    const uint32_t end = event_log.index;
+    const uint32_t len = end < FEATHERTRACE_LOG_ENTRIES ? end : FEATHERTRACE_LOG_ENTRIES;
+    const uint32_t first = end - (len < max_entries ? len : max_entries);
+    size_t count = 0;
+    for (uint32_t i = first; i != end; i++) {
+        const volatile uint32_t* const entry = event_log.entries[i & (FEATHERTRACE_LOG_ENTRIES - 1)];
+        if (entry[0] == 0)
+            continue;
+        for (size_t w = 0; w < LOG_ENTRY_WORDS; w++)
+            out[count][w] = entry[w];
+        count++;
+    }
+    return count;
+}
+
+/** Print a single event_log entry, in the format read by `recover_trace decode-log` */
+static void print_log_entry(Print& where, const uint32_t* entry) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "0x%08lx:", static_cast<unsigned long>(entry[0] & 0x0FFFFFFF));
+    where.print(buf);
+    const uint32_t count = entry[0] >> 28;
+    for (uint32_t i = 0; i < count && i < FEATHERTRACE_LOG_MAX_ARGS; i++) {
+        snprintf(buf, sizeof(buf), " 0x%08lx", static_cast<unsigned long>(entry[1 + i]));
+        where.print(buf);
+    }
+    where.println();
+}
+#endif
+
+#if FEATHERTRACE_MARK_LATENCY
+/** Time between MARKs, written by FeatherTrace::mark and FeatherTrace::mark_site */
+static struct {
+    /** HAL::Micros() of the last MARK */
+    uint32_t last_us;
+    /** False if there hasn't been a MARK since boot or FeatherTrace::ClearMarkLatency */
+    bool has_last;
+    FeatherTrace::MarkLocation last;
+    FeatherTrace::MarkLatency stats;
+} mark_latency = {};
+
+/** Record the time since the last MARK, and remember where this one is */
+static inline void mark_latency_record(const int line, const char* file, const uint32_t site) {
+    const uint32_t now = FeatherTrace::HAL::Micros();
+    const FeatherTrace::MarkLocation here = { line, file, site };
+    if (mark_latency.has_last) {
+        // unsigned subtraction handles micros rolling over
+        const uint32_t gap = now - mark_latency.last_us;
+        // log2 of the gap, with 0 and 1 both in the first bucket
+        const size_t bucket = gap > 1 ? 31 - __builtin_clz(gap) : 0;
+        mark_latency.stats.buckets[bucket]++;
+        mark_latency.stats.count++;
+        if (gap > mark_latency.stats.worst_us) {
+            mark_latency.stats.worst_us = gap;
+            mark_latency.stats.worst_from = mark_latency.last;
+            mark_latency.stats.worst_to = here;
+        }
+    }
+    mark_latency.last_us = now;
+    mark_latency.last = here;
+    mark_latency.has_last = true;
+}
+
+/** Print where a MARK was placed, for FeatherTrace::PrintMarkLatency */
+static void print_mark_location(Print& where, const FeatherTrace::MarkLocation& location) {
+    if (location.file == nullptr) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "0x%08lx", static_cast<unsigned long>(location.site));
+        where.print(buf);
+    }
+    else {
+        where.print(location.file);
+        where.print(":");
+        where.print(static_cast<int>(location.line));
+    }
+}
+#endif
+
+#if FEATHERTRACE_MEMCHECK == FEATHERTRACE_MEMCHECK_EVERY_N
+static_assert((FEATHERTRACE_MEMCHECK_INTERVAL & (FEATHERTRACE_MEMCHECK_INTERVAL - 1)) == 0, "FEATHERTRACE_MEMCHECK_INTERVAL must be a power of two");
+/** Number of MARKs since boot, used to sample the memory check */
+static uint32_t memcheck_count = 0;
+#elif FEATHERTRACE_MEMCHECK == FEATHERTRACE_MEMCHECK_CANARY
+/** Value of the stack guard word */
+static constexpr uint32_t STACK_CANARY = 0xCAFEF00Du;
+/**
+ * Pointer to the stack guard word, checked by FeatherTrace::mark. nullptr if the guard
+ * could not be placed, in which case MARK falls back to FeatherTrace::Core::MemoryCollided.
+ */
+static volatile uint32_t* canary_ptr = nullptr;
+
+/** Place the stack guard word, run before main so the heap is still small */
+static void __attribute__((constructor)) init_stack_canary() {
+    const uintptr_t stack_top = FeatherTrace::HAL::GetStackTop();
+    if (stack_top == 0)
+        return;
+    volatile uint32_t* const guard = reinterpret_cast<volatile uint32_t*>(stack_top - FEATHERTRACE_STACK_SIZE);
+    char top;
+    // only place the guard if it is between the heap and the stack
+    const int guard_depth = &top - reinterpret_cast<volatile char*>(guard);
+    if (guard_depth > 0 && guard_depth < FeatherTrace::HAL::FreeMemory()) {
+        *guard = STACK_CANARY;
+        canary_ptr = guard;
+    }
+}
+#endif
+
+#if FEATHERTRACE_STACK_PAINT
+/** Value painted on the unused stack */
+static constexpr uint32_t STACK_PAINT = 0xDEADBEEFu;
+/** Number of bytes left unpainted below the frame of paint_stack */
+static constexpr uintptr_t STACK_PAINT_MARGIN = 64;
+
+/** State of the painted stack, read and written by FeatherTrace::ScanStack */
+static struct {
+    /** Lowest stack address known to have been used, 0 if the stack was not painted */
+    uintptr_t low_water;
+    /** Next address to be checked by FeatherTrace::ScanStack, 0 to start a new pass from the heap */
+    uintptr_t cursor;
+} stack_paint = {};
+
+/** Returns true if addr is the stack guard word, which is never painted */
+static inline bool is_stack_canary(const uintptr_t addr) {
+#if FEATHERTRACE_MEMCHECK == FEATHERTRACE_MEMCHECK_CANARY
+    return addr == reinterpret_cast<uintptr_t>(canary_ptr);
+#else
+    (void)addr;
+    return false;
+#endif
+}
+
+/** Paint the stack between the heap and this function's frame, run before main */
+static void __attribute__((constructor)) paint_stack() {
+    const uintptr_t heap_end = FeatherTrace::HAL::GetHeapEnd();
+    if (heap_end == 0 || FeatherTrace::HAL::GetStackTop() == 0)
+        return;
+    char top;
+    const uintptr_t start = (heap_end + 3) & ~static_cast<uintptr_t>(3);
+    const uintptr_t end = (reinterpret_cast<uintptr_t>(&top) - STACK_PAINT_MARGIN) & ~static_cast<uintptr_t>(3);
+    for (uintptr_t addr = start; addr < end; addr += 4) {
+        if (!is_stack_canary(addr))
+            *reinterpret_cast<volatile uint32_t*>(addr) = STACK_PAINT;
+    }
+    stack_paint.low_water = end;
+}
+#endif
+
+#if FEATHERTRACE_SLEEP_WDT
+/** Called by every MARK to put the watchdog back to normal after FeatherTrace::SleepWDT */
+static inline void mark_wake_check() {
+    if (wdt_asleep)
+        FeatherTrace::Core::WakeWatchdog();
+}
+#endif
+
+/** Called by every MARK to check the heap and stack, according to FEATHERTRACE_MEMCHECK */
+static inline void mark_memory_check() {
+#if FEATHERTRACE_MEMCHECK == FEATHERTRACE_MEMCHECK_ALWAYS
+    if (FeatherTrace::Core::MemoryCollided())
+        FeatherTrace::Fault(FeatherTrace::FAULT_OUTOFMEMORY);
+#elif FEATHERTRACE_MEMCHECK == FEATHERTRACE_MEMCHECK_EVERY_N
+    if ((++memcheck_count & (FEATHERTRACE_MEMCHECK_INTERVAL - 1)) == 0 && FeatherTrace::Core::MemoryCollided())
+        FeatherTrace::Fault(FeatherTrace::FAULT_OUTOFMEMORY);
+#elif FEATHERTRACE_MEMCHECK == FEATHERTRACE_MEMCHECK_CANARY
+    if (canary_ptr != nullptr ? *canary_ptr != STACK_CANARY : FeatherTrace::Core::MemoryCollided())
+        FeatherTrace::Fault(FeatherTrace::FAULT_OUTOFMEMORY);
+#endif
+    // FEATHERTRACE_MEMCHECK_WDT is checked in FeatherTrace::Fault
+}
+
+#if FEATHERTRACE_BENCHMARK
+/** Magic number indicating fault_timing holds the timing of a fault */
+static constexpr uint32_t FAULT_TIMING_MAGIC = 0x54494D45u;
+
+/**
+ * Timing of the last fault, see FeatherTrace::GetFaultTiming. This is stored
+ * in the .noinit section so it can be read after the reset.
+ */
+static struct {
+    uint32_t magic;
+    FeatherTrace::FaultTiming timing;
+} fault_timing __attribute__((section(".noinit")));
+
+/** State of the fault being timed */
+static struct {
+    /** True between FeatherTrace::Core::BeginFaultTiming and EndFaultTiming */
+    bool active;
+    /** HAL::Cycles() when the fault started */
+    uint32_t start;
+    /** HAL::Cycles() when the last stage ended */
+    uint32_t last;
+} fault_timer = {};
+#endif
+
+/** Returns true if [offset, offset + len) in the flash log is erased */
+static bool flash_blank(const size_t offset, const size_t len) {
+    const uint32_t* const flash_u32 = reinterpret_cast<const uint32_t*>(FeatherTrace::HAL::GetFlashLog() + offset);
+    for (size_t i = 0; i < len / 4; i++) {
+        if (flash_u32[i] != 0xFFFFFFFF)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Write a sealed record to the flash log just after the newest record, wrapping
+ * around to the start of the log if it doesn't fit. Rows are only erased if they
+ * aren't already blank, erasing the oldest records in them, and HAL::WriteFlash
+ * writes RecordHeader::head last, marking the record valid.
+ * @param record Record to save to flash.
+ * @param newest Offset of the newest record, or FLASH_LOG_SIZE if there isn't one.
+ * @param newest_size Size of the newest record in bytes.
+ */
+static void write_to_flash(const EncodedRecord_t& record, const size_t newest, const size_t newest_size) {
+    const size_t len = (sizeof(RecordHeader) + record.data.header.length + 3) / 4 * 4;
+    size_t offset = newest != FLASH_LOG_SIZE ? newest + newest_size : 0;
+    // the rest of the row after the newest record should be blank, but a write may have been interrupted
+    const size_t row_end = (offset + FLASH_ROW_SIZE - 1) / FLASH_ROW_SIZE * FLASH_ROW_SIZE;
+    if (!flash_blank(offset, (row_end < offset + len ? row_end : offset + len) - offset))
+        offset = row_end;
+    if (offset + len > FLASH_LOG_SIZE)
+        offset = 0;
+    FEATHERTRACE_END_STAGE(STAGE_FIND);
+    // erase the rows after the newest record, only if they've been written to since they were last erased
+    for (size_t row = (offset + FLASH_ROW_SIZE - 1) / FLASH_ROW_SIZE * FLASH_ROW_SIZE; row < offset + len; row += FLASH_ROW_SIZE) {
+        if (!flash_blank(row, FLASH_ROW_SIZE))
+            FeatherTrace::HAL::EraseFlash(row, FLASH_ROW_SIZE);
+    }
+    FEATHERTRACE_END_STAGE(STAGE_ERASE);
+    FeatherTrace::HAL::WriteFlash(offset, record.raw_u32, len / 4);
+    FEATHERTRACE_END_STAGE(STAGE_WRITE);
+}
+
+/**
+ * Write an encoded record to the flash log after the newest record.
+ * @param record[in,out] Record to save, sealed with the failure number of the newest record + 1.
+ */
+static void commit_encoded_record(EncodedRecord_t& record, const uint32_t dropped = 0) {
+    size_t newest_size = 0;
+    const size_t newest = find_newest(newest_size);
+    // faults that were never written still count towards failnum
+    FeatherTrace::Record::SealRecord(record, (newest != FLASH_LOG_SIZE ? flash_header_at(newest).failnum + 1 : 1) + dropped);
+    write_to_flash(record, newest, newest_size);
+}
+
+#if FEATHERTRACE_DEFERRED_COMMIT
+/** Magic number indicating pending_fault contains a fault waiting to be written to flash */
+static constexpr uint32_t PENDING_FAULT_MAGIC = 0x50454E44u;
+
+/**
+ * A fault saved by FeatherTrace::Fault that has not been written to flash yet.
+ * This is stored in the .noinit section so it survives the reset, and the CRC of
+ * the encoded record detects if RAM was corrupted before it was written.
+ */
+static struct {
+    uint32_t magic;
+    /** Number of faults after this one that were dropped because it had not been written yet */
+    uint32_t dropped;
+    EncodedRecord_t record;
+} pending_fault __attribute__((section(".noinit")));
+
+/** Returns true if pending_fault holds a fault waiting to be written, and RAM has not corrupted it */
+static bool has_pending_fault() {
+    // a warm reset can't corrupt RAM, but a power loss or brownout can
+    return pending_fault.magic == PENDING_FAULT_MAGIC
+        && FeatherTrace::Record::CheckRecord(reinterpret_cast<const uint8_t*>(pending_fault.record.raw_u32), sizeof(pending_fault.record)) != 0;
+}
+
+#if FEATHERTRACE_DEFERRED_COMMIT == FEATHERTRACE_COMMIT_ON_BOOT
+/** Write a pending fault to flash as soon as the device boots, run before main */
+static void __attribute__((constructor)) commit_on_boot() {
+    FeatherTrace::Core::CommitPendingRecord();
+}
+#endif
+#endif
+
+/* See FeatherTraceCore.h */
+bool FeatherTrace::Core::IsWatchdogFed() {
+    return should_feed_watchdog.load();
+}
+
+/* See FeatherTraceCore.h */
+void FeatherTrace::Core::ClearWatchdogFed() {
+    should_feed_watchdog.store(false);
+}
+
+/* See FeatherTraceCore.h */
+void FeatherTrace::Core::RequestWatchdog(const bool enable, const uint8_t period) {
+    const uint32_t state = FeatherTrace::HAL::DisableInterrupts();
+#if FEATHERTRACE_SLEEP_WDT
+    // put the clock back first, or synchronizing could take seconds
+    if (wdt_asleep) {
+        FeatherTrace::HAL::SlowWatchdog(0, false);
+        wdt_asleep = false;
+    }
+#endif
+    wdt_target_enabled = enable;
+    if (enable)
+        wdt_target_period = period;
+    FeatherTrace::HAL::RestoreInterrupts(state);
+}
+
+/* See FeatherTraceCore.h */
+bool FeatherTrace::Core::ServiceWatchdog() {
+    // the watchdog interrupt calls this too, so keep it out from between checking and writing
+    const uint32_t state = FeatherTrace::HAL::DisableInterrupts();
+    bool done = false;
+    if (!FeatherTrace::HAL::WatchdogSyncing()) {
+        const bool enabled = FeatherTrace::HAL::WatchdogEnabled();
+        if (!wdt_target_enabled) {
+            wdt_clear_pending = false;
+            if (enabled)
+                FeatherTrace::HAL::EnableWatchdog(false);
+            else
+                done = true;
+        }
+        else if (wdt_configured_period != wdt_target_period || wdt_configured_warning != wdt_target_period) {
+            // the timeout can only be changed while the watchdog is disabled, and the period
+            // and early warning are synchronized separately, so each is written by its own call
+            if (enabled)
+                FeatherTrace::HAL::EnableWatchdog(false);
+            else if (wdt_configured_period != wdt_target_period) {
+                FeatherTrace::HAL::ConfigureWatchdogPeriod(wdt_target_period);
+                wdt_configured_period = wdt_target_period;
+            }
+            else {
+                FeatherTrace::HAL::ConfigureWatchdogWarning(wdt_target_period);
+                wdt_configured_warning = wdt_target_period;
+            }
+        }
+        else if (!enabled) {
+            FeatherTrace::HAL::EnableWatchdog(true);
+            // start from a full period
+            wdt_clear_pending = true;
+        }
+        else if (wdt_clear_pending) {
+            FeatherTrace::HAL::ClearWatchdog();
+            wdt_clear_pending = false;
+        }
+        else
+            done = true;
+    }
+    FeatherTrace::HAL::RestoreInterrupts(state);
+    return done;
+}
+
+/* See FeatherTraceCore.h */
+void FeatherTrace::Core::FeedWatchdog() {
+    wdt_clear_pending = true;
+    FeatherTrace::Core::ServiceWatchdog();
+}
+
+#if FEATHERTRACE_SLEEP_WDT
+/* See FeatherTraceCore.h */
+void FeatherTrace::Core::SleepWatchdog(const uint32_t sleep_ms) {
+    if (!wdt_target_enabled)
+        return;
+    // the early warning interrupt comes about 2^(period + 2) ms after the counter is reset
+    uint8_t shift = 0;
+    while (shift < FeatherTrace::HAL::WATCHDOG_MAX_SLOWDOWN && (1ul << (wdt_target_period + 2 + shift)) < sleep_ms)
+        shift++;
+    const uint32_t state = FeatherTrace::HAL::DisableInterrupts();
+    if (!FeatherTrace::HAL::WatchdogSyncing()) {
+        // start the sleep with a full period, and fault if it runs out before a MARK
+        FeatherTrace::HAL::ClearWatchdog();
+        wdt_clear_pending = false;
+        FeatherTrace::Core::ClearWatchdogFed();
+    }
+    else {
+        // the counter can't be reset yet, so let the next early warning reset it instead of faulting
+        wdt_clear_pending = true;
+        should_feed_watchdog.store(true);
+    }
+    FeatherTrace::HAL::SlowWatchdog(shift, true);
+    wdt_asleep = true;
+    FeatherTrace::HAL::RestoreInterrupts(state);
+}
+
+/* See FeatherTraceCore.h */
+void FeatherTrace::Core::WakeWatchdog() {
+    const uint32_t state = FeatherTrace::HAL::DisableInterrupts();
+    if (wdt_asleep) {
+        FeatherTrace::HAL::SlowWatchdog(0, false);
+        wdt_asleep = false;
+        wdt_wake_count = wdt_wake_count + 1;
+        // the counter may be close to running out at the normal speed
+        FeatherTrace::Core::FeedWatchdog();
+    }
+    FeatherTrace::HAL::RestoreInterrupts(state);
+}
+
+/* See FeatherTraceCore.h */
+uint32_t FeatherTrace::Core::GetWakeCount() {
+    return wdt_wake_count;
+}
+#endif
+
+/* See FeatherTraceCore.h */
+int FeatherTrace::Core::GetStarvedChannel() {
+#if FEATHERTRACE_WDT_CHANNELS > 0
+    const uint32_t now = FeatherTrace::HAL::Millis();
+    for (size_t i = 0; i < FEATHERTRACE_WDT_CHANNELS; i++) {
+        // unsigned subtraction handles millis rolling over
+        if (wdt_channels[i].name != nullptr && now - wdt_channels[i].last_fed > wdt_channels[i].deadline_ms)
+            return static_cast<int>(i);
+    }
+#endif
+    return -1;
+}
+
+#if FEATHERTRACE_BENCHMARK
+/* See FeatherTraceCore.h */
+void FeatherTrace::Core::BeginFaultTiming() {
+    fault_timing.magic = 0;
+    fault_timing.timing = FeatherTrace::FaultTiming();
+    fault_timing.timing.cycles_per_second = FeatherTrace::HAL::CyclesPerSecond();
+    fault_timer.active = true;
+    fault_timer.start = fault_timer.last = FeatherTrace::HAL::Cycles();
+}
+
+/* See FeatherTraceCore.h */
+void FeatherTrace::Core::EndFaultStage(const FeatherTrace::FaultStage stage) {
+    // the flash log is also written outside of a fault
+    if (!fault_timer.active)
+        return;
+    const uint32_t now = FeatherTrace::HAL::Cycles();
+    fault_timing.timing.cycles[stage] += now - fault_timer.last;
+    fault_timer.last = now;
+}
+
+/* See FeatherTraceCore.h */
+void FeatherTrace::Core::EndFaultTiming() {
+    fault_timing.timing.total = FeatherTrace::HAL::Cycles() - fault_timer.start;
+    fault_timing.magic = FAULT_TIMING_MAGIC;
+    fault_timer.active = false;
+}
+
+/* See FeatherTraceCore.h */
+bool FeatherTrace::Core::GetFaultTiming(FeatherTrace::FaultTiming& out) {
+    if (fault_timing.magic != FAULT_TIMING_MAGIC)
+        return false;
+    out = fault_timing.timing;
+    return true;
+}
+#endif
+
+/* See FeatherTraceCore.h */
+bool FeatherTrace::Core::MemoryCollided() {
+    const int mem = FeatherTrace::HAL::FreeMemory();
+    return mem < 0 || mem > 60000;
+}
+
+/* See FeatherTraceCore.h */
+FeatherTrace::FaultCause FeatherTrace::Core::DecideCause(const FaultCause cause, const uint32_t interrupt_type) {
+    if (cause != FeatherTrace::FAULT_UNKNOWN)
+        return cause;
+    // check to see if we know what kind of interrupt we're in
+    if (interrupt_type == FeatherTrace::HAL::SCB_WDTEW)
+        return FeatherTrace::FAULT_HUNG;
+    if (interrupt_type == FeatherTrace::HAL::SCB_HARDFAULT)
+        return FeatherTrace::FAULT_HARDFAULT;
+    return FeatherTrace::FAULT_UNKNOWN;
+}
+
+/* See FeatherTraceCore.h */
+void FeatherTrace::Core::BuildRecord(FaultDataFlash_t& trace, const FaultCause cause) {
+    trace.data.cause = DecideCause(cause, trace.data.interrupt_type);
+    // site IDs are written with a single store, so they can't be corrupted
+#if FEATHERTRACE_USE_SITE_IDS
+    trace.data.is_corrupted = 0;
+    trace.data.site = last_site;
+#else
+    // check if FeatherTrace may have been the cause (oops)
+    trace.data.is_corrupted = is_being_written.load() ? 1 : 0;
+    trace.data.site = 0;
+#endif
+    // write cause, line, and file info
+    trace.data.line = last_line;
+    // if the pointer was being written and we interrupted it, we don't want to make things worse
+    if (!trace.data.is_corrupted) {
+        const volatile char* index = last_file;
+        uint32_t i = 0;
+        for (; i < sizeof(trace.data.file) - 1 && *index != '\0'; i++)
+            trace.data.file[i] = *(index++);
+        trace.data.file[i] = '\0';
+    }
+    else
+        trace.data.file[0] = '\0'; // Corrupted!
+#if FEATHERTRACE_MARK_HISTORY > 0
+    // copy the mark history, oldest first
+    const uint32_t end = mark_history.index;
+    const uint32_t len = end < FEATHERTRACE_MARK_HISTORY ? end : FEATHERTRACE_MARK_HISTORY;
+    trace.data.mark_history_len = len;
+    for (uint32_t i = 0; i < len; i++)
+        trace.data.mark_history[i] = mark_history.marks[(end - len + i) & (FEATHERTRACE_MARK_HISTORY - 1)];
+#endif
+#if FEATHERTRACE_WDT_CHANNELS > 0
+    // save the channel that caused the watchdog to trigger, if any
+    const int starved = trace.data.cause == FeatherTrace::FAULT_HUNG ? GetStarvedChannel() : -1;
+    size_t c = 0;
+    if (starved >= 0) {
+        const char* const name = wdt_channels[starved].name;
+        for (; c < sizeof(trace.data.starved_channel) - 1 && name[c] != '\0'; c++)
+            trace.data.starved_channel[c] = name[c];
+    }
+    trace.data.starved_channel[c] = '\0';
+#endif
+#if FEATHERTRACE_HEAP_HOOKS
+    // save who has been using the heap if we ran out
+    if (trace.data.cause == FeatherTrace::FAULT_OUTOFMEMORY) {
+        const FeatherTrace::HeapStats stats = FeatherTrace::GetHeapStats();
+        const uint32_t stats_u32[] = { stats.live_bytes, stats.peak_bytes, stats.alloc_count,
+            stats.free_count, stats.failed_count, stats.largest_free };
+        for (size_t i = 0; i < 6; i++)
+            trace.data.heap_stats[i] = stats_u32[i];
+        FeatherTrace::HeapSite sites[FEATHERTRACE_HEAP_SITES];
+        const size_t count = FeatherTrace::GetHeapSites(sites, FEATHERTRACE_HEAP_SITES);
+        trace.data.heap_sites_len = count;
+        for (size_t i = 0; i < count; i++) {
+            trace.data.heap_sites[i][0] = sites[i].caller;
+            trace.data.heap_sites[i][1] = sites[i].size;
+        }
+    }
+#endif
+#if FEATHERTRACE_LOG_ENTRIES > 0
+    // save the tail of the event log
+    trace.data.log_len = copy_event_log(trace.data.log, FEATHERTRACE_LOG_SAVED);
+#endif
+#if FEATHERTRACE_STACK_PAINT
+    // finish the scan, so the value is exact
+    trace.data.stack_high_water = FeatherTrace::ScanStack(SIZE_MAX);
+#endif
+#if FEATHERTRACE_SLEEP_WDT
+    trace.data.wake_count = wdt_wake_count;
+#endif
+#if FEATHERTRACE_SIGNATURE
+    trace.data.signature = ComputeSignature(trace);
+#endif
+}
+
+#if FEATHERTRACE_SIGNATURE
+/* See FeatherTraceCore.h */
+uint32_t FeatherTrace::Core::ComputeSignature(const FaultDataFlash_t& trace) {
+    // must match get_device_signature in tools/recover_trace/recover_trace.py
+    uint32_t hash = _ShortFilePrivate::fnv1a_u32(trace.data.cause, _ShortFilePrivate::fnv1a_basis);
+    if (trace.data.site != 0)
+        hash = _ShortFilePrivate::fnv1a_u32(trace.data.site, hash);
+    else {
+        // the filename is empty if the record is corrupted
+        for (size_t i = 0; i < sizeof(trace.data.file) && trace.data.file[i] != '\0'; i++)
+            hash = _ShortFilePrivate::fnv1a_byte(hash, static_cast<uint8_t>(trace.data.file[i]));
+        hash = _ShortFilePrivate::fnv1a_u32(static_cast<uint32_t>(trace.data.line), hash);
+    }
+    for (size_t i = 0; i < MAX_STRACE && trace.data.stacktrace[i] != 0; i++)
+        hash = _ShortFilePrivate::fnv1a_u32(trace.data.stacktrace[i], hash);
+    return hash;
+}
+#endif
+
+/* See FeatherTraceCore.h */
+void FeatherTrace::Core::SaveRecord(FaultDataFlash_t& trace) {
+#if FEATHERTRACE_DEFERRED_COMMIT
+    // keep the first of several faults before a commit, which is most likely the cause of
+    // the others, and only count the rest
+    if (has_pending_fault())
+        pending_fault.dropped++;
+    else {
+        // save the encoded record to RAM, it will be written to flash after the reset
+        FeatherTrace::Record::EncodeRecord(trace, pending_fault.record);
+        FeatherTrace::Record::SealRecord(pending_fault.record, 0);
+        pending_fault.dropped = 0;
+        pending_fault.magic = PENDING_FAULT_MAGIC;
+    }
+    FEATHERTRACE_END_STAGE(STAGE_ENCODE);
+#else
+    // write the collected data to flash!
+    CommitRecord(trace);
+#endif
+}
+
+/* See FeatherTraceCore.h */
+void FeatherTrace::Core::CommitRecord(FaultDataFlash_t& trace) {
+    EncodedRecord_t record;
+    FeatherTrace::Record::EncodeRecord(trace, record);
+    FEATHERTRACE_END_STAGE(STAGE_ENCODE);
+    commit_encoded_record(record);
+    trace.data.failnum = record.data.header.failnum;
+}
+
+/* See FeatherTraceCore.h */
+bool FeatherTrace::Core::CommitPendingRecord() {
+#if FEATHERTRACE_DEFERRED_COMMIT
+    if (pending_fault.magic != PENDING_FAULT_MAGIC)
+        return false;
+    if (has_pending_fault())
+        commit_encoded_record(pending_fault.record, pending_fault.dropped);
+    pending_fault.magic = 0;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* See FeatherTraceCore.h */
+bool FeatherTrace::Core::GetRecord(const size_t index, FaultDataFlash_t& out) {
+    const size_t offset = find_record(index);
+    if (offset == FLASH_LOG_SIZE)
+        return false;
+    FeatherTrace::Record::DecodeRecord(FeatherTrace::HAL::GetFlashLog() + offset, out);
+    return true;
+}
+
+/* See FeatherTraceCore.h */
+size_t FeatherTrace::Core::GetRecordCount() {
+    LogEntry entries[MAX_LOG_ENTRIES];
+    const size_t found = scan_log(entries);
+    size_t count = 0;
+    for (size_t i = 0; i < found; i++) {
+        if (flash_record_at(entries[i].offset) != 0)
+            count++;
+    }
+    return count;
+}
+
+/* See FeatherTraceCore.h */
+void FeatherTrace::Core::CopyRecord(const FaultDataFlash_t& trace, FaultData& ret) {
+    ret.cause = static_cast<FeatherTrace::FaultCause>(trace.data.cause);
+    ret.interrupt_type = trace.data.interrupt_type;
+    for (size_t i = 0; i < MAX_STRACE; i++)
+        ret.stacktrace[i] = trace.data.stacktrace[i];
+#if FEATHERTRACE_SAVE_REGISTERS
+    for (size_t i = 0; i < 16; i++)
+        ret.regs[i] = trace.data.regs[i];
+    ret.xpsr = trace.data.xpsr;
+#endif
+    ret.is_corrupted = trace.data.is_corrupted;
+    ret.failnum = trace.data.failnum;
+    ret.line = trace.data.line;
+    for(size_t i = 0; i < sizeof(ret.file); i++)
+        ret.file[i] = trace.data.file[i];
+    ret.site = trace.data.site;
+#if FEATHERTRACE_MARK_HISTORY > 0
+    ret.mark_history_len = trace.data.mark_history_len;
+    for (size_t i = 0; i < FEATHERTRACE_MARK_HISTORY; i++)
+        ret.mark_history[i] = trace.data.mark_history[i];
+#endif
+#if FEATHERTRACE_STACK_WINDOW > 0
+    ret.stack_window_addr = trace.data.stack_window_addr;
+    ret.stack_window_len = trace.data.stack_window_len;
+    for (size_t i = 0; i < FEATHERTRACE_STACK_WINDOW / 4; i++)
+        ret.stack_window[i] = trace.data.stack_window[i];
+#endif
+#if FEATHERTRACE_WDT_CHANNELS > 0
+    for (size_t i = 0; i < sizeof(ret.starved_channel); i++)
+        ret.starved_channel[i] = trace.data.starved_channel[i];
+#endif
+#if FEATHERTRACE_STACK_PAINT
+    ret.stack_high_water = trace.data.stack_high_water;
+#endif
+#if FEATHERTRACE_SLEEP_WDT
+    ret.wake_count = trace.data.wake_count;
+#endif
+#if FEATHERTRACE_SIGNATURE
+    ret.signature = trace.data.signature;
+#endif
+#if FEATHERTRACE_HEAP_HOOKS
+    ret.heap_stats.live_bytes = trace.data.heap_stats[0];
+    ret.heap_stats.peak_bytes = trace.data.heap_stats[1];
+    ret.heap_stats.alloc_count = trace.data.heap_stats[2];
+    ret.heap_stats.free_count = trace.data.heap_stats[3];
+    ret.heap_stats.failed_count = trace.data.heap_stats[4];
+    ret.heap_stats.largest_free = trace.data.heap_stats[5];
+    ret.heap_sites_len = trace.data.heap_sites_len;
+    for (size_t i = 0; i < FEATHERTRACE_HEAP_SITES; i++) {
+        ret.heap_sites[i].caller = trace.data.heap_sites[i][0];
+        ret.heap_sites[i].size = trace.data.heap_sites[i][1];
+    }
+#endif
+#if FEATHERTRACE_LOG_ENTRIES > 0
+    ret.log_len = trace.data.log_len;
+    for (size_t i = 0; i < FEATHERTRACE_LOG_SAVED; i++) {
+        ret.log[i].token = trace.data.log[i][0] & 0x0FFFFFFF;
+        ret.log[i].arg_count = trace.data.log[i][0] >> 28;
+        for (size_t a = 0; a < FEATHERTRACE_LOG_MAX_ARGS; a++)
+            ret.log[i].args[a] = trace.data.log[i][1 + a];
+    }
+#endif
+}
+
+/* See FeatherTraceCore.h */
+void FeatherTrace::Core::PrintRecord(Print& where, const FaultDataFlash_t& trace) {
+    where.print("Fault! Cause: ");
+    where.println(FeatherTrace::GetCauseString(static_cast<FeatherTrace::FaultCause>(trace.data.cause)));
+    where.print("Fault during recording: ");
+    where.println(trace.data.is_corrupted ? "Yes" : "No");
+    if (trace.data.site != 0) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "0x%08lx", static_cast<unsigned long>(trace.data.site));
+        where.print("Site: ");
+        where.println(buf);
+    }
+    else {
+        where.print("Line: ");
+        where.println(trace.data.line);
+        where.print("File: ");
+        where.println(trace.data.file);
+    }
+#if FEATHERTRACE_WDT_CHANNELS > 0
+    if (trace.data.starved_channel[0] != '\0') {
+        where.print("Starved channel: ");
+        where.println(trace.data.starved_channel);
+    }
+#endif
+    where.print("Interrupt type: ");
+    where.println(trace.data.interrupt_type);
+    where.print("Stacktrace: ");
+    for (size_t i = 0; ; i++) {
+        char buf[24];
+        snprintf(buf, sizeof(buf), "0x%08lx", static_cast<unsigned long>(trace.data.stacktrace[i]));
+        where.print(buf);
+        if (i + 1 < MAX_STRACE
+            && trace.data.stacktrace[i + 1] != 0)
+            where.print(", ");
+        else
+            break;
+    }
+    where.println();
+#if FEATHERTRACE_SAVE_REGISTERS
+    if (trace.data.interrupt_type != 0) {
+        char buf[32];
+        where.println("Registers: ");
+        for (unsigned int i = 0; i < 13; i++) {
+            snprintf(buf, sizeof(buf), "\tR%u: 0x%08lx", i, static_cast<unsigned long>(trace.data.regs[i]));
+            where.print(buf);
+        }
+        snprintf(buf, sizeof(buf), "\tSP: 0x%08lx", static_cast<unsigned long>(trace.data.regs[13]));
+        where.print(buf);
+        snprintf(buf, sizeof(buf), "\tLR: 0x%08lx", static_cast<unsigned long>(trace.data.regs[14]));
+        where.print(buf);
+        snprintf(buf, sizeof(buf), "\tPC: 0x%08lx", static_cast<unsigned long>(trace.data.regs[15]));
+        where.print(buf);
+        snprintf(buf, sizeof(buf), "\txPSR: 0x%08lx", static_cast<unsigned long>(trace.data.xpsr));
+        where.println(buf);
+    }
+#endif
+#if FEATHERTRACE_MARK_HISTORY > 0
+    where.println("Mark history (oldest first): ");
+    for (uint32_t i = 0; i < trace.data.mark_history_len && i < FEATHERTRACE_MARK_HISTORY; i++) {
+        const uint32_t entry = trace.data.mark_history[i];
+        where.print("\t");
+#if FEATHERTRACE_USE_SITE_IDS || !defined(ARDUINO)
+        // on a computer the filename pointer doesn't fit in the entry, so print it raw
+        char buf[16];
+        snprintf(buf, sizeof(buf), "0x%08lx", static_cast<unsigned long>(entry));
+        where.println(buf);
+#else
+        where.print(FeatherTrace::GetMarkFile(entry));
+        where.print(":");
+        where.println(FeatherTrace::GetMarkLine(entry));
+#endif
+    }
+#endif
+#if FEATHERTRACE_STACK_WINDOW > 0
+    if (trace.data.stack_window_len > 0) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "0x%08lx", static_cast<unsigned long>(trace.data.stack_window_addr));
+        where.print("Stack window at ");
+        where.print(buf);
+        where.println(": ");
+        const uint32_t len = trace.data.stack_window_len;
+        const uint32_t words = (len < FEATHERTRACE_STACK_WINDOW ? len : FEATHERTRACE_STACK_WINDOW) / 4;
+        for (uint32_t i = 0; i < words; i++) {
+            snprintf(buf, sizeof(buf), "%08lx", static_cast<unsigned long>(trace.data.stack_window[i]));
+            where.print((i & 7) == 0 ? "\t" : " ");
+            where.print(buf);
+            if ((i & 7) == 7 || i + 1 == words)
+                where.println();
+        }
+    }
+#endif
+#if FEATHERTRACE_HEAP_HOOKS
+    if (trace.data.cause == FeatherTrace::FAULT_OUTOFMEMORY) {
+        char buf[48];
+        static const char* const names[] = { "Live", "Peak", "Allocs", "Frees", "Failed", "Largest free" };
+        where.println("Heap: ");
+        for (size_t i = 0; i < 6; i++) {
+            snprintf(buf, sizeof(buf), "\t%s: %lu", names[i], static_cast<unsigned long>(trace.data.heap_stats[i]));
+            where.println(buf);
+        }
+        where.println("Recent allocations (oldest first): ");
+        for (uint32_t i = 0; i < trace.data.heap_sites_len && i < FEATHERTRACE_HEAP_SITES; i++) {
+            snprintf(buf, sizeof(buf), "\t0x%08lx: %lu bytes",
+                static_cast<unsigned long>(trace.data.heap_sites[i][0]),
+                static_cast<unsigned long>(trace.data.heap_sites[i][1]));
+            where.println(buf);
+        }
+    }
+#endif
+#if FEATHERTRACE_LOG_ENTRIES > 0
+    if (trace.data.log_len > 0) {
+        where.println("Log (oldest first): ");
+        for (uint32_t i = 0; i < trace.data.log_len && i < FEATHERTRACE_LOG_SAVED; i++) {
+            where.print("\t");
+            print_log_entry(where, trace.data.log[i]);
+        }
+    }
+#endif
+#if FEATHERTRACE_STACK_PAINT
+    where.print("Stack high water: ");
+    where.print(static_cast<unsigned long>(trace.data.stack_high_water));
+    where.println(" bytes");
+#endif
+#if FEATHERTRACE_SLEEP_WDT
+    where.print("Wakes since boot: ");
+    where.println(static_cast<unsigned long>(trace.data.wake_count));
+#endif
+#if FEATHERTRACE_SIGNATURE
+    char signature[16];
+    snprintf(signature, sizeof(signature), "0x%08lx", static_cast<unsigned long>(trace.data.signature));
+    where.print("Signature: ");
+    where.println(signature);
+#endif
+    where.print("Failures since upload: ");
+    where.println(trace.data.failnum);
+}
+
+#if FEATHERTRACE_WDT_CHANNELS > 0
+/* See FeatherTrace.h */
+FeatherTrace::WDTChannel FeatherTrace::RegisterWDTChannel(const char* name, const uint32_t deadline_ms) {
+    for (size_t i = 0; i < FEATHERTRACE_WDT_CHANNELS; i++) {
+        if (wdt_channels[i].name == nullptr) {
+            wdt_channels[i].deadline_ms = deadline_ms;
+            wdt_channels[i].last_fed = FeatherTrace::HAL::Millis();
+            // written last, since the watchdog interrupt checks it first
+            wdt_channels[i].name = name;
+            return static_cast<FeatherTrace::WDTChannel>(i);
+        }
+    }
+    return FeatherTrace::WDT_CHANNEL_INVALID;
+}
+
+/* See FeatherTrace.h */
+void FeatherTrace::UnregisterWDTChannel(const FeatherTrace::WDTChannel channel) {
+    if (channel < FEATHERTRACE_WDT_CHANNELS)
+        wdt_channels[channel].name = nullptr;
+}
+
+/* See FeatherTrace.h */
+void FeatherTrace::FeedWDTChannel(const FeatherTrace::WDTChannel channel) {
+    if (channel < FEATHERTRACE_WDT_CHANNELS)
+        wdt_channels[channel].last_fed = FeatherTrace::HAL::Millis();
+}
+#endif
+
+#if FEATHERTRACE_STACK_PAINT
+/* See FeatherTrace.h */
+uint32_t FeatherTrace::ScanStack(const size_t max_words) {
+    if (stack_paint.low_water == 0)
+        return 0;
+    // words below the end of the heap belong to the heap, even if they were painted
+    const uintptr_t heap_end = (FeatherTrace::HAL::GetHeapEnd() + 3) & ~static_cast<uintptr_t>(3);
+    uintptr_t cursor = stack_paint.cursor > heap_end ? stack_paint.cursor : heap_end;
+    // the first word that isn't painted is the deepest the stack has reached
+    for (size_t i = 0; i < max_words && cursor < stack_paint.low_water; i++, cursor += 4) {
+        if (*reinterpret_cast<volatile uint32_t*>(cursor) != STACK_PAINT && !is_stack_canary(cursor)) {
+            stack_paint.low_water = cursor;
+            break;
+        }
+    }
+    // start a new pass next time if this one has finished
+    stack_paint.cursor = cursor < stack_paint.low_water ? cursor : 0;
+    return FeatherTrace::GetStackHighWater();
+}
+
+/* See FeatherTrace.h */
+uint32_t FeatherTrace::GetStackHighWater() {
+    if (stack_paint.low_water == 0)
+        return 0;
+    return static_cast<uint32_t>(FeatherTrace::HAL::GetStackTop() - stack_paint.low_water);
+}
+#endif
+
+#if FEATHERTRACE_HEAP_HOOKS
+/* See FeatherTrace.h */
+FeatherTrace::HeapStats FeatherTrace::GetHeapStats() {
+    FeatherTrace::HeapStats stats = heap_hooks.stats;
+    const int free = FeatherTrace::HAL::FreeMemory();
+    stats.largest_free = free > 0 ? static_cast<uint32_t>(free) : 0;
+    return stats;
+}
+
+/* See FeatherTrace.h */
+size_t FeatherTrace::GetHeapSites(FeatherTrace::HeapSite* out, const size_t max_entries) {
+    const uint32_t end = heap_hooks.index;
+    uint32_t len = end < FEATHERTRACE_HEAP_SITES ? end : FEATHERTRACE_HEAP_SITES;
+    if (len > max_entries)
+        len = max_entries;
+    for (uint32_t i = 0; i < len; i++)
+        out[i] = heap_hooks.sites[(end - len + i) & (FEATHERTRACE_HEAP_SITES - 1)];
+    return len;
+}
+#endif
+
+#if FEATHERTRACE_LOG_ENTRIES > 0
+/* See FeatherTrace.h */
+void FeatherTrace::log_words(const char* format, const uint32_t* args, const uint32_t count) {
+    // claim an entry, the SAMD21 has no atomic increment so interrupts are disabled instead
+    const uint32_t state = FeatherTrace::HAL::DisableInterrupts();
+    const uint32_t index = event_log.index;
+    event_log.index = index + 1;
+    FeatherTrace::HAL::RestoreInterrupts(state);
+    // write the header last, so a fault while writing the entry will skip it
+    volatile uint32_t* const entry = event_log.entries[index & (FEATHERTRACE_LOG_ENTRIES - 1)];
+    entry[0] = 0;
+    for (uint32_t i = 0; i < count; i++)
+        entry[1 + i] = args[i];
+    entry[0] = log_header(format, count);
+}
+
+/* See FeatherTrace.h */
+size_t FeatherTrace::GetLog(FeatherTrace::LogEntry* out, const size_t max_entries) {
+    uint32_t entries[FEATHERTRACE_LOG_ENTRIES][LOG_ENTRY_WORDS];
+    const size_t count = copy_event_log(entries, max_entries);
+    for (size_t i = 0; i < count; i++) {
+        out[i].token = entries[i][0] & 0x0FFFFFFF;
+        out[i].arg_count = entries[i][0] >> 28;
+        for (size_t a = 0; a < FEATHERTRACE_LOG_MAX_ARGS; a++)
+            out[i].args[a] = entries[i][1 + a];
+    }
+    return count;
+}
+
+/* See FeatherTrace.h */
+void FeatherTrace::PrintLog(Print& where) {
+    uint32_t entries[FEATHERTRACE_LOG_ENTRIES][LOG_ENTRY_WORDS];
+    const size_t count = copy_event_log(entries, FEATHERTRACE_LOG_ENTRIES);
+    where.println("Log (oldest first): ");
+    for (size_t i = 0; i < count; i++)
+        print_log_entry(where, entries[i]);
+}
+#endif
+
+#if FEATHERTRACE_MARK_LATENCY
+/* See FeatherTrace.h */
+FeatherTrace::MarkLatency FeatherTrace::GetMarkLatency() {
+    return mark_latency.stats;
+}
+
+/* See FeatherTrace.h */
+void FeatherTrace::ClearMarkLatency() {
+    mark_latency.has_last = false;
+    mark_latency.stats = FeatherTrace::MarkLatency();
+}
+
+/* See FeatherTrace.h */
+void FeatherTrace::PrintMarkLatency(Print& where) {
+    const FeatherTrace::MarkLatency stats = FeatherTrace::GetMarkLatency();
+    where.print("MARK gaps: ");
+    where.print(static_cast<unsigned long>(stats.count));
+    where.print(", worst: ");
+    where.print(static_cast<unsigned long>(stats.worst_us));
+    where.println(" us");
+    if (stats.count > 0) {
+        where.print("Worst gap from ");
+        print_mark_location(where, stats.worst_from);
+        where.print(" to ");
+        print_mark_location(where, stats.worst_to);
+        where.println();
+    }
+    where.println("Gap (us), count");
+    for (size_t i = 0; i < FeatherTrace::MARK_LATENCY_BUCKETS; i++) {
+        if (stats.buckets[i] == 0)
+            continue;
+        char buf[40];
+        snprintf(buf, sizeof(buf), "%lu-%lu, %lu",
+            i == 0 ? 0ul : 1ul << i,
+            (2ul << i) - 1,
+            static_cast<unsigned long>(stats.buckets[i]));
+        where.println(buf);
+    }
+}
+#endif
+
+/* See FeatherTrace.h */
+void FeatherTrace::mark(const int line, const char* file) {
+    // feed the watchdog
+    should_feed_watchdog.store(true);
+#if FEATHERTRACE_SLEEP_WDT
+    mark_wake_check();
+#endif
+    // write the last marked data
+    is_being_written.store(true);
+    last_line = line;
+    last_file = file;
+    is_being_written.store(false);
+#if FEATHERTRACE_MARK_HISTORY > 0
+    mark_history.marks[mark_history.index++ & (FEATHERTRACE_MARK_HISTORY - 1)] = mark_history_entry(line, file);
+#endif
+#if FEATHERTRACE_MARK_LATENCY
+    mark_latency_record(line, file, 0);
+#endif
+    // check for a stackoverflow
+    mark_memory_check();
+}
+
+/* See FeatherTrace.h */
+void FeatherTrace::mark_site(const uint32_t site) {
+    // feed the watchdog
+    should_feed_watchdog.store(true);
+#if FEATHERTRACE_SLEEP_WDT
+    mark_wake_check();
+#endif
+    // a single word store, no need to guard it with is_being_written
+    last_site = site;
+#if FEATHERTRACE_MARK_HISTORY > 0
+    mark_history.marks[mark_history.index++ & (FEATHERTRACE_MARK_HISTORY - 1)] = site;
+#endif
+#if FEATHERTRACE_MARK_LATENCY
+    mark_latency_record(0, nullptr, site);
+#endif
+    // check for a stackoverflow
+    mark_memory_check();
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "FeatherTrace.h"
+#include "FeatherTraceRecord.h"
+
+/**
+ * Portable FeatherTrace logic, used by the public API in FeatherTrace.cpp.
+ * Nothing in FeatherTraceCore.cpp touches hardware directly, it uses
+ * FeatherTraceHAL.h instead so it can be built and run on a computer.
+ */
+
+namespace FeatherTrace {
+namespace Core {
+
+    /** Returns true if MARK has been called since the last call to ClearWatchdogFed */
+    bool IsWatchdogFed();
+
+    /** Wait for another MARK before feeding the watchdog */
+    void ClearWatchdogFed();
+
+    /**
+     * Set the state the watchdog should be in, which is applied by ServiceWatchdog.
+     * @param enable true to run the watchdog, false to stop it.
+     * @param period Value of FeatherTrace::WDTTimeout to run the watchdog with.
+     */
+    void RequestWatchdog(const bool enable, const uint8_t period);
+
+    /**
+     * If the watchdog is not synchronizing, make the next write needed to bring it
+     * to the state from RequestWatchdog, or the write from FeedWatchdog. Never waits.
+     * @return true if the watchdog is in the requested state with nothing left to write.
+     */
+    bool ServiceWatchdog();
+
+    /** Reset the watchdog counter, now if the watchdog is not synchronizing or later from ServiceWatchdog */
+    void FeedWatchdog();
+
+#if FEATHERTRACE_SLEEP_WDT
+    /**
+     * Slow down the watchdog and keep it running in standby, so the early warning
+     * interrupt comes at least sleep_ms from now. Does nothing if the watchdog isn't running.
+     * @param sleep_ms Longest expected sleep in milliseconds.
+     */
+    void SleepWatchdog(const uint32_t sleep_ms);
+
+    /** Undo SleepWatchdog and count a wake, does nothing if the watchdog isn't asleep */
+    void WakeWatchdog();
+
+    /** Get the number of times WakeWatchdog has woken the watchdog since boot */
+    uint32_t GetWakeCount();
+#endif
+
+    /**
+     * Find a watchdog channel that has missed its deadline, see FeatherTrace::RegisterWDTChannel.
+     * @return The index of the channel, or -1 if every channel has been fed (or FEATHERTRACE_WDT_CHANNELS is 0).
+     */
+    int GetStarvedChannel();
+
+    /** Returns true if the heap and stack have collided */
+    bool MemoryCollided();
+
+#if FEATHERTRACE_BENCHMARK
+    /** Start timing a fault, see FeatherTrace::GetFaultTiming */
+    void BeginFaultTiming();
+
+    /**
+     * Add the cycles since the last stage ended to a stage, if a fault is being timed.
+     * Use FEATHERTRACE_END_STAGE instead, which compiles to nothing without FEATHERTRACE_BENCHMARK.
+     */
+    void EndFaultStage(const FaultStage stage);
+
+    /** Finish timing a fault, just before the reset */
+    void EndFaultTiming();
+
+    /** See FeatherTrace::GetFaultTiming */
+    bool GetFaultTiming(FaultTiming& out);
+#endif
+
+    /**
+     * Decide the cause of a fault, using the interrupt type if the cause is unknown.
+     * @param cause Cause passed to FeatherTrace::Fault.
+     * @param interrupt_type Exception FeatherTrace::Fault was called from, see HAL::SCBFaultType.
+     * @return The cause to save in the fault record.
+     */
+    FaultCause DecideCause(const FaultCause cause, const uint32_t interrupt_type);
+
+    /**
+     * Fill the cause and MARK information of a fault record (everything except
+     * the stacktrace and registers, see HAL::CaptureTrace).
+     * @param trace[in,out] Record to fill, trace.data.interrupt_type must be set,
+     * and the stacktrace must be captured if FEATHERTRACE_SIGNATURE is set.
+     * @param cause Cause passed to FeatherTrace::Fault.
+     */
+    void BuildRecord(FaultDataFlash_t& trace, const FaultCause cause);
+
+#if FEATHERTRACE_SIGNATURE
+    /**
+     * Compute FeatherTrace::FaultData::signature of a fault record.
+     * @param trace Record with the cause, MARK information, and stacktrace filled in.
+     */
+    uint32_t ComputeSignature(const FaultDataFlash_t& trace);
+#endif
+
+    /**
+     * Encode and save a completed fault record, to flash or to RAM if FEATHERTRACE_DEFERRED_COMMIT is set.
+     * @param trace[in,out] Record to save, failnum is filled in if it is written to flash.
+     */
+    void SaveRecord(FaultDataFlash_t& trace);
+
+    /**
+     * Encode and write a record to the flash log after the newest record, filling in the failure number.
+     * @param trace[in,out] Record to save.
+     */
+    void CommitRecord(FaultDataFlash_t& trace);
+
+    /**
+     * Write a record saved to RAM by FEATHERTRACE_DEFERRED_COMMIT to the flash log.
+     * @return true if a record was waiting to be written, false if not.
+     */
+    bool CommitPendingRecord();
+
+    /**
+     * Find a record in the flash log by age, using failnum as the sequence number, and decode it.
+     * @param index 0 for the newest record, 1 for the one before it, etc.
+     * @param out[out] The decoded record.
+     * @return false if there are not that many records.
+     */
+    bool GetRecord(const size_t index, FaultDataFlash_t& out);
+
+    /** Returns the number of valid records in the flash log */
+    size_t GetRecordCount();
+
+    /** Copy a record into the public FeatherTrace::FaultData format */
+    void CopyRecord(const FaultDataFlash_t& trace, FaultData& out);
+
+    /** Print a record in a human readable format, see FeatherTrace::PrintFault */
+    void PrintRecord(Print& where, const FaultDataFlash_t& trace);
+
+}
+}
+
+/** End a stage of FeatherTrace::Fault (ex. FEATHERTRACE_END_STAGE(STAGE_CAPTURE)), see FeatherTrace::FaultStage */
+#if FEATHERTRACE_BENCHMARK
+#define FEATHERTRACE_END_STAGE(_stage) FeatherTrace::Core::EndFaultStage(FeatherTrace::_stage)
+#else
+#define FEATHERTRACE_END_STAGE(_stage)
+#endif
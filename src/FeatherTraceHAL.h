@@ -0,0 +1,180 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "FeatherTraceRecord.h"
+
+/**
+ * Hardware abstraction layer used by FeatherTraceCore.cpp and FeatherTrace.cpp.
+ * Every function here is implemented by exactly one backend:
+ *  - FeatherTraceHAL_SAMD.cpp on the SAMD21 (ARDUINO_ARCH_SAMD)
+ *  - FeatherTraceHAL_Linux.cpp on a computer (no ARDUINO), which emulates the
+ *    flash log and watchdog in memory so the core can be built and run on a host.
+ */
+
+namespace FeatherTrace {
+namespace HAL {
+
+    /** Derived from VECTACTIVE in https://developer.arm.com/docs/dui0662/a/cortex-m0-peripherals/system-control-block/interrupt-control-and-state-register */
+    enum SCBFaultType : uint32_t {
+        SCB_NONE = 0,
+        SCB_HARDFAULT = 3,
+        SCB_WDTEW = 18,
+    };
+
+    /** Get the number of the exception being handled (VECTACTIVE), SCB_NONE if none */
+    uint32_t GetActiveInterrupt();
+
+    /**
+     * Returns true while a write to the watchdog is being synchronized to its slow
+     * clock, which takes a few milliseconds. The other watchdog functions must not
+     * be called until this returns false, since the CPU would stall until the
+     * synchronization is done.
+     */
+    bool WatchdogSyncing();
+
+    /** Returns true if the watchdog is enabled */
+    bool WatchdogEnabled();
+
+    /**
+     * Set up the clock and early warning interrupt of the watchdog, and set its
+     * period. The watchdog must be disabled. Starts a synchronization, see WatchdogSyncing.
+     * @param period Value of FeatherTrace::WDTTimeout to use.
+     */
+    void ConfigureWatchdogPeriod(const uint8_t period);
+
+    /**
+     * Set when the early warning interrupt fires, half way through the period.
+     * The watchdog must be disabled. Starts a synchronization, see WatchdogSyncing.
+     * @param period Value of FeatherTrace::WDTTimeout passed to ConfigureWatchdogPeriod.
+     */
+    void ConfigureWatchdogWarning(const uint8_t period);
+
+    /**
+     * Enable or disable the watchdog. Starts a synchronization, see WatchdogSyncing.
+     * @param enable true to enable, false to disable.
+     */
+    void EnableWatchdog(const bool enable);
+
+    /** Reset the watchdog counter. Starts a synchronization, see WatchdogSyncing. */
+    void ClearWatchdog();
+
+    /** Largest value of shift accepted by SlowWatchdog */
+    static constexpr uint8_t WATCHDOG_MAX_SLOWDOWN = 11;
+
+    /**
+     * Slow down the clock of the watchdog, so every timeout is 2^shift times as long.
+     * Synchronizations also take 2^shift times as long.
+     * @param shift At most WATCHDOG_MAX_SLOWDOWN, 0 for the normal clock.
+     * @param standby true to keep the watchdog running in standby, which it normally doesn't.
+     */
+    void SlowWatchdog(const uint8_t shift, const bool standby);
+
+    /** Acknowledge the watchdog early warning interrupt */
+    void ClearWatchdogWarning();
+
+    /**
+     * Disable interrupts, for a short critical section.
+     * @return The previous interrupt state, to be passed to RestoreInterrupts.
+     */
+    uint32_t DisableInterrupts();
+
+    /** Restore the interrupt state returned by DisableInterrupts */
+    void RestoreInterrupts(const uint32_t state);
+
+    /** Get the number of milliseconds since boot, safe to call from the watchdog interrupt */
+    uint32_t Millis();
+
+    /** Get the number of microseconds since boot, wrapping every ~71 minutes */
+    uint32_t Micros();
+
+#if FEATHERTRACE_BENCHMARK
+    /** Get a free running count of CPU cycles, which keeps counting with interrupts disabled */
+    uint32_t Cycles();
+
+    /** Get the rate of Cycles in cycles per second */
+    uint32_t CyclesPerSecond();
+#endif
+
+    /** Get the number of bytes between the heap and the stack, negative if they have collided */
+    int FreeMemory();
+
+    /** Get the address just past the top of the stack, or 0 if it is not known */
+    uintptr_t GetStackTop();
+
+    /** Get the address just past the end of the heap, or 0 if it is not known */
+    uintptr_t GetHeapEnd();
+
+    /** Get a pointer to the flash log, FLASH_LOG_SIZE bytes aligned to an NVM row */
+    const uint8_t* GetFlashLog();
+
+    /**
+     * Erase the NVM rows of the flash log in [offset, offset + len) to 0xFF.
+     * @param offset Offset into the flash log, must be a multiple of 256.
+     * @param len Number of bytes to erase, rounded up to a multiple of 256.
+     */
+    void EraseFlash(const size_t offset, const size_t len);
+
+    /**
+     * Write words to erased flash in the flash log. Pages are written last
+     * to first, so the first word is always written last. The words may start
+     * partway through a page, as long as the rest of the page is erased.
+     * @param offset Offset into the flash log, must be a multiple of 4.
+     * @param words Words to write.
+     * @param count Number of words to write.
+     */
+    void WriteFlash(const size_t offset, const uint32_t* words, const size_t count);
+
+    /**
+     * Fill the stacktrace, registers, and (if enabled) stack window of a fault
+     * record from the current context. trace.data.interrupt_type must be set.
+     * @param trace[in,out] Record to fill.
+     */
+    void CaptureTrace(FaultDataFlash_t& trace);
+
+    /** Reset the device, this function does not return */
+    [[noreturn]] void SystemReset();
+
+#ifndef ARDUINO
+    /** Functions to control the emulated hardware in FeatherTraceHAL_Linux.cpp */
+    namespace Emulator {
+        /**
+         * Set the function called by SystemReset, which must not return (ex. it can
+         * longjmp out of FeatherTrace::Fault). The default exits the process.
+         */
+        void SetResetHandler(void (*handler)());
+
+        /** Set the value returned by GetActiveInterrupt, to pretend FeatherTrace is running in an exception */
+        void SetActiveInterrupt(const uint32_t interrupt);
+
+        /** Set the emulated time since boot in milliseconds, see Millis and Micros */
+        void SetMillis(const uint32_t ms);
+
+        /** Advance the emulated time since boot, see Millis and Micros */
+        void AdvanceMicros(const uint32_t us);
+
+        /** Set the value returned by FreeMemory */
+        void SetFreeMemory(const int free);
+
+        /** Returns true if the watchdog is running, the same as WatchdogEnabled */
+        bool IsWatchdogRunning();
+
+        /** Get the shift passed to SlowWatchdog, 0 by default */
+        uint8_t GetWatchdogSlowdown();
+
+        /** Get the number of times ClearWatchdog has been called */
+        uint32_t GetWatchdogFeeds();
+
+        /**
+         * Get the number of watchdog writes made while a synchronization was in
+         * progress, which would have stalled the CPU on the SAMD21.
+         */
+        uint32_t GetWatchdogStalls();
+
+        /** Erase the entire emulated flash log */
+        void EraseFlashLog();
+    }
+#endif
+
+}
+}
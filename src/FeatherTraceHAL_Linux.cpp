@@ -0,0 +1,236 @@
+#ifndef ARDUINO
+#include "FeatherTraceHAL.h"
+#include <stdlib.h>
+#if FEATHERTRACE_BENCHMARK
+#include <time.h>
+#endif
+
+/**
+ * FeatherTraceHAL implementation for a computer, which emulates the SAMD21
+ * hardware FeatherTrace uses in memory. Flash behaves like NOR flash: an erase
+ * sets a 256 byte row to 0xFF, and a write can only clear bits.
+ */
+
+/** Emulated NVM row size, the same as the SAMD21 */
+static constexpr size_t ROW_SIZE = 256;
+
+/** Emulated flash log, zero filled like the one in FeatherTraceHAL_SAMD.cpp */
+alignas(ROW_SIZE) static uint8_t emulated_flash[FLASH_LOG_SIZE] = { 0 };
+/** Value returned by GetActiveInterrupt */
+static uint32_t active_interrupt = FeatherTrace::HAL::SCB_NONE;
+/** Emulated time since boot, returned by Millis and Micros */
+static uint64_t emulated_micros = 0;
+/** Value returned by FreeMemory, anything from 0 to 60000 is treated as healthy */
+static int free_memory = 16384;
+/** True if the emulated watchdog is running */
+static bool watchdog_running = false;
+/** Value passed to SlowWatchdog */
+static uint8_t watchdog_slowdown = 0;
+/** Number of times ClearWatchdog has been called */
+static uint32_t watchdog_feeds = 0;
+/** Number of watchdog writes made while watchdog_sync_until had not passed */
+static uint32_t watchdog_stalls = 0;
+/** emulated_micros when the last watchdog write finishes synchronizing */
+static uint64_t watchdog_sync_until = 0;
+/** Time a watchdog write takes to synchronize, about 3 cycles of the 1024Hz watchdog clock */
+static constexpr uint64_t WATCHDOG_SYNC_MICROS = 3000;
+
+/** Emulate a write to a synchronized watchdog register */
+static void watchdog_write() {
+    if (emulated_micros < watchdog_sync_until)
+        watchdog_stalls++;
+    watchdog_sync_until = emulated_micros + (WATCHDOG_SYNC_MICROS << watchdog_slowdown);
+}
+
+/** Default reset handler, a reset ends the program */
+static void exit_on_reset() {
+    exit(0);
+}
+
+/** Function called by SystemReset */
+static void (*reset_handler)() = &exit_on_reset;
+
+/* See FeatherTraceHAL.h */
+uint32_t FeatherTrace::HAL::GetActiveInterrupt() {
+    return active_interrupt;
+}
+
+/* See FeatherTraceHAL.h */
+bool FeatherTrace::HAL::WatchdogSyncing() {
+    if (emulated_micros >= watchdog_sync_until)
+        return false;
+    // checking takes time, so code that spins on this finishes
+    emulated_micros++;
+    return true;
+}
+
+/* See FeatherTraceHAL.h */
+bool FeatherTrace::HAL::WatchdogEnabled() {
+    return watchdog_running;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::ConfigureWatchdogPeriod(const uint8_t) {
+    watchdog_write();
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::ConfigureWatchdogWarning(const uint8_t) {
+    watchdog_write();
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::EnableWatchdog(const bool enable) {
+    watchdog_write();
+    watchdog_running = enable;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::ClearWatchdog() {
+    watchdog_write();
+    watchdog_feeds++;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::SlowWatchdog(const uint8_t shift, const bool) {
+    watchdog_slowdown = shift;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::ClearWatchdogWarning() { }
+
+/* See FeatherTraceHAL.h */
+uint32_t FeatherTrace::HAL::DisableInterrupts() {
+    // there are no interrupts to disable
+    return 0;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::RestoreInterrupts(const uint32_t) { }
+
+/* See FeatherTraceHAL.h */
+uint32_t FeatherTrace::HAL::Millis() {
+    return static_cast<uint32_t>(emulated_micros / 1000);
+}
+
+/* See FeatherTraceHAL.h */
+uint32_t FeatherTrace::HAL::Micros() {
+    return static_cast<uint32_t>(emulated_micros);
+}
+
+#if FEATHERTRACE_BENCHMARK
+/* See FeatherTraceHAL.h */
+uint32_t FeatherTrace::HAL::Cycles() {
+    // real time instead of emulated time, so the host benchmark measures the code
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint32_t>(static_cast<uint64_t>(now.tv_sec) * 1000000000u + now.tv_nsec);
+}
+
+/* See FeatherTraceHAL.h */
+uint32_t FeatherTrace::HAL::CyclesPerSecond() {
+    // a cycle is a nanosecond on a computer
+    return 1000000000u;
+}
+#endif
+
+/* See FeatherTraceHAL.h */
+int FeatherTrace::HAL::FreeMemory() {
+    return free_memory;
+}
+
+/* See FeatherTraceHAL.h */
+uintptr_t FeatherTrace::HAL::GetStackTop() {
+    // the stack guard word can't be placed on a computer
+    return 0;
+}
+
+/* See FeatherTraceHAL.h */
+uintptr_t FeatherTrace::HAL::GetHeapEnd() {
+    // the stack can't be painted on a computer either
+    return 0;
+}
+
+/* See FeatherTraceHAL.h */
+const uint8_t* FeatherTrace::HAL::GetFlashLog() {
+    return emulated_flash;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::EraseFlash(const size_t offset, const size_t len) {
+    for (size_t i = 0; i < (len + ROW_SIZE - 1) / ROW_SIZE * ROW_SIZE && offset + i < FLASH_LOG_SIZE; i++)
+        emulated_flash[offset + i] = 0xFF;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::WriteFlash(const size_t offset, const uint32_t* words, const size_t count) {
+    uint32_t* const flash_u32 = reinterpret_cast<uint32_t*>(&emulated_flash[offset]);
+    // writing to flash can only clear bits, last word first to match the SAMD21
+    for (size_t i = count; i > 0; i--)
+        flash_u32[i - 1] &= words[i - 1];
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::CaptureTrace(FaultDataFlash_t& trace) {
+    // there are no saved registers to unwind, so only record who called FeatherTrace::Fault
+    trace.data.stacktrace[0] = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(__builtin_return_address(0)));
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::SystemReset() {
+    reset_handler();
+    // the reset handler must not return
+    abort();
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::Emulator::SetResetHandler(void (*handler)()) {
+    reset_handler = handler != nullptr ? handler : &exit_on_reset;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::Emulator::SetActiveInterrupt(const uint32_t interrupt) {
+    active_interrupt = interrupt;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::Emulator::SetMillis(const uint32_t ms) {
+    emulated_micros = static_cast<uint64_t>(ms) * 1000;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::Emulator::AdvanceMicros(const uint32_t us) {
+    emulated_micros += us;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::Emulator::SetFreeMemory(const int free) {
+    free_memory = free;
+}
+
+/* See FeatherTraceHAL.h */
+bool FeatherTrace::HAL::Emulator::IsWatchdogRunning() {
+    return watchdog_running;
+}
+
+/* See FeatherTraceHAL.h */
+uint8_t FeatherTrace::HAL::Emulator::GetWatchdogSlowdown() {
+    return watchdog_slowdown;
+}
+
+/* See FeatherTraceHAL.h */
+uint32_t FeatherTrace::HAL::Emulator::GetWatchdogFeeds() {
+    return watchdog_feeds;
+}
+
+/* See FeatherTraceHAL.h */
+uint32_t FeatherTrace::HAL::Emulator::GetWatchdogStalls() {
+    return watchdog_stalls;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::Emulator::EraseFlashLog() {
+    EraseFlash(0, FLASH_LOG_SIZE);
+}
+
+#endif // ARDUINO
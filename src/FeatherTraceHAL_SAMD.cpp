@@ -0,0 +1,731 @@
+#ifdef ARDUINO_ARCH_SAMD
+#include "FeatherTraceHAL.h"
+#include "FeatherTrace.h"
+#if FEATHERTRACE_BUILTIN_UNWINDER
+#include "FeatherTraceUnwind.h"
+#endif
+extern "C" {
+    #include <unwind.h>
+}
+
+/** Allocate flash for our crash log, FEATHERTRACE_LOG_SLOTS records each in their own NVM rows */
+alignas(256) _Pragma("location=\"FLASH\"") static const uint8_t FeatherTraceFlash[FLASH_LOG_SIZE] = { 0 };
+const void* FeatherTraceFlashPtr = FeatherTraceFlash;
+
+typedef struct {
+    unsigned last_ip;
+    int strace_len;
+    bool sdid_max_len;
+    unsigned stacktrace[MAX_STRACE];
+}  trace_arg_t;
+
+static const uint32_t pageSizes[] = { 8, 16, 32, 64, 128, 256, 512, 1024 };
+
+/** Global varible to store the Link Register (lr) during stack decoding. */
+static unsigned saved_lr;
+/** Global varible to store the program status register (xpsr) during stack decoding */
+static unsigned saved_xpsr;
+/* See FeatherTrace.h */
+phase2_vrs p_main_context;
+
+#ifdef __arm__
+// should use uinstd.h to define sbrk but Due causes a conflict
+extern "C" char* sbrk(int incr);
+#else  // __ARM__
+extern char *__brkval;
+#endif  // __arm__
+
+static int freeMemory() {
+  char top;
+#ifdef __arm__
+  return &top - reinterpret_cast<char*>(sbrk(0));
+#elif defined(CORE_TEENSY) || (ARDUINO > 103 && ARDUINO != 151)
+  return &top - __brkval;
+#else  // __arm__
+  return __brkval ? &top - __brkval : &top - __malloc_heap_start;
+#endif  // __arm__
+}
+
+/** Top of the stack, defined by the linker script */
+extern "C" uint32_t __StackTop;
+/** Start of the SAMD21 SRAM */
+static constexpr uint32_t RAM_START = 0x20000000;
+
+extern "C" {
+    _Unwind_Reason_Code __gnu_Unwind_Backtrace(
+        _Unwind_Trace_Fn trace, void *trace_argument, phase2_vrs *entry_vrs);
+
+    _Unwind_Reason_Code _Unwind_Backtrace(_Unwind_Trace_Fn trace, void * trace_argument);
+}
+
+/**
+ * Takes registers from the core state and the saved exception context and
+ * fills in the structure necessary for the LIBGCC unwinder. Also fills
+ * lr and xpsr (saved_lr and saved_xpsr for a fault).
+ * 
+ * This function was derived from the OpenMRN implementation here:
+ * https://github.com/bakerstu/openmrn/blob/0d051659af093e03d883a9ea003773ae58ace62a/src/freertos_drivers/common/cpu_profile.hxx#L183-L202
+ * 
+ * @param fault_args stack pointer we would like to unwind
+ * @param context[out] register context to fill, r4-r11 must already be saved by the naked handler
+ * @param lr[out] the link register from the exception context
+ * @param xpsr[out] the program status register from the exception context
+ */
+static void fill_phase2_vrs(volatile unsigned *fault_args, phase2_vrs& context, unsigned& lr, unsigned& xpsr)
+{
+    // see https://static.docs.arm.com/ddi0419/d/DDI0419D_armv6m_arm.pdf B.1.5.6 for
+    // details on which registers are pushed to the stack and in what order
+    context.demand_save_flags = 0;
+    context.core.r[0] = fault_args[0];
+    context.core.r[1] = fault_args[1];
+    context.core.r[2] = fault_args[2];
+    context.core.r[3] = fault_args[3];
+    context.core.r[12] = fault_args[4];
+    // We add +2 here because first thing libgcc does with the lr value is
+    // subtract two, presuming that lr points to after a branch
+    // instruction. However, exception entry's saved PC can point to the first
+    // instruction of a function and we don't want to have the backtrace end up
+    // showing the previous function.
+    // This has been removed for ARMv6
+    context.core.r[14] = fault_args[6]; // + 2; // Set link register to the previous program counter
+    context.core.r[15] = fault_args[6]; // Set program counter as well
+    lr = fault_args[5]; // save the link register for later
+    // also save xPSR so we can read it later
+    xpsr = fault_args[7];
+    // set the stack pointer to the inactive stack minus values pushed entering the exception
+    context.core.r[13] = (unsigned)(fault_args + 8); 
+}
+
+/**
+ * Callback for _Unwind_Backtrace, stores the information from the
+ * backtrace into arg for processing later.
+ * 
+ * This function is derived from the OpenMRN implementatio here:
+ * https://github.com/bakerstu/openmrn/blob/0d051659af093e03d883a9ea003773ae58ace62a/src/freertos_drivers/common/cpu_profile.hxx#L212-L244
+ * Changes were made as FeatherTrace only needs to support a single
+ * stacktrace per boot.
+ */
+_Unwind_Reason_Code trace_func(struct _Unwind_Context *context, void *arg)
+{
+    trace_arg_t* myargs = (trace_arg_t*)arg;
+    // for some reason IP's are sometimes one below the values used by
+    // addr2line and other tools. This only happens if the address is odd,
+    // so I suspect this is due to PC getting incremented and then faulting
+    // before it is incremented again. To correct for this, we add
+    // 1 here if the number is odd.
+    unsigned ip = _Unwind_GetIP(context);
+    if (ip > 0 && ip & 1)
+        ip++;
+    // ignore the first entry to prevent doubling up
+    if (myargs->strace_len == 0)
+    {
+        // stacktrace[strace_len++] = ip;
+        // By taking the beginning of the function for the immediate interrupt
+        // we will attempt to coalesce more traces.
+        // ip = (void *)_Unwind_GetRegionStart(context);
+    }
+    else if (myargs->last_ip == ip)
+    {
+        if (myargs->strace_len == 1 
+            && saved_lr != 0
+            && saved_lr != _Unwind_GetGR(context, 14))
+        {
+            _Unwind_SetGR(context, 14, saved_lr);
+            // allocator.singleLenHack++; not sure what this was for?
+            return _URC_NO_REASON;
+        }
+        return _URC_END_OF_STACK;
+    }
+    if (myargs->strace_len >= MAX_STRACE - 1)
+    {
+        myargs->sdid_max_len = true;
+        return _URC_END_OF_STACK;
+    }
+    myargs->stacktrace[myargs->strace_len++] = ip;
+    myargs->last_ip = ip;
+    // for some reason GCC keeps unwinding past the reset handler sometimes,
+    // which causes yet another hardfault
+    // this addresses that issue by exiting upon encountering it.
+    // Add one because GetRegionStart is one off for some reason
+    int (*ptr)() = (int (*)())(_Unwind_GetRegionStart(context) + 1);
+    if (ptr == main) {
+        return _URC_END_OF_STACK;
+    }
+    // ip = (void *)_Unwind_GetRegionStart(context);
+    // stacktrace[strace_len++] = ip;
+    return _URC_NO_REASON;
+}
+
+
+/**
+ * Use _Unwind_Backtrace as if we are in an ISR
+ * context, meaning we've saved registers to
+ * p_main_context and we'd like _Unwind_Backtrace
+ * to look at a different stack than the one we're
+ * using now
+ * @param arg[out] Pointer to a object used to store the results of the trace.
+ */
+static void take_isr_cpu_trace(trace_arg_t* arg)
+{
+    p_main_context.demand_save_flags = 0;
+    // perform the stack trace!
+    phase2_vrs first_context = p_main_context;
+    __gnu_Unwind_Backtrace(&trace_func, arg, &first_context);
+    // This is a workaround for the case when the function in which we had the
+    // exception trigger does not have a stack saved LR. In this case the
+    // backtrace will fail after the first step. We manually append the second
+    // step to have at least some idea of what's going on.
+    if (arg->strace_len == 0)
+    {
+        arg->stacktrace[0] = p_main_context.core.r[15];
+        arg->strace_len++;
+    }
+    if (arg->strace_len == 1)
+    {
+        // try the link register instead of the program counter
+        p_main_context.core.r[14] = saved_lr;
+        p_main_context.core.r[15] = saved_lr;
+        arg->last_ip = 0;
+        __gnu_Unwind_Backtrace(&trace_func, arg, &p_main_context);
+    }
+    if (arg->strace_len == 1)
+    {
+        arg->stacktrace[1] = saved_lr - 1;
+        arg->strace_len++;
+    }
+}
+
+#if FEATHERTRACE_BUILTIN_UNWINDER
+extern "C" {
+    /** Bounds of the .ARM.exidx table, defined by the linker script */
+    extern const uint32_t __exidx_start;
+    extern const uint32_t __exidx_end;
+}
+/** End of the SAMD21 flash, the largest part has 256KB */
+static constexpr uint32_t FLASH_END = 0x40000;
+
+/** FeatherTrace::Unwind::ReadFn that only allows reads from flash or RAM, so the unwinder can't fault */
+static bool read_device_memory(void*, uint32_t addr, uint32_t* out) {
+    if (addr > FLASH_END - 4
+        && (addr < RAM_START || addr > reinterpret_cast<uint32_t>(&__StackTop) - 4))
+        return false;
+    *out = *reinterpret_cast<const volatile uint32_t*>(addr);
+    return true;
+}
+
+/**
+ * Take a stacktrace using FeatherTrace::Unwind::Backtrace.
+ * @param regs Registers to start unwinding from, only r7 and r13-r15 need to be valid.
+ * @param arg[out] Pointer to a object used to store the results of the trace.
+ */
+static void take_builtin_trace(const uint32_t regs[16], trace_arg_t* arg) {
+    const FeatherTrace::Unwind::UnwindConfig config = {
+        &read_device_memory,
+        nullptr,
+        reinterpret_cast<uint32_t>(&__exidx_start),
+        reinterpret_cast<uint32_t>(&__exidx_end),
+        reinterpret_cast<uint32_t>(&main),
+        FEATHERTRACE_UNWIND_BUDGET
+    };
+    FeatherTrace::Unwind::Result result;
+    // leave the last entry as zero, the same as trace_func
+    arg->strace_len = static_cast<int>(FeatherTrace::Unwind::Backtrace(
+        config, regs, reinterpret_cast<uint32_t*>(arg->stacktrace), MAX_STRACE - 1, &result));
+    arg->sdid_max_len = result == FeatherTrace::Unwind::UNWIND_MAX_FRAMES;
+}
+#endif
+
+#if FEATHERTRACE_STACK_WINDOW > 0
+static_assert(FEATHERTRACE_STACK_WINDOW % 4 == 0, "FEATHERTRACE_STACK_WINDOW must be a multiple of 4");
+
+/**
+ * Copy up to FEATHERTRACE_STACK_WINDOW bytes of the stack starting at sp into trace.
+ * Nothing is copied if sp is not a valid stack address, since it may be garbage after
+ * a hard fault.
+ */
+static void save_stack_window(const uint32_t sp, FaultDataFlash_t& trace) {
+    const uint32_t top = reinterpret_cast<uint32_t>(&__StackTop);
+    uint32_t len = 0;
+    if (sp >= RAM_START && sp < top && (sp & 3) == 0)
+        len = top - sp < FEATHERTRACE_STACK_WINDOW ? top - sp : FEATHERTRACE_STACK_WINDOW;
+    const volatile uint32_t* const stack = reinterpret_cast<const volatile uint32_t*>(sp);
+    for (uint32_t i = 0; i < len / 4; i++)
+        trace.data.stack_window[i] = stack[i];
+    trace.data.stack_window_addr = sp;
+    trace.data.stack_window_len = len;
+}
+#endif
+
+/* See FeatherTraceHAL.h */
+uint32_t FeatherTrace::HAL::GetActiveInterrupt() {
+    // Read SCB/ICSR, detailed here:
+    // https://developer.arm.com/docs/dui0662/a/cortex-m0-peripherals/system-control-block/interrupt-control-and-state-register
+    // this will tell us what kind of interrupt triggered
+    return *(uint32_t*)(0xE000ED04) & 0x001F;
+}
+
+/* See FeatherTraceHAL.h */
+bool FeatherTrace::HAL::WatchdogSyncing() {
+    return WDT->STATUS.bit.SYNCBUSY;
+}
+
+/* See FeatherTraceHAL.h */
+bool FeatherTrace::HAL::WatchdogEnabled() {
+    return WDT->CTRL.bit.ENABLE;
+}
+
+/**
+ * Set up the clock generator used by the watchdog (GCLK2).
+ * @param shift See FeatherTrace::HAL::SlowWatchdog.
+ * @param standby See FeatherTrace::HAL::SlowWatchdog.
+ */
+static void setup_watchdog_clock(const uint8_t shift, const bool standby) {
+    // Generic clock generator 2, divisor = 32 << shift (2^(DIV+1))
+    GCLK->GENDIV.reg = GCLK_GENDIV_ID(2) | GCLK_GENDIV_DIV(4 + shift);
+    // Enable clock generator 2 using low-power 32KHz oscillator.
+    // With /32 divisor above, this yields 1024Hz(ish) clock.
+    GCLK->GENCTRL.reg = GCLK_GENCTRL_ID(2) |
+                        GCLK_GENCTRL_GENEN |
+                        GCLK_GENCTRL_SRC_OSCULP32K |
+                        GCLK_GENCTRL_DIVSEL |
+                        (standby ? GCLK_GENCTRL_RUNSTDBY : 0);
+    // the GCLK runs from the main clock, so this is quick
+    while(GCLK->STATUS.bit.SYNCBUSY);
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::ConfigureWatchdogPeriod(const uint8_t period) {
+    setup_watchdog_clock(0, false);
+    // WDT clock = clock gen 2
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID_WDT |
+                        GCLK_CLKCTRL_CLKEN |
+                        GCLK_CLKCTRL_GEN_GCLK2;
+    // Enable WDT early-warning interrupt
+    NVIC_DisableIRQ(WDT_IRQn);
+    NVIC_ClearPendingIRQ(WDT_IRQn);
+    NVIC_SetPriority(WDT_IRQn, 0); // Top priority
+    NVIC_EnableIRQ(WDT_IRQn);
+    // Enable early warning interrupt
+    WDT->INTENSET.bit.EW   = 1;
+    // Period = twice
+    WDT->CONFIG.bit.PER    = period;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::ConfigureWatchdogWarning(const uint8_t period) {
+    // Set time of interrupt, CONFIG must be done synchronizing first
+    WDT->EWCTRL.bit.EWOFFSET = period - 1;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::EnableWatchdog(const bool enable) {
+    // also disables window mode
+    WDT->CTRL.reg = enable ? WDT_CTRL_ENABLE : 0;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::ClearWatchdog() {
+    WDT->CLEAR.reg = WDT_CLEAR_CLEAR_KEY;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::SlowWatchdog(const uint8_t shift, const bool standby) {
+    setup_watchdog_clock(shift, standby);
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::ClearWatchdogWarning() {
+    WDT->INTFLAG.bit.EW  = 1;        // Clear interrupt flag
+}
+
+/* See FeatherTraceHAL.h */
+uint32_t FeatherTrace::HAL::DisableInterrupts() {
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return primask;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::RestoreInterrupts(const uint32_t state) {
+    __set_PRIMASK(state);
+}
+
+/* See FeatherTraceHAL.h */
+uint32_t FeatherTrace::HAL::Millis() {
+    return millis();
+}
+
+/* See FeatherTraceHAL.h */
+uint32_t FeatherTrace::HAL::Micros() {
+    // computed from SysTick by the Arduino core
+    return micros();
+}
+
+#if FEATHERTRACE_BENCHMARK
+/**
+ * Start TC4 and TC5 as a 32-bit counter at the CPU clock. The Cortex-M0+ has no
+ * DWT cycle counter, and SysTick can't be used since it wraps every millisecond
+ * and its interrupt can't run while a fault is handled.
+ */
+static void start_cycle_counter() {
+    // TC4 clock = clock gen 0 (48MHz), shared with TC5
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN |
+                        GCLK_CLKCTRL_GEN_GCLK0 |
+                        GCLK_CLKCTRL_ID_TC4_TC5;
+    while(GCLK->STATUS.bit.SYNCBUSY);
+    // reset the timer
+    TC4->COUNT32.CTRLA.reg = TC_CTRLA_SWRST;
+    while(TC4->COUNT32.STATUS.bit.SYNCBUSY);
+    // count every cycle, TC5 holds the upper 16 bits
+    TC4->COUNT32.CTRLA.reg = TC_CTRLA_MODE_COUNT32 | TC_CTRLA_PRESCALER_DIV1;
+    while(TC4->COUNT32.STATUS.bit.SYNCBUSY);
+    // keep COUNT synchronized, so it can be read without a read request
+    TC4->COUNT32.READREQ.reg = TC_READREQ_RCONT | TC_READREQ_ADDR(TC_COUNT32_COUNT_OFFSET);
+    TC4->COUNT32.CTRLA.bit.ENABLE = 1;
+    while(TC4->COUNT32.STATUS.bit.SYNCBUSY);
+}
+
+/* See FeatherTraceHAL.h */
+uint32_t FeatherTrace::HAL::Cycles() {
+    if (!TC4->COUNT32.CTRLA.bit.ENABLE)
+        start_cycle_counter();
+    return TC4->COUNT32.COUNT.reg;
+}
+
+/* See FeatherTraceHAL.h */
+uint32_t FeatherTrace::HAL::CyclesPerSecond() {
+    return SystemCoreClock;
+}
+#endif
+
+/* See FeatherTraceHAL.h */
+int FeatherTrace::HAL::FreeMemory() {
+    return freeMemory();
+}
+
+/* See FeatherTraceHAL.h */
+uintptr_t FeatherTrace::HAL::GetStackTop() {
+    return reinterpret_cast<uintptr_t>(&__StackTop);
+}
+
+/* See FeatherTraceHAL.h */
+uintptr_t FeatherTrace::HAL::GetHeapEnd() {
+#ifdef __arm__
+    return reinterpret_cast<uintptr_t>(sbrk(0));
+#else  // __arm__
+    return reinterpret_cast<uintptr_t>(__brkval);
+#endif  // __arm__
+}
+
+/* See FeatherTraceHAL.h */
+const uint8_t* FeatherTrace::HAL::GetFlashLog() {
+    return FeatherTraceFlash;
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::EraseFlash(const size_t offset, const size_t len) {
+    // an erase is 4 pages (one row)
+    const size_t rowsize = pageSizes[NVMCTRL->PARAM.bit.PSZ] * 4;
+    for (size_t i = 0; i < len; i += rowsize) {
+        NVMCTRL->ADDR.reg = ((uint32_t)&(FeatherTraceFlash[offset + i])) / 2;
+        NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_ER;
+        while (!NVMCTRL->INTFLAG.bit.READY) { }
+    }
+}
+
+/*
+ * See FeatherTraceHAL.h
+ * This function is translated from https://github.com/cmaglie/FlashStorage.
+ */
+void FeatherTrace::HAL::WriteFlash(const size_t offset, const uint32_t* words, const size_t count) {
+    volatile uint32_t* const flash_u32 = (volatile uint32_t*)&FeatherTraceFlash[offset];
+    // determine page size
+    const size_t pagesize = pageSizes[NVMCTRL->PARAM.bit.PSZ];
+    // Disable automatic page write
+    NVMCTRL->CTRLB.bit.MANW = 1;
+    // iterate, starting from the last page, FeatherTraceFlash is row aligned so offsets line up with pages
+    size_t last = count;
+    while (last > 0) {
+        // Execute "PBC" Page Buffer Clear, the cleared buffer leaves the rest of the page unchanged
+        NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_PBC;
+        while (NVMCTRL->INTFLAG.bit.READY == 0) { }
+        // write!
+        const size_t page_start = (offset + (last - 1) * 4) / pagesize * pagesize;
+        const size_t first = page_start > offset ? (page_start - offset) / 4 : 0;
+        for (size_t i = first; i < last; i++)
+            flash_u32[i] = words[i];
+        // flush the page
+        NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_WP;
+        while (NVMCTRL->INTFLAG.bit.READY == 0) { }
+        last = first;
+    }
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::CaptureTrace(FaultDataFlash_t& trace) {
+    // check if we're in a synchronous context,
+    // if so we can't save registers but can backtrace normally
+    if (trace.data.interrupt_type == SCB_NONE) {
+        // take a cpu trace!
+        trace_arg_t arg = {};
+#if FEATHERTRACE_BUILTIN_UNWINDER
+        // start unwinding from here, r7 is included in case it is used as a frame pointer
+        uint32_t regs[16] = {};
+        __asm__ volatile (
+            "mov %0, r7\n"
+            "mov %1, sp\n"
+            "mov %2, lr\n"
+            "mov %3, pc\n"
+            : "=r" (regs[7]), "=r" (regs[13]), "=r" (regs[14]), "=r" (regs[15]));
+        take_builtin_trace(regs, &arg);
+#else
+        // run unwind_backtrace!
+        _Unwind_Backtrace(&trace_func, &arg);
+#endif
+        // write the results to our fault data
+        for (size_t i = 0; i < MAX_STRACE; i++)
+            trace.data.stacktrace[i] = arg.stacktrace[i];
+    }
+    // else save registers and manipulate unwind.h to use alternate stack
+    else {
+        // copy the saved registers
+        uint32_t regs[16];
+        for (size_t i = 0; i < 16; i++)
+            regs[i] = p_main_context.core.r[i];
+        // also make sure the link register is set correctly, since we have to hack around it earlier
+        regs[14] = saved_lr;
+#if FEATHERTRACE_SAVE_REGISTERS
+        // write them to our trace, with xPSR
+        for (size_t i = 0; i < 16; i++)
+            trace.data.regs[i] = regs[i];
+        trace.data.xpsr = saved_xpsr;
+#endif
+        // take a backtrace!
+        trace_arg_t arg = {};
+#if !FEATHERTRACE_DEVICE_UNWIND
+        // only save where the fault happened, the stack window can be unwound later
+        arg.stacktrace[0] = regs[15];
+        arg.stacktrace[1] = saved_lr & ~1u;
+#elif FEATHERTRACE_BUILTIN_UNWINDER
+        // lr was clobbered by the exception entry, so use the saved one
+        take_builtin_trace(regs, &arg);
+#else
+        // unwinds from p_main_context instead
+        (void)regs;
+        take_isr_cpu_trace(&arg);
+#endif
+#if FEATHERTRACE_STACK_WINDOW > 0
+        save_stack_window(regs[13], trace);
+#endif
+        // write the results to our fault data
+        for (size_t i = 0; i < MAX_STRACE; i++)
+            trace.data.stacktrace[i] = arg.stacktrace[i];
+    }
+}
+
+/* See FeatherTraceHAL.h */
+void FeatherTrace::HAL::SystemReset() {
+    // All done! the chip will now reset
+    NVIC_SystemReset();
+    while(true);
+}
+
+extern "C" {
+    /* See FeatherTrace.h */
+    volatile void __attribute__((__noinline__)) p_load_monitor_interrupt_handler(
+        volatile unsigned *exception_args, unsigned exception_return_code)
+    {
+        // read the stack pointer not currently in use
+        fill_phase2_vrs(exception_args, p_main_context, saved_lr, saved_xpsr);
+        // Call the FeatherTrace Fault handler
+        FeatherTrace::Fault(FeatherTrace::FaultCause::FAULT_UNKNOWN);
+    }
+}
+
+#if FEATHERTRACE_PROFILER
+static_assert((FEATHERTRACE_PROFILER_SLOTS & (FEATHERTRACE_PROFILER_SLOTS - 1)) == 0, "FEATHERTRACE_PROFILER_SLOTS must be a power of two");
+static_assert(FEATHERTRACE_PROFILER_DEPTH >= 1, "FEATHERTRACE_PROFILER_DEPTH must be at least 1");
+
+/** Number of slots to probe in profile_table before giving up on an address */
+static constexpr size_t PROFILE_MAX_PROBE = 8;
+
+/* See FeatherTrace.h */
+phase2_vrs p_profile_context;
+/** Hash table of sampled addresses, written by p_profile_interrupt_handler */
+static volatile FeatherTrace::ProfileEntry profile_table[FEATHERTRACE_PROFILER_SLOTS];
+/** Total number of samples taken */
+static volatile uint32_t profile_samples = 0;
+/** Number of addresses that could not be counted because profile_table was full */
+static volatile uint32_t profile_dropped = 0;
+
+/** Find or create the profile_table entry for address, or nullptr if the table is full */
+static volatile FeatherTrace::ProfileEntry* profile_lookup(const uint32_t address) {
+    // Knuth's multiplicative hash, ignoring the thumb bit
+    const uint32_t hash = ((address >> 1) * 2654435761u) >> 8;
+    for (size_t i = 0; i < PROFILE_MAX_PROBE; i++) {
+        volatile FeatherTrace::ProfileEntry* const entry = &profile_table[(hash + i) & (FEATHERTRACE_PROFILER_SLOTS - 1)];
+        if (entry->address == address)
+            return entry;
+        if (entry->address == 0) {
+            entry->address = address;
+            return entry;
+        }
+    }
+    profile_dropped = profile_dropped + 1;
+    return nullptr;
+}
+
+#if FEATHERTRACE_PROFILER_DEPTH > 1
+typedef struct {
+    uint32_t last_ip;
+    size_t len;
+    uint32_t frames[FEATHERTRACE_PROFILER_DEPTH];
+} profile_trace_t;
+
+/** Callback for __gnu_Unwind_Backtrace, a simplified version of trace_func for profiling */
+static _Unwind_Reason_Code profile_trace_func(struct _Unwind_Context *context, void *arg)
+{
+    profile_trace_t* myargs = (profile_trace_t*)arg;
+    uint32_t ip = _Unwind_GetIP(context);
+    if (ip > 0 && ip & 1)
+        ip++;
+    if (myargs->len >= FEATHERTRACE_PROFILER_DEPTH || (myargs->len > 0 && myargs->last_ip == ip))
+        return _URC_END_OF_STACK;
+    myargs->frames[myargs->len++] = ip;
+    myargs->last_ip = ip;
+    int (*ptr)() = (int (*)())(_Unwind_GetRegionStart(context) + 1);
+    if (ptr == main)
+        return _URC_END_OF_STACK;
+    return _URC_NO_REASON;
+}
+#endif
+
+extern "C" {
+    /* See FeatherTrace.h */
+    volatile void __attribute__((__noinline__)) p_profile_interrupt_handler(
+        volatile unsigned *exception_args, unsigned exception_return_code)
+    {
+        // acknowledge the timer
+        TC3->COUNT16.INTFLAG.reg = TC_INTFLAG_MC0;
+        unsigned lr, xpsr;
+        fill_phase2_vrs(exception_args, p_profile_context, lr, xpsr);
+        profile_samples = profile_samples + 1;
+        // count the interrupted program counter
+        volatile FeatherTrace::ProfileEntry* entry = profile_lookup(p_profile_context.core.r[15]);
+        if (entry != nullptr) {
+            entry->self = entry->self + 1;
+            entry->inclusive = entry->inclusive + 1;
+        }
+#if FEATHERTRACE_PROFILER_DEPTH > 1
+        // count the callers, skipping the first frame (the program counter)
+        profile_trace_t arg = {};
+        __gnu_Unwind_Backtrace(&profile_trace_func, &arg, &p_profile_context);
+        for (size_t i = 1; i < arg.len; i++) {
+            // don't count recursive calls more than once
+            bool seen = false;
+            for (size_t j = 0; j < i && !seen; j++)
+                seen = arg.frames[j] == arg.frames[i];
+            if (seen)
+                continue;
+            entry = profile_lookup(arg.frames[i]);
+            if (entry != nullptr)
+                entry->inclusive = entry->inclusive + 1;
+        }
+#endif
+    }
+}
+
+/* See FeatherTrace.h */
+void FeatherTrace::StartProfiler(const uint32_t hz) {
+    // TC3 clock = clock gen 0 (48MHz)
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN |
+                        GCLK_CLKCTRL_GEN_GCLK0 |
+                        GCLK_CLKCTRL_ID_TCC2_TC3;
+    while(GCLK->STATUS.bit.SYNCBUSY);
+    // reset the timer
+    TC3->COUNT16.CTRLA.reg = TC_CTRLA_SWRST;
+    while(TC3->COUNT16.STATUS.bit.SYNCBUSY);
+    // match frequency mode, the 16 bit counter can reach 12Hz at /64 and 1Hz at /1024
+    const uint32_t rate = hz > 0 ? hz : 1;
+    const bool slow = rate < 12;
+    const uint32_t ticks = SystemCoreClock / (slow ? 1024 : 64) / rate;
+    TC3->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 |
+                             TC_CTRLA_WAVEGEN_MFRQ |
+                             (slow ? TC_CTRLA_PRESCALER_DIV1024 : TC_CTRLA_PRESCALER_DIV64);
+    TC3->COUNT16.CC[0].reg = (ticks > 0xFFFF ? 0xFFFF : ticks) - 1;
+    while(TC3->COUNT16.STATUS.bit.SYNCBUSY);
+    // interrupt on match, below the WDT so we never delay a fault
+    TC3->COUNT16.INTENSET.reg = TC_INTENSET_MC0;
+    NVIC_DisableIRQ(TC3_IRQn);
+    NVIC_ClearPendingIRQ(TC3_IRQn);
+    NVIC_SetPriority(TC3_IRQn, 3); // Lowest priority
+    NVIC_EnableIRQ(TC3_IRQn);
+    // start sampling now!
+    TC3->COUNT16.CTRLA.bit.ENABLE = 1;
+    while(TC3->COUNT16.STATUS.bit.SYNCBUSY);
+}
+
+/* See FeatherTrace.h */
+void FeatherTrace::StopProfiler() {
+    TC3->COUNT16.CTRLA.bit.ENABLE = 0;
+    while(TC3->COUNT16.STATUS.bit.SYNCBUSY);
+    TC3->COUNT16.INTENCLR.reg = TC_INTENCLR_MC0;
+    NVIC_DisableIRQ(TC3_IRQn);
+}
+
+/* See FeatherTrace.h */
+void FeatherTrace::ClearProfile() {
+    NVIC_DisableIRQ(TC3_IRQn);
+    for (size_t i = 0; i < FEATHERTRACE_PROFILER_SLOTS; i++) {
+        profile_table[i].address = 0;
+        profile_table[i].self = 0;
+        profile_table[i].inclusive = 0;
+    }
+    profile_samples = 0;
+    profile_dropped = 0;
+    if (TC3->COUNT16.CTRLA.bit.ENABLE)
+        NVIC_EnableIRQ(TC3_IRQn);
+}
+
+/* See FeatherTrace.h */
+size_t FeatherTrace::GetProfile(FeatherTrace::ProfileEntry* out, const size_t max_entries) {
+    // insertion sort the used entries into out, most self samples first
+    size_t len = 0;
+    for (size_t i = 0; i < FEATHERTRACE_PROFILER_SLOTS; i++) {
+        const FeatherTrace::ProfileEntry entry = { profile_table[i].address, profile_table[i].self, profile_table[i].inclusive };
+        if (entry.address == 0)
+            continue;
+        size_t pos = len < max_entries ? len : max_entries;
+        while (pos > 0 && out[pos - 1].self < entry.self) {
+            if (pos < max_entries)
+                out[pos] = out[pos - 1];
+            pos--;
+        }
+        if (pos < max_entries) {
+            out[pos] = entry;
+            if (len < max_entries)
+                len++;
+        }
+    }
+    return len;
+}
+
+/* See FeatherTrace.h */
+void FeatherTrace::PrintProfile(Print& where, const size_t max_entries) {
+    where.print("Profile samples: ");
+    where.print(profile_samples);
+    where.print(", dropped: ");
+    where.println(profile_dropped);
+    where.println("Address, self, inclusive");
+    FeatherTrace::ProfileEntry top[32];
+    const size_t count = FeatherTrace::GetProfile(top, max_entries < 32 ? max_entries : 32);
+    for (size_t i = 0; i < count; i++) {
+        const FeatherTrace::ProfileEntry& entry = top[i];
+        char buf[48];
+        snprintf(buf, sizeof(buf), "0x%08lx, %lu, %lu", entry.address, entry.self, entry.inclusive);
+        where.println(buf);
+    }
+}
+#endif
+
+#endif // ARDUINO_ARCH_SAMD
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * A subset of the Arduino Print class for host builds, with the overloads
+ * used by FeatherTrace. Implement write to send the output somewhere.
+ */
+class Print {
+public:
+    virtual ~Print() {}
+
+    /** Write a single character, returning the number of characters written */
+    virtual size_t write(uint8_t c) = 0;
+
+    /** Write a buffer, returning the number of characters written */
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t n = 0;
+        while (size-- > 0)
+            n += write(*buffer++);
+        return n;
+    }
+
+    size_t print(const char* str) { return write(reinterpret_cast<const uint8_t*>(str), strlen(str)); }
+    size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+    size_t print(int n) { return print(static_cast<long>(n)); }
+    size_t print(unsigned int n) { return print(static_cast<unsigned long>(n)); }
+    size_t print(long n) {
+        char buf[24];
+        snprintf(buf, sizeof(buf), "%ld", n);
+        return print(buf);
+    }
+    size_t print(unsigned long n) {
+        char buf[24];
+        snprintf(buf, sizeof(buf), "%lu", n);
+        return print(buf);
+    }
+
+    size_t println() { return print("\r\n"); }
+    template<typename T>
+    size_t println(T value) { return print(value) + println(); }
+};
+
+/** Print to a stdio stream (ex. stdout) */
+class FilePrint : public Print {
+public:
+    explicit FilePrint(FILE* file) : m_file(file) {}
+
+    size_t write(uint8_t c) override { return fputc(c, m_file) == EOF ? 0 : 1; }
+    size_t write(const uint8_t* buffer, size_t size) override { return fwrite(buffer, 1, size, m_file); }
+
+private:
+    FILE* m_file;
+};
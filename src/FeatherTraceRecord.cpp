@@ -0,0 +1,355 @@
+#include "FeatherTraceRecord.h"
+
+/** Writes fields to an EncodedRecord_t body, see FeatherTraceRecord.h for the format */
+struct RecordWriter {
+    uint8_t* pos;
+
+    void varint(uint32_t value) {
+        while (value >= 0x80) {
+            *(pos++) = static_cast<uint8_t>(value | 0x80);
+            value >>= 7;
+        }
+        *(pos++) = static_cast<uint8_t>(value);
+    }
+
+    void word(const uint32_t value) {
+        for (size_t i = 0; i < 4; i++)
+            *(pos++) = static_cast<uint8_t>(value >> (i * 8));
+    }
+
+    /** Start a field, returning the position of its value for end_field */
+    uint8_t* begin_field(const uint8_t tag) {
+        *(pos++) = tag;
+        // reserve one byte for the length, moved by end_field if it needs more
+        *(pos++) = 0;
+        return pos;
+    }
+
+    /** Fill in the length of a field started with begin_field */
+    void end_field(uint8_t* const value) {
+        const size_t len = static_cast<size_t>(pos - value);
+        const size_t extra = varint_size(static_cast<uint32_t>(len)) - 1;
+        if (extra > 0) {
+            for (size_t i = len; i > 0; i--)
+                value[i - 1 + extra] = value[i - 1];
+        }
+        pos = value - 1;
+        varint(static_cast<uint32_t>(len));
+        pos += len;
+    }
+
+    void varint_field(const uint8_t tag, const uint32_t value) {
+        if (value == 0)
+            return;
+        uint8_t* const value_pos = begin_field(tag);
+        varint(value);
+        end_field(value_pos);
+    }
+
+    void varints_field(const uint8_t tag, const uint32_t* values, const size_t count) {
+        if (count == 0)
+            return;
+        uint8_t* const value_pos = begin_field(tag);
+        for (size_t i = 0; i < count; i++)
+            varint(values[i]);
+        end_field(value_pos);
+    }
+
+    void string_field(const uint8_t tag, const char* str, const size_t max_len) {
+        size_t len = 0;
+        while (len < max_len && str[len] != '\0')
+            len++;
+        if (len == 0)
+            return;
+        uint8_t* const value_pos = begin_field(tag);
+        for (size_t i = 0; i < len; i++)
+            *(pos++) = static_cast<uint8_t>(str[i]);
+        end_field(value_pos);
+    }
+};
+
+/** Map a signed difference to an unsigned value, so small negative numbers make short varints */
+static inline uint32_t zigzag_encode(const uint32_t delta) {
+    return (delta << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(delta) >> 31);
+}
+
+/** Reverse zigzag_encode */
+static inline uint32_t zigzag_decode(const uint32_t value) {
+    return (value >> 1) ^ (0u - (value & 1));
+}
+
+/** Read a varint field into an array, returning the number of values read */
+static size_t read_varints(const uint8_t* value, const size_t len, uint32_t* out, const size_t max_count) {
+    const uint8_t* const end = value + len;
+    size_t count = 0;
+    while (value < end && count < max_count)
+        out[count++] = FeatherTrace::Record::ReadVarint(value, end);
+    return count;
+}
+
+/** Read a string field into a null terminated buffer */
+static void read_string(const uint8_t* value, const size_t len, char* out, const size_t out_size) {
+    const size_t count = len < out_size - 1 ? len : out_size - 1;
+    for (size_t i = 0; i < count; i++)
+        out[i] = static_cast<char>(value[i]);
+    out[count] = '\0';
+}
+
+/* See FeatherTraceRecord.h */
+uint32_t FeatherTrace::Record::Crc32(const uint8_t* data, const size_t len, const uint32_t crc_in) {
+    uint32_t crc = ~crc_in;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+/* See FeatherTraceRecord.h */
+void FeatherTrace::Record::EncodeRecord(const FaultDataFlash_t& trace, EncodedRecord_t& out) {
+    RecordWriter writer = { out.data.body };
+    writer.varint_field(TAG_CAUSE, trace.data.cause);
+    writer.varint_field(TAG_INTERRUPT_TYPE, trace.data.interrupt_type);
+    writer.varint_field(TAG_IS_CORRUPTED, trace.data.is_corrupted);
+    writer.varint_field(TAG_LINE, static_cast<uint32_t>(trace.data.line));
+    writer.string_field(TAG_FILE, trace.data.file, sizeof(trace.data.file) - 1);
+    writer.varint_field(TAG_SITE, trace.data.site);
+    // frames are usually close together in flash, so store the distance between them
+    if (trace.data.stacktrace[0] != 0) {
+        uint8_t* const value = writer.begin_field(TAG_STACKTRACE_DELTAS);
+        uint32_t prev = STACKTRACE_BASE;
+        for (size_t i = 0; i < MAX_STRACE && trace.data.stacktrace[i] != 0; i++) {
+            const uint32_t delta = zigzag_encode(trace.data.stacktrace[i] - prev);
+            // drop the deepest frames if they don't fit
+            if (static_cast<size_t>(writer.pos - value) + varint_size(delta) > FEATHERTRACE_STRACE_BYTES)
+                break;
+            writer.varint(delta);
+            prev = trace.data.stacktrace[i];
+        }
+        writer.end_field(value);
+    }
+#if FEATHERTRACE_SAVE_REGISTERS
+    // registers are only saved in an exception
+    if (trace.data.interrupt_type != 0) {
+        uint8_t* const value = writer.begin_field(TAG_REGS);
+        for (size_t i = 0; i < 16; i++)
+            writer.varint(trace.data.regs[i]);
+        writer.varint(trace.data.xpsr);
+        writer.end_field(value);
+    }
+#endif
+#if FEATHERTRACE_MARK_HISTORY > 0
+    const uint32_t history_len = trace.data.mark_history_len;
+    writer.varints_field(TAG_MARK_HISTORY, trace.data.mark_history,
+        history_len < FEATHERTRACE_MARK_HISTORY ? history_len : FEATHERTRACE_MARK_HISTORY);
+#endif
+#if FEATHERTRACE_STACK_WINDOW > 0
+    if (trace.data.stack_window_len > 0) {
+        const uint32_t len = trace.data.stack_window_len;
+        const uint32_t words = (len < FEATHERTRACE_STACK_WINDOW ? len : FEATHERTRACE_STACK_WINDOW) / 4;
+        uint8_t* const value = writer.begin_field(TAG_STACK_WINDOW);
+        writer.varint(trace.data.stack_window_addr);
+        // the stack is mostly addresses and large values, which varints would only make longer
+        for (uint32_t i = 0; i < words; i++)
+            writer.word(trace.data.stack_window[i]);
+        writer.end_field(value);
+    }
+#endif
+#if FEATHERTRACE_WDT_CHANNELS > 0
+    writer.string_field(TAG_STARVED_CHANNEL, trace.data.starved_channel, sizeof(trace.data.starved_channel) - 1);
+#endif
+#if FEATHERTRACE_STACK_PAINT
+    writer.varint_field(TAG_STACK_HIGH_WATER, trace.data.stack_high_water);
+#endif
+#if FEATHERTRACE_SLEEP_WDT
+    writer.varint_field(TAG_WAKE_COUNT, trace.data.wake_count);
+#endif
+#if FEATHERTRACE_SIGNATURE
+    writer.varint_field(TAG_SIGNATURE, trace.data.signature);
+#endif
+#if FEATHERTRACE_HEAP_HOOKS
+    // the heap is only saved for out of memory faults, and is all zero otherwise
+    bool has_heap_stats = false;
+    for (size_t i = 0; i < 6; i++)
+        has_heap_stats = has_heap_stats || trace.data.heap_stats[i] != 0;
+    if (has_heap_stats) {
+        writer.varints_field(TAG_HEAP_STATS, trace.data.heap_stats, 6);
+        const uint32_t sites_len = trace.data.heap_sites_len;
+        writer.varints_field(TAG_HEAP_SITES, trace.data.heap_sites[0],
+            (sites_len < FEATHERTRACE_HEAP_SITES ? sites_len : FEATHERTRACE_HEAP_SITES) * 2);
+    }
+#endif
+#if FEATHERTRACE_LOG_ENTRIES > 0
+    const uint32_t log_len = trace.data.log_len < FEATHERTRACE_LOG_SAVED ? trace.data.log_len : FEATHERTRACE_LOG_SAVED;
+    if (log_len > 0) {
+        uint8_t* const value = writer.begin_field(TAG_EVENT_LOG);
+        for (uint32_t i = 0; i < log_len; i++) {
+            const uint32_t count = trace.data.log[i][0] >> 28;
+            writer.varint(trace.data.log[i][0]);
+            for (uint32_t a = 0; a < count && a < FEATHERTRACE_LOG_MAX_ARGS; a++)
+                writer.varint(trace.data.log[i][1 + a]);
+        }
+        writer.end_field(value);
+    }
+#endif
+    out.data.header.head = FEATHERTRACE_HEAD;
+    out.data.header.version = FEATHERTRACE_RECORD_VERSION;
+    out.data.header.length = static_cast<uint16_t>(writer.pos - out.data.body);
+    out.data.header.failnum = 0;
+    out.data.header.crc = 0;
+    // pad to a whole word, so the padding is written as 0xFF
+    while ((writer.pos - out.data.body) % 4 != 0)
+        *(writer.pos++) = 0xFF;
+}
+
+/* See FeatherTraceRecord.h */
+void FeatherTrace::Record::SealRecord(EncodedRecord_t& record, const uint32_t failnum) {
+    record.data.header.failnum = failnum;
+    const uint8_t* const header_u8 = reinterpret_cast<const uint8_t*>(&record.data.header);
+    const uint32_t crc = Crc32(header_u8 + offsetof(RecordHeader, version), offsetof(RecordHeader, crc) - offsetof(RecordHeader, version));
+    record.data.header.crc = Crc32(record.data.body, record.data.header.length, crc);
+}
+
+/* See FeatherTraceRecord.h */
+size_t FeatherTrace::Record::CheckHeader(const uint8_t* data, const size_t available) {
+    if (available < sizeof(RecordHeader))
+        return 0;
+    const RecordHeader& header = *reinterpret_cast<const RecordHeader*>(data);
+    if (header.head != FEATHERTRACE_HEAD
+        || header.version != FEATHERTRACE_RECORD_VERSION
+        || header.length > available - sizeof(RecordHeader))
+        return 0;
+    return (sizeof(RecordHeader) + header.length + 3) / 4 * 4;
+}
+
+/* See FeatherTraceRecord.h */
+size_t FeatherTrace::Record::CheckRecord(const uint8_t* data, const size_t available) {
+    const size_t size = CheckHeader(data, available);
+    if (size == 0)
+        return 0;
+    const RecordHeader& header = *reinterpret_cast<const RecordHeader*>(data);
+    const uint32_t crc = Crc32(data + offsetof(RecordHeader, version), offsetof(RecordHeader, crc) - offsetof(RecordHeader, version));
+    if (Crc32(data + sizeof(RecordHeader), header.length, crc) != header.crc)
+        return 0;
+    return size;
+}
+
+/* See FeatherTraceRecord.h */
+void FeatherTrace::Record::DecodeRecord(const uint8_t* data, FaultDataFlash_t& out) {
+    const RecordHeader& header = *reinterpret_cast<const RecordHeader*>(data);
+    out = FaultDataFlash_t();
+    out.data.failnum = header.failnum;
+    const uint8_t* pos = data + sizeof(RecordHeader);
+    const uint8_t* const end = pos + header.length;
+    uint8_t tag;
+    const uint8_t* value;
+    size_t len;
+    while (NextField(pos, end, tag, value, len)) {
+        const uint8_t* const value_end = value + len;
+        switch (tag) {
+            case TAG_CAUSE: out.data.cause = ReadVarint(value, value_end); break;
+            case TAG_INTERRUPT_TYPE: out.data.interrupt_type = ReadVarint(value, value_end); break;
+            case TAG_IS_CORRUPTED: out.data.is_corrupted = ReadVarint(value, value_end); break;
+            case TAG_LINE: out.data.line = static_cast<int32_t>(ReadVarint(value, value_end)); break;
+            case TAG_FILE: read_string(value, len, out.data.file, sizeof(out.data.file)); break;
+            case TAG_SITE: out.data.site = ReadVarint(value, value_end); break;
+            case TAG_STACKTRACE: read_varints(value, len, out.data.stacktrace, MAX_STRACE); break;
+            case TAG_STACKTRACE_DELTAS: {
+                const size_t count = read_varints(value, len, out.data.stacktrace, MAX_STRACE);
+                uint32_t prev = STACKTRACE_BASE;
+                for (size_t i = 0; i < count; i++) {
+                    prev += zigzag_decode(out.data.stacktrace[i]);
+                    out.data.stacktrace[i] = prev;
+                }
+                break;
+            }
+#if FEATHERTRACE_SAVE_REGISTERS
+            case TAG_REGS: {
+                uint32_t regs[17] = {};
+                read_varints(value, len, regs, 17);
+                for (size_t i = 0; i < 16; i++)
+                    out.data.regs[i] = regs[i];
+                out.data.xpsr = regs[16];
+                break;
+            }
+#endif
+#if FEATHERTRACE_MARK_HISTORY > 0
+            case TAG_MARK_HISTORY:
+                out.data.mark_history_len = read_varints(value, len, out.data.mark_history, FEATHERTRACE_MARK_HISTORY);
+                break;
+#endif
+#if FEATHERTRACE_STACK_WINDOW > 0
+            case TAG_STACK_WINDOW: {
+                out.data.stack_window_addr = ReadVarint(value, value_end);
+                uint32_t words = 0;
+                for (; value + 4 <= value_end && words < FEATHERTRACE_STACK_WINDOW / 4; value += 4) {
+                    out.data.stack_window[words++] = static_cast<uint32_t>(value[0]) | (static_cast<uint32_t>(value[1]) << 8)
+                        | (static_cast<uint32_t>(value[2]) << 16) | (static_cast<uint32_t>(value[3]) << 24);
+                }
+                out.data.stack_window_len = words * 4;
+                break;
+            }
+#endif
+#if FEATHERTRACE_WDT_CHANNELS > 0
+            case TAG_STARVED_CHANNEL:
+                read_string(value, len, out.data.starved_channel, sizeof(out.data.starved_channel));
+                break;
+#endif
+#if FEATHERTRACE_STACK_PAINT
+            case TAG_STACK_HIGH_WATER: out.data.stack_high_water = ReadVarint(value, value_end); break;
+#endif
+#if FEATHERTRACE_SLEEP_WDT
+            case TAG_WAKE_COUNT: out.data.wake_count = ReadVarint(value, value_end); break;
+#endif
+#if FEATHERTRACE_SIGNATURE
+            case TAG_SIGNATURE: out.data.signature = ReadVarint(value, value_end); break;
+#endif
+#if FEATHERTRACE_HEAP_HOOKS
+            case TAG_HEAP_STATS: read_varints(value, len, out.data.heap_stats, 6); break;
+            case TAG_HEAP_SITES:
+                out.data.heap_sites_len = read_varints(value, len, out.data.heap_sites[0], FEATHERTRACE_HEAP_SITES * 2) / 2;
+                break;
+#endif
+#if FEATHERTRACE_LOG_ENTRIES > 0
+            case TAG_EVENT_LOG: {
+                uint32_t count = 0;
+                while (value < value_end && count < FEATHERTRACE_LOG_SAVED) {
+                    uint32_t* const entry = out.data.log[count++];
+                    entry[0] = ReadVarint(value, value_end);
+                    for (uint32_t a = 0; a < (entry[0] >> 28) && a < FEATHERTRACE_LOG_MAX_ARGS; a++)
+                        entry[1 + a] = ReadVarint(value, value_end);
+                }
+                out.data.log_len = count;
+                break;
+            }
+#endif
+            default: break;
+        }
+    }
+}
+
+/* See FeatherTraceRecord.h */
+uint32_t FeatherTrace::Record::ReadVarint(const uint8_t*& pos, const uint8_t* end) {
+    uint32_t value = 0;
+    for (uint32_t shift = 0; pos < end && shift < 35; shift += 7) {
+        const uint8_t byte = *(pos++);
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return value;
+    }
+    return 0;
+}
+
+/* See FeatherTraceRecord.h */
+bool FeatherTrace::Record::NextField(const uint8_t*& pos, const uint8_t* end, uint8_t& tag, const uint8_t*& value, size_t& len) {
+    if (pos >= end)
+        return false;
+    tag = *(pos++);
+    len = ReadVarint(pos, end);
+    if (len > static_cast<size_t>(end - pos))
+        return false;
+    value = pos;
+    pos += len;
+    return true;
+}
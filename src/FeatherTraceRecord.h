@@ -0,0 +1,282 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "FeatherTraceConfig.h"
+
+/**
+ * Layout of a fault record in the flash log, shared by FeatherTraceCore.cpp,
+ * the hardware backends, and the host tools.
+ *
+ * Faults are collected in a FaultDataFlash_t, and encoded before they are written
+ * to flash: a RecordHeader followed by a list of fields, each a tag byte (see
+ * RecordTag), the length of the value as a varint, and the value. Numbers are
+ * stored as little endian base 128 varints, and empty fields are left out, so
+ * most records are a fraction of their worst case size. Records are packed one
+ * after another in the flash log, word aligned.
+ *
+ * tools/recover_trace/recover_trace.py must be changed to reflect changes to this format.
+ */
+
+/** Value of RecordHeader::head, used to find records in a flash dump */
+static constexpr uint32_t FEATHERTRACE_HEAD = 0xFEFE2A2A;
+/** Value of RecordHeader::version, increment if the meaning of an existing tag changes */
+static constexpr uint16_t FEATHERTRACE_RECORD_VERSION = 1;
+
+/** Header of an encoded record */
+struct RecordHeader {
+    uint32_t head;
+    uint16_t version;
+    /** Number of bytes of fields following the header */
+    uint16_t length;
+    /** See FeatherTrace::FaultData::failnum, also used as the sequence number of the record */
+    uint32_t failnum;
+    /** CRC-32 (as used by zlib) of version, length, failnum, and the fields */
+    uint32_t crc;
+};
+static_assert(sizeof(RecordHeader) == 16, "RecordHeader must not be padded");
+
+/** Tags of the fields in an encoded record, unknown tags are skipped when decoding */
+enum RecordTag : uint8_t {
+    /** varint */
+    TAG_CAUSE = 1,
+    /** varint */
+    TAG_INTERRUPT_TYPE = 2,
+    /** varint */
+    TAG_IS_CORRUPTED = 3,
+    /** varint */
+    TAG_LINE = 4,
+    /** characters, without the null terminator */
+    TAG_FILE = 5,
+    /** varint */
+    TAG_SITE = 6,
+    /** varints, replaced by TAG_STACKTRACE_DELTAS but still read */
+    TAG_STACKTRACE = 7,
+    /** 17 varints, R0-R15 then xPSR */
+    TAG_REGS = 8,
+    /** varints, oldest first */
+    TAG_MARK_HISTORY = 9,
+    /** address as a varint, then the contents of the stack as little endian words */
+    TAG_STACK_WINDOW = 10,
+    /** characters, without the null terminator */
+    TAG_STARVED_CHANNEL = 11,
+    /** varint */
+    TAG_STACK_HIGH_WATER = 12,
+    /** 6 varints, in the same order as FeatherTrace::HeapStats */
+    TAG_HEAP_STATS = 13,
+    /** pairs of caller and size varints, oldest first */
+    TAG_HEAP_SITES = 14,
+    /** for each entry, the header (see log_header) then each argument as varints, oldest first */
+    TAG_EVENT_LOG = 15,
+    /** zigzag varints of the difference between each frame and the one before it, the first frame from STACKTRACE_BASE */
+    TAG_STACKTRACE_DELTAS = 16,
+    /** varint */
+    TAG_WAKE_COUNT = 17,
+    /** varint */
+    TAG_SIGNATURE = 18
+};
+
+/** Address the first frame of TAG_STACKTRACE_DELTAS is relative to, the start of flash on the SAMD21 */
+static constexpr uint32_t STACKTRACE_BASE = 0;
+
+/**
+ * A fault record before it is encoded, with the same meaning as FeatherTrace::FaultData.
+ * This is filled in by FeatherTrace::Fault, and by DecodeRecord when reading the flash log.
+ */
+struct FaultDataFlashStruct {
+    uint32_t cause;
+    uint32_t interrupt_type;
+    uint32_t stacktrace[MAX_STRACE];
+#if FEATHERTRACE_SAVE_REGISTERS
+    uint32_t regs[16];
+    uint32_t xpsr;
+#endif
+    uint32_t is_corrupted;
+    uint32_t failnum;
+    int32_t line;
+    // may be corrupted if is_corrupted is true
+    char file[64];
+    uint32_t site;
+#if FEATHERTRACE_MARK_HISTORY > 0
+    uint32_t mark_history_len;
+    // oldest first, see mark_history_entry for the format
+    uint32_t mark_history[FEATHERTRACE_MARK_HISTORY];
+#endif
+#if FEATHERTRACE_STACK_WINDOW > 0
+    uint32_t stack_window_addr;
+    // in bytes
+    uint32_t stack_window_len;
+    uint32_t stack_window[FEATHERTRACE_STACK_WINDOW / 4];
+#endif
+#if FEATHERTRACE_WDT_CHANNELS > 0
+    char starved_channel[16];
+#endif
+#if FEATHERTRACE_STACK_PAINT
+    // in bytes
+    uint32_t stack_high_water;
+#endif
+#if FEATHERTRACE_SLEEP_WDT
+    uint32_t wake_count;
+#endif
+#if FEATHERTRACE_SIGNATURE
+    uint32_t signature;
+#endif
+#if FEATHERTRACE_HEAP_HOOKS
+    // same order as FeatherTrace::HeapStats
+    uint32_t heap_stats[6];
+    uint32_t heap_sites_len;
+    // oldest first, pairs of caller and size
+    uint32_t heap_sites[FEATHERTRACE_HEAP_SITES][2];
+#endif
+#if FEATHERTRACE_LOG_ENTRIES > 0
+    uint32_t log_len;
+    // oldest first, a header word (see log_header) followed by the arguments
+    uint32_t log[FEATHERTRACE_LOG_SAVED][1 + FEATHERTRACE_LOG_MAX_ARGS];
+#endif
+};
+
+typedef struct {
+    struct FaultDataFlashStruct data;
+} FaultDataFlash_t;
+
+/** Maximum number of bytes in a varint encoding a 32-bit value */
+static constexpr size_t VARINT_MAX = 5;
+
+/** Number of bytes needed to encode value as a varint */
+static constexpr size_t varint_size(const uint32_t value) {
+    return value < 0x80 ? 1 : 1 + varint_size(value >> 7);
+}
+
+/** Maximum number of bytes needed to encode a field with a value of len bytes */
+static constexpr size_t field_size(const size_t len) {
+    return 1 + varint_size(static_cast<uint32_t>(len)) + len;
+}
+
+/** Maximum number of bytes of fields in an encoded record, with every field present and every varint as long as possible */
+static constexpr size_t RECORD_MAX_BODY = field_size(VARINT_MAX) * 5
+    + field_size(sizeof(FaultDataFlashStruct::file) - 1)
+    + field_size(FEATHERTRACE_STRACE_BYTES)
+#if FEATHERTRACE_SAVE_REGISTERS
+    + field_size(17 * VARINT_MAX)
+#endif
+#if FEATHERTRACE_MARK_HISTORY > 0
+    + field_size(FEATHERTRACE_MARK_HISTORY * VARINT_MAX)
+#endif
+#if FEATHERTRACE_STACK_WINDOW > 0
+    + field_size(VARINT_MAX + FEATHERTRACE_STACK_WINDOW)
+#endif
+#if FEATHERTRACE_WDT_CHANNELS > 0
+    + field_size(sizeof(FaultDataFlashStruct::starved_channel) - 1)
+#endif
+#if FEATHERTRACE_STACK_PAINT
+    + field_size(VARINT_MAX)
+#endif
+#if FEATHERTRACE_SLEEP_WDT
+    + field_size(VARINT_MAX)
+#endif
+#if FEATHERTRACE_SIGNATURE
+    + field_size(VARINT_MAX)
+#endif
+#if FEATHERTRACE_HEAP_HOOKS
+    + field_size(6 * VARINT_MAX)
+    + field_size(FEATHERTRACE_HEAP_SITES * 2 * VARINT_MAX)
+#endif
+#if FEATHERTRACE_LOG_ENTRIES > 0
+    + field_size(FEATHERTRACE_LOG_SAVED * (1 + FEATHERTRACE_LOG_MAX_ARGS) * VARINT_MAX)
+#endif
+    ;
+static_assert(RECORD_MAX_BODY <= UINT16_MAX, "Fault record is too large, reduce the size of the optional features");
+
+/** An encoded record, ready to be written to flash */
+typedef union {
+    struct {
+        RecordHeader header;
+        // rounded up to a word, for the padding written by EncodeRecord
+        uint8_t body[(RECORD_MAX_BODY + 3) / 4 * 4];
+    } data;
+    uint32_t raw_u32[(sizeof(RecordHeader) + RECORD_MAX_BODY + 3) / 4];
+} EncodedRecord_t;
+
+/**
+ * Amount of flash reserved for each of FEATHERTRACE_LOG_SLOTS, enough for the
+ * largest possible record rounded up to the nearest 256 byte NVM row (512 bytes
+ * without extra features). Most records are much smaller, and since records are
+ * packed together, far more than FEATHERTRACE_LOG_SLOTS faults usually fit.
+ */
+static constexpr size_t FLASH_SLOT_SIZE = (sizeof(EncodedRecord_t) + 255) / 256 * 256;
+static_assert(FEATHERTRACE_LOG_SLOTS >= 1, "FEATHERTRACE_LOG_SLOTS must be at least 1");
+/** Size of the flash log, see FEATHERTRACE_LOG_BYTES */
+static constexpr size_t FLASH_LOG_SIZE = FEATHERTRACE_LOG_BYTES > 0 ? FEATHERTRACE_LOG_BYTES : FLASH_SLOT_SIZE * FEATHERTRACE_LOG_SLOTS;
+static_assert(FLASH_LOG_SIZE >= FLASH_SLOT_SIZE, "FEATHERTRACE_LOG_BYTES is too small for the largest possible fault, reduce the size of the optional features");
+
+namespace FeatherTrace {
+namespace Record {
+
+    /**
+     * Standard CRC-32 (as used by zlib), computed bitwise to save flash.
+     * @param data Bytes to checksum.
+     * @param len Number of bytes in data.
+     * @param crc The CRC of the bytes before data, to checksum data in pieces.
+     */
+    uint32_t Crc32(const uint8_t* data, const size_t len, const uint32_t crc = 0);
+
+    /**
+     * Encode a record, and fill in every field of the header except failnum and crc.
+     * @param trace Record to encode.
+     * @param out[out] Encoded record, see SealRecord.
+     */
+    void EncodeRecord(const FaultDataFlash_t& trace, EncodedRecord_t& out);
+
+    /**
+     * Set the failure number of an encoded record, and compute its CRC.
+     * @param record[in,out] Record from EncodeRecord.
+     * @param failnum Failure number to save.
+     */
+    void SealRecord(EncodedRecord_t& record, const uint32_t failnum);
+
+    /**
+     * Check if a well-formed header of the current version starts at data, without
+     * checking the CRC. This is much faster than CheckRecord, for finding candidates.
+     * @param data Start of the record, must be word aligned.
+     * @param available Number of bytes readable from data.
+     * @return The size of the record in bytes rounded up to a word, or 0 if the header is not valid.
+     */
+    size_t CheckHeader(const uint8_t* data, const size_t available);
+
+    /**
+     * Check if a complete, uncorrupted record of the current version starts at data.
+     * @param data Start of the record, must be word aligned.
+     * @param available Number of bytes readable from data.
+     * @return The size of the record in bytes rounded up to a word, or 0 if it is not valid.
+     */
+    size_t CheckRecord(const uint8_t* data, const size_t available);
+
+    /**
+     * Decode a record checked by CheckRecord, truncating fields that are larger
+     * than FeatherTrace was built to store.
+     * @param data Start of the record.
+     * @param out[out] Decoded record.
+     */
+    void DecodeRecord(const uint8_t* data, FaultDataFlash_t& out);
+
+    /**
+     * Read a varint.
+     * @param pos[in,out] Position to read from, moved past the varint.
+     * @param end End of the data that can be read.
+     * @return The value, or 0 if the varint was truncated.
+     */
+    uint32_t ReadVarint(const uint8_t*& pos, const uint8_t* end);
+
+    /**
+     * Read the next field of a record.
+     * @param pos[in,out] Position of the field, moved past it.
+     * @param end End of the fields, from RecordHeader::length.
+     * @param tag[out] Tag of the field, see RecordTag.
+     * @param value[out] Start of the value.
+     * @param len[out] Length of the value in bytes.
+     * @return false if there are no more fields.
+     */
+    bool NextField(const uint8_t*& pos, const uint8_t* end, uint8_t& tag, const uint8_t*& value, size_t& len);
+
+}
+}
@@ -0,0 +1,321 @@
+#include "FeatherTraceUnwind.h"
+
+using namespace FeatherTrace::Unwind;
+
+/** Value of the second word of an exidx entry for a function that can't be unwound */
+static constexpr uint32_t EXIDX_CANTUNWIND = 1;
+/** Opcode to stop executing unwind instructions */
+static constexpr uint8_t OP_FINISH = 0xB0;
+
+/** State of the virtual registers while unwinding a single stack */
+struct UnwindState {
+    const UnwindConfig& config;
+    /** Virtual registers r0-r15 */
+    uint32_t r[16];
+    /** Virtual stack pointer, used while executing unwind instructions */
+    uint32_t vsp;
+    /** Whether or not the unwind instructions popped r15 */
+    bool pc_set;
+    /** Remaining instructions and reads before UNWIND_BUDGET */
+    uint32_t budget;
+    /** Reason for the last failure */
+    Result error;
+};
+
+/** Reads unwind instruction bytes, most significant byte first, from a sequence of words */
+struct OpcodeReader {
+    /** Remaining bytes in the current word, shifted so the next byte is in the top 8 bits */
+    uint32_t data;
+    /** Number of bytes left in data */
+    uint8_t bytes_left;
+    /** Number of words left after data */
+    uint8_t words_left;
+    /** Target address of the next word */
+    uint32_t next;
+};
+
+/** Charge one unit of budget, returning false if there is none left */
+static bool spend(UnwindState& state) {
+    if (state.budget == 0) {
+        state.error = UNWIND_BUDGET;
+        return false;
+    }
+    state.budget--;
+    return true;
+}
+
+/** Read a word of target memory, returning false on failure */
+static bool read_word(UnwindState& state, const uint32_t addr, uint32_t* out) {
+    if (!spend(state))
+        return false;
+    if ((addr & 3) != 0 || !state.config.read(state.config.ctx, addr, out)) {
+        state.error = UNWIND_BAD_MEMORY;
+        return false;
+    }
+    return true;
+}
+
+/** Decode a place-relative 31-bit signed offset */
+static uint32_t prel31(const uint32_t place, const uint32_t word) {
+    return place + static_cast<uint32_t>(static_cast<int32_t>(word << 1) >> 1);
+}
+
+/**
+ * Binary search .ARM.exidx for the entry covering addr.
+ * @param entry[out] Target address of the entry.
+ * @param function[out] Start address of the function the entry covers.
+ * @return false if there is no entry, or a read failed.
+ */
+static bool find_entry(UnwindState& state, const uint32_t addr, uint32_t* entry, uint32_t* function) {
+    const uint32_t count = (state.config.exidx_end - state.config.exidx_start) / 8;
+    uint32_t lo = 0;
+    uint32_t hi = count;
+    bool found = false;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        const uint32_t place = state.config.exidx_start + mid * 8;
+        uint32_t word;
+        if (!read_word(state, place, &word))
+            return false;
+        const uint32_t start = prel31(place, word);
+        if (start <= addr) {
+            *entry = place;
+            *function = start;
+            found = true;
+            lo = mid + 1;
+        }
+        else
+            hi = mid;
+    }
+    if (!found)
+        state.error = UNWIND_NO_ENTRY;
+    return found;
+}
+
+/** Get the next unwind instruction byte, returning OP_FINISH once they run out */
+static bool next_byte(UnwindState& state, OpcodeReader& ops, uint8_t* out) {
+    if (ops.bytes_left == 0) {
+        if (ops.words_left == 0) {
+            *out = OP_FINISH;
+            return true;
+        }
+        if (!read_word(state, ops.next, &ops.data))
+            return false;
+        ops.next += 4;
+        ops.words_left--;
+        ops.bytes_left = 4;
+    }
+    *out = static_cast<uint8_t>(ops.data >> 24);
+    ops.data <<= 8;
+    ops.bytes_left--;
+    return true;
+}
+
+/** Pop the core registers in mask (bit n = rn) from the virtual stack */
+static bool pop_registers(UnwindState& state, const uint16_t mask) {
+    for (uint8_t i = 0; i < 16; i++) {
+        if ((mask & (1u << i)) == 0)
+            continue;
+        if (!read_word(state, state.vsp, &state.r[i]))
+            return false;
+        state.vsp += 4;
+    }
+    if (mask & (1u << 13))
+        state.vsp = state.r[13];
+    if (mask & (1u << 15))
+        state.pc_set = true;
+    return true;
+}
+
+/** Fail with UNWIND_BAD_OPCODE */
+static bool bad_opcode(UnwindState& state) {
+    state.error = UNWIND_BAD_OPCODE;
+    return false;
+}
+
+/** Execute unwind instructions until finished, see EHABI section 10.3 */
+static bool execute(UnwindState& state, OpcodeReader& ops) {
+    while (true) {
+        uint8_t op;
+        uint8_t op2;
+        if (!spend(state) || !next_byte(state, ops, &op))
+            return false;
+        if ((op & 0xC0) == 0x00)
+            state.vsp += ((op & 0x3Fu) << 2) + 4;
+        else if ((op & 0xC0) == 0x40)
+            state.vsp -= ((op & 0x3Fu) << 2) + 4;
+        else if ((op & 0xF0) == 0x80) {
+            if (!next_byte(state, ops, &op2))
+                return false;
+            const uint16_t mask = static_cast<uint16_t>(((op & 0x0Fu) << 8) | op2);
+            // 0x8000 means refuse to unwind
+            if (mask == 0)
+                return bad_opcode(state);
+            if (!pop_registers(state, static_cast<uint16_t>(mask << 4)))
+                return false;
+        }
+        else if ((op & 0xF0) == 0x90) {
+            const uint8_t reg = op & 0x0F;
+            if (reg == 13 || reg == 15)
+                return bad_opcode(state);
+            state.vsp = state.r[reg];
+        }
+        else if ((op & 0xF0) == 0xA0) {
+            // pop r4-r[4+nnn], and r14 if bit 3 is set
+            uint16_t mask = static_cast<uint16_t>(((1u << ((op & 0x07) + 1)) - 1) << 4);
+            if (op & 0x08)
+                mask |= 1u << 14;
+            if (!pop_registers(state, mask))
+                return false;
+        }
+        else if (op == OP_FINISH)
+            break;
+        else if (op == 0xB1) {
+            if (!next_byte(state, ops, &op2))
+                return false;
+            if (op2 == 0 || (op2 & 0xF0) != 0)
+                return bad_opcode(state);
+            if (!pop_registers(state, op2))
+                return false;
+        }
+        else if (op == 0xB2) {
+            // vsp = vsp + 0x204 + (uleb128 << 2)
+            uint32_t value = 0;
+            uint8_t shift = 0;
+            do {
+                if (shift > 28 || !next_byte(state, ops, &op2))
+                    return shift > 28 ? bad_opcode(state) : false;
+                value |= static_cast<uint32_t>(op2 & 0x7F) << shift;
+                shift += 7;
+            } while (op2 & 0x80);
+            state.vsp += 0x204 + (value << 2);
+        }
+        else if (op == 0xB3 || op == 0xC8 || op == 0xC9 || op == 0xC6) {
+            // VFP or iWMMXt registers described by sssscccc, we only need to skip them
+            if (!next_byte(state, ops, &op2))
+                return false;
+            state.vsp += ((op2 & 0x0Fu) + 1) * 8 + (op == 0xB3 ? 4 : 0);
+        }
+        else if (op == 0xC7) {
+            // iWMMXt wCGR registers under mask
+            if (!next_byte(state, ops, &op2))
+                return false;
+            if (op2 == 0 || (op2 & 0xF0) != 0)
+                return bad_opcode(state);
+            for (uint8_t i = 0; i < 4; i++)
+                state.vsp += (op2 & (1u << i)) ? 4 : 0;
+        }
+        else if ((op & 0xF8) == 0xB8)
+            state.vsp += ((op & 0x07u) + 1) * 8 + 4;
+        else if ((op & 0xF8) == 0xC0 || (op & 0xF8) == 0xD0)
+            state.vsp += ((op & 0x07u) + 1) * 8;
+        else
+            return bad_opcode(state);
+    }
+    // if the instructions didn't set pc, the return address is in lr
+    if (!state.pc_set)
+        state.r[15] = state.r[14];
+    state.r[13] = state.vsp;
+    return true;
+}
+
+/** Set up an OpcodeReader for an exidx entry, see EHABI sections 6 and 7 */
+static bool load_opcodes(UnwindState& state, const uint32_t entry, OpcodeReader& ops) {
+    uint32_t word;
+    if (!read_word(state, entry + 4, &word))
+        return false;
+    if (word == EXIDX_CANTUNWIND) {
+        state.error = UNWIND_NO_ENTRY;
+        return false;
+    }
+    ops.words_left = 0;
+    if (word & 0x80000000) {
+        // compact model inlined into the table, only personality 0 fits
+        if ((word & 0x0F000000) != 0)
+            return bad_opcode(state);
+        ops.data = word << 8;
+        ops.bytes_left = 3;
+        return true;
+    }
+    // else the entry points to .ARM.extab
+    uint32_t table = prel31(entry + 4, word);
+    if (!read_word(state, table, &word))
+        return false;
+    if (word & 0x80000000) {
+        const uint8_t personality = (word >> 24) & 0x0F;
+        if (personality == 0) {
+            ops.data = word << 8;
+            ops.bytes_left = 3;
+        }
+        else if (personality == 1 || personality == 2) {
+            ops.data = word << 16;
+            ops.bytes_left = 2;
+            ops.words_left = (word >> 16) & 0xFF;
+            ops.next = table + 4;
+        }
+        else
+            return bad_opcode(state);
+        return true;
+    }
+    // generic model (ex. __gxx_personality_v0), opcodes follow the personality routine
+    // in the same format as personality 1
+    table += 4;
+    if (!read_word(state, table, &word))
+        return false;
+    ops.data = word << 8;
+    ops.bytes_left = 3;
+    ops.words_left = (word >> 24) & 0xFF;
+    ops.next = table + 4;
+    return true;
+}
+
+/* See FeatherTraceUnwind.h */
+size_t FeatherTrace::Unwind::Backtrace(const UnwindConfig& config, const uint32_t regs[16],
+    uint32_t* frames, const size_t max_frames, Result* result)
+{
+    UnwindState state = { config, {}, 0, false, config.max_instructions, UNWIND_END_OF_STACK };
+    for (uint8_t i = 0; i < 16; i++)
+        state.r[i] = regs[i];
+    size_t len = 0;
+    Result reason = UNWIND_END_OF_STACK;
+    while (true) {
+        const uint32_t pc = state.r[15] & ~1u;
+        if (pc == 0)
+            break;
+        if (len >= max_frames) {
+            reason = UNWIND_MAX_FRAMES;
+            break;
+        }
+        frames[len++] = pc;
+        // return addresses point after the call, which may be past the end of the function
+        const uint32_t lookup = len == 1 ? pc : pc - 2;
+        uint32_t entry;
+        uint32_t function;
+        OpcodeReader ops = {};
+        if (!find_entry(state, lookup, &entry, &function)) {
+            reason = state.error;
+            break;
+        }
+        if (config.stop_function != 0 && function == (config.stop_function & ~1u))
+            break;
+        if (!load_opcodes(state, entry, ops)) {
+            reason = state.error;
+            break;
+        }
+        const uint32_t old_sp = state.r[13];
+        const uint32_t old_pc = state.r[15];
+        state.vsp = state.r[13];
+        state.pc_set = false;
+        if (!execute(state, ops)) {
+            reason = state.error;
+            break;
+        }
+        if (state.r[13] == old_sp && state.r[15] == old_pc) {
+            reason = UNWIND_NO_PROGRESS;
+            break;
+        }
+    }
+    if (result != nullptr)
+        *result = reason;
+    return len;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * A self-contained ARM EHABI stack unwinder, used instead of libgcc's
+ * __gnu_Unwind_Backtrace if FEATHERTRACE_BUILTIN_UNWINDER is set.
+ *
+ * The unwinder binary searches the .ARM.exidx table (which the linker
+ * emits sorted by function address) and interprets the unwind opcodes
+ * directly, as described in "Exception Handling ABI for the ARM Architecture"
+ * (https://developer.arm.com/documentation/ihi0038/latest) section 10.
+ * All memory is read through a callback and every step counts against an
+ * instruction budget, so a corrupted stack or table can't fault or hang
+ * the unwinder.
+ *
+ * This file does not depend on Arduino, so it can also be used on a host
+ * to unwind a stack captured on the device.
+ */
+
+namespace FeatherTrace {
+namespace Unwind {
+
+    /**
+     * Function used by the unwinder to read a word of target memory.
+     * @param ctx User context from UnwindConfig::ctx.
+     * @param addr Word aligned target address to read.
+     * @param out[out] The word read.
+     * @return false if the address can't be read, which stops the unwind.
+     */
+    typedef bool (*ReadFn)(void* ctx, uint32_t addr, uint32_t* out);
+
+    /** Reason the unwinder stopped */
+    enum Result : uint8_t {
+        /** A frame had no caller (pc was zero, or stop_function was reached) */
+        UNWIND_END_OF_STACK = 0,
+        /** frames was filled before the end of the stack was reached */
+        UNWIND_MAX_FRAMES = 1,
+        /** A function was marked EXIDX_CANTUNWIND or had no exidx entry */
+        UNWIND_NO_ENTRY = 2,
+        /** An unwind instruction was invalid, or asked to refuse unwinding */
+        UNWIND_BAD_OPCODE = 3,
+        /** A read failed, usually because the stack pointer left the stack */
+        UNWIND_BAD_MEMORY = 4,
+        /** UnwindConfig::max_instructions was reached */
+        UNWIND_BUDGET = 5,
+        /** A frame did not change the stack pointer or program counter */
+        UNWIND_NO_PROGRESS = 6
+    };
+
+    /** Configuration for FeatherTrace::Unwind::Backtrace */
+    struct UnwindConfig {
+        /** Function used to read target memory */
+        ReadFn read;
+        /** Context passed to read */
+        void* ctx;
+        /** Target address of the start of .ARM.exidx (__exidx_start) */
+        uint32_t exidx_start;
+        /** Target address of the end of .ARM.exidx (__exidx_end) */
+        uint32_t exidx_end;
+        /** Address of a function to stop unwinding at (ex. main), or 0 for none */
+        uint32_t stop_function;
+        /** Maximum number of unwind instructions and memory reads before giving up */
+        uint32_t max_instructions;
+    };
+
+    /**
+     * Unwind a stack, starting from a register set.
+     *
+     * The first frame is regs[15] (the program counter), all other frames are
+     * return addresses. All addresses have the thumb bit cleared.
+     *
+     * @param config Memory access and limits to use.
+     * @param regs The registers r0-r15 at the start of the unwind. Only r4-r15 are used.
+     * @param frames[out] Array to store the addresses of each frame into.
+     * @param max_frames Size of frames.
+     * @param result[out] If not null, set to the reason the unwinder stopped.
+     * @return The number of frames written.
+     */
+    size_t Backtrace(const UnwindConfig& config, const uint32_t regs[16],
+        uint32_t* frames, const size_t max_frames, Result* result = nullptr);
+
+}
+}
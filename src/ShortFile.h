@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 namespace _ShortFilePrivate {
     using cstr = const char * const;
 
@@ -17,8 +19,47 @@ namespace _ShortFilePrivate {
         return past_last_slash(str, str);
     }
 
+    /** 32-bit FNV-1a offset basis and prime, see http://www.isthe.com/chongo/tech/comp/fnv/ */
+    static constexpr uint32_t fnv1a_basis = 2166136261u;
+    static constexpr uint32_t fnv1a_prime = 16777619u;
+
+    /** Fold a single byte into a running FNV-1a hash */
+    static constexpr uint32_t fnv1a_byte(uint32_t hash, uint8_t byte)
+    {
+        return static_cast<uint32_t>((hash ^ byte) * fnv1a_prime);
+    }
+
+    /** FNV-1a hash of a null terminated string, continuing from hash */
+    static constexpr uint32_t fnv1a_str(cstr str, uint32_t hash)
+    {
+        return *str == '\0' ? hash : fnv1a_str(str + 1, fnv1a_byte(hash, static_cast<uint8_t>(*str)));
+    }
+
+    /** FNV-1a hash of the four bytes of value (little endian), continuing from hash */
+    static constexpr uint32_t fnv1a_u32(uint32_t value, uint32_t hash)
+    {
+        return fnv1a_byte(fnv1a_byte(fnv1a_byte(fnv1a_byte(hash,
+            value & 0xFF), (value >> 8) & 0xFF), (value >> 16) & 0xFF), (value >> 24) & 0xFF);
+    }
+
+    /**
+     * Hash a filename and line number into a 32-bit MARK site ID. Only the
+     * part of the filename after the last slash is hashed, so the ID does not
+     * depend on where the project was built. The same FNV-1a functions are
+     * used by FeatherTrace::Core::ComputeSignature, and are mirrored by fnv1a
+     * in tools/recover_trace/recover_trace.py for both get_site_id (mapping an
+     * ID back to file:line using the ELF line table) and get_device_signature.
+     */
+    static constexpr uint32_t site_id(cstr file, uint32_t line)
+    {
+        return fnv1a_u32(line, fnv1a_str(past_last_slash(file), fnv1a_basis));
+    }
+
 }
 
 
 /** Use this macro to get the filename of the current file */
-#define __SHORT_FILE__ ({constexpr const char* const sf__ {_ShortFilePrivate::past_last_slash(__FILE__)}; sf__;})
\ No newline at end of file
+#define __SHORT_FILE__ ({constexpr const char* const sf__ {_ShortFilePrivate::past_last_slash(__FILE__)}; sf__;})
+
+/** Use this macro to get the MARK site ID of the current line, evaluated at compile time */
+#define __SITE_ID__ ({constexpr uint32_t sid__ {_ShortFilePrivate::site_id(__FILE__, __LINE__)}; sid__;})
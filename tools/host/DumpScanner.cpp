@@ -0,0 +1,74 @@
+#include "DumpScanner.h"
+#include "FeatherTraceRecord.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FEATHERTRACE_SCAN_SSE2 1
+#include <emmintrin.h>
+#else
+#define FEATHERTRACE_SCAN_SSE2 0
+#endif
+
+/** Index of the lowest set bit of a non-zero mask */
+static unsigned lowest_bit(unsigned mask) {
+    unsigned bit = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        bit++;
+    }
+    return bit;
+}
+
+/* See DumpScanner.h */
+size_t DumpScanner::FindHead(const uint8_t* data, size_t len, size_t offset) {
+#if FEATHERTRACE_SCAN_SSE2
+    // compare 16 words at a time, and only look for which one matched if any did
+    const __m128i head = _mm_set1_epi32(static_cast<int>(FEATHERTRACE_HEAD));
+    for (; offset + 64 <= len; offset += 64) {
+        const __m128i* const block = reinterpret_cast<const __m128i*>(data + offset);
+        const __m128i eq0 = _mm_cmpeq_epi32(_mm_loadu_si128(block), head);
+        const __m128i eq1 = _mm_cmpeq_epi32(_mm_loadu_si128(block + 1), head);
+        const __m128i eq2 = _mm_cmpeq_epi32(_mm_loadu_si128(block + 2), head);
+        const __m128i eq3 = _mm_cmpeq_epi32(_mm_loadu_si128(block + 3), head);
+        const __m128i any = _mm_or_si128(_mm_or_si128(eq0, eq1), _mm_or_si128(eq2, eq3));
+        if (_mm_movemask_epi8(any) == 0)
+            continue;
+        // one bit per word, in order
+        const unsigned mask = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(eq0)))
+            | (static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(eq1))) << 4)
+            | (static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(eq2))) << 8)
+            | (static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(eq3))) << 12);
+        return offset + 4 * lowest_bit(mask);
+    }
+#endif
+    // the rest of the dump, or all of it without SSE2
+    for (; offset + 4 <= len; offset += 4) {
+        uint32_t word;
+        memcpy(&word, data + offset, sizeof(word));
+        if (word == FEATHERTRACE_HEAD)
+            return offset;
+    }
+    return len;
+}
+
+/* See DumpScanner.h */
+std::vector<DumpScanner::DumpRecord> DumpScanner::FindRecords(const uint8_t* data, size_t len) {
+    std::vector<DumpRecord> records;
+    for (size_t offset = FindHead(data, len, 0); offset + sizeof(RecordHeader) <= len; ) {
+        const size_t size = FeatherTrace::Record::CheckRecord(data + offset, len - offset);
+        if (size == 0) {
+            offset = FindHead(data, len, offset + 4);
+            continue;
+        }
+        RecordHeader header;
+        memcpy(&header, data + offset, sizeof(header));
+        records.push_back({ static_cast<uint32_t>(offset), header.failnum, header.length });
+        offset = FindHead(data, len, offset + size);
+    }
+    // failnum doubles as the sequence number of the record
+    std::stable_sort(records.begin(), records.end(),
+        [](const DumpRecord& a, const DumpRecord& b) { return a.failnum > b.failnum; });
+    return records;
+}
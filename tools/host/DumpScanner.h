@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/**
+ * Find the fault records in a flash dump. Records are word aligned and start
+ * with FEATHERTRACE_HEAD, so the dump is first searched for words equal to the
+ * magic number, several words per instruction with SSE2 where it is available,
+ * and only those words are checked with FeatherTrace::Record::CheckRecord
+ * (which also checks the CRC). Most of a dump is erased flash or other data,
+ * so this is much faster than checking every word.
+ */
+namespace DumpScanner {
+    /** A record found by FindRecords */
+    struct DumpRecord {
+        /** Offset of the header from the start of the dump */
+        uint32_t offset;
+        /** See RecordHeader::failnum */
+        uint32_t failnum;
+        /** Number of bytes of fields following the header */
+        uint32_t length;
+    };
+
+    /**
+     * Find the next word equal to FEATHERTRACE_HEAD.
+     * @param offset Offset to start at, a multiple of 4.
+     * @return The offset of the word, or len if there isn't one.
+     */
+    size_t FindHead(const uint8_t* data, size_t len, size_t offset);
+
+    /**
+     * Find every valid record in a dump.
+     * @param data The dump, which must be word aligned.
+     * @return The records, newest (highest failnum) first.
+     */
+    std::vector<DumpRecord> FindRecords(const uint8_t* data, size_t len);
+}
@@ -0,0 +1,518 @@
+#include "ElfFile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+// See https://refspecs.linuxfoundation.org/elf/elf.pdf for the layout of these structures
+static constexpr size_t EHDR_SIZE = 52;
+static constexpr size_t SHDR_SIZE = 40;
+static constexpr size_t SYM_SIZE = 16;
+static constexpr uint32_t SHT_SYMTAB = 2;
+static constexpr uint32_t SHT_STRTAB = 3;
+static constexpr uint32_t SHT_NOBITS = 8;
+static constexpr uint32_t SHF_ALLOC = 2;
+static constexpr uint8_t STT_FUNC = 2;
+static constexpr uint32_t NT_GNU_BUILD_ID = 3;
+
+// See https://dwarfstd.org/doc/DWARF5.pdf section 6.2 for the line number program
+static constexpr uint8_t DW_LNS_copy = 1;
+static constexpr uint8_t DW_LNS_advance_pc = 2;
+static constexpr uint8_t DW_LNS_advance_line = 3;
+static constexpr uint8_t DW_LNS_set_file = 4;
+static constexpr uint8_t DW_LNS_const_add_pc = 8;
+static constexpr uint8_t DW_LNS_fixed_advance_pc = 9;
+static constexpr uint8_t DW_LNE_end_sequence = 1;
+static constexpr uint8_t DW_LNE_set_address = 2;
+static constexpr uint8_t DW_LNE_define_file = 3;
+static constexpr uint32_t DW_LNCT_path = 1;
+static constexpr uint32_t DW_LNCT_directory_index = 2;
+static constexpr uint32_t DW_FORM_block2 = 0x03;
+static constexpr uint32_t DW_FORM_block4 = 0x04;
+static constexpr uint32_t DW_FORM_data2 = 0x05;
+static constexpr uint32_t DW_FORM_data4 = 0x06;
+static constexpr uint32_t DW_FORM_data8 = 0x07;
+static constexpr uint32_t DW_FORM_string = 0x08;
+static constexpr uint32_t DW_FORM_block = 0x09;
+static constexpr uint32_t DW_FORM_block1 = 0x0a;
+static constexpr uint32_t DW_FORM_data1 = 0x0b;
+static constexpr uint32_t DW_FORM_sdata = 0x0d;
+static constexpr uint32_t DW_FORM_strp = 0x0e;
+static constexpr uint32_t DW_FORM_udata = 0x0f;
+static constexpr uint32_t DW_FORM_data16 = 0x1e;
+static constexpr uint32_t DW_FORM_line_strp = 0x1f;
+/** Index in m_files of a file that isn't in the line table */
+static constexpr uint32_t NO_FILE = 0xFFFFFFFF;
+
+/** Bounds checked reader for DWARF data, reads past the end return 0 and set failed */
+struct DwarfCursor {
+    const uint8_t* pos;
+    const uint8_t* end;
+    bool failed;
+
+    uint64_t fixed(size_t len) {
+        if (static_cast<size_t>(end - pos) < len) {
+            failed = true;
+            pos = end;
+            return 0;
+        }
+        uint64_t value = 0;
+        for (size_t i = 0; i < len; i++)
+            value |= static_cast<uint64_t>(pos[i]) << (8 * i);
+        pos += len;
+        return value;
+    }
+
+    uint64_t uleb() {
+        uint64_t value = 0;
+        for (unsigned shift = 0; pos < end; shift += 7) {
+            const uint8_t byte = *pos++;
+            if (shift < 64)
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+                return value;
+        }
+        failed = true;
+        return 0;
+    }
+
+    int64_t sleb() {
+        int64_t value = 0;
+        unsigned shift = 0;
+        while (pos < end) {
+            const uint8_t byte = *pos++;
+            if (shift < 64)
+                value |= static_cast<int64_t>(byte & 0x7F) << shift;
+            shift += 7;
+            if ((byte & 0x80) == 0) {
+                if (shift < 64 && (byte & 0x40))
+                    value |= -(static_cast<int64_t>(1) << shift);
+                return value;
+            }
+        }
+        failed = true;
+        return 0;
+    }
+
+    std::string cstr() {
+        const uint8_t* const start = pos;
+        while (pos < end && *pos != '\0')
+            pos++;
+        if (pos == end) {
+            failed = true;
+            return std::string();
+        }
+        return std::string(reinterpret_cast<const char*>(start), reinterpret_cast<const char*>(pos++));
+    }
+
+    void skip(uint64_t len) {
+        if (static_cast<uint64_t>(end - pos) < len) {
+            failed = true;
+            pos = end;
+        }
+        else
+            pos += len;
+    }
+};
+
+/* See ElfFile.h */
+bool ElfFile::Load(const std::string& path, std::string& error, const bool read_tables) {
+    m_sections.clear();
+    m_functions.clear();
+    m_files.clear();
+    m_lines.clear();
+    if (!m_file.Open(path, error))
+        return false;
+    m_data = m_file.Data();
+    m_size = m_file.Size();
+    // check for "\x7fELF", ELFCLASS32, and ELFDATA2LSB
+    if (m_size < EHDR_SIZE || memcmp(m_data, "\x7f" "ELF", 4) != 0
+        || m_data[4] != 1 || m_data[5] != 1) {
+        error = path + " is not a 32-bit little-endian ELF file";
+        return false;
+    }
+    const uint32_t shoff = u32(32);
+    const uint16_t shentsize = u16(46);
+    const uint16_t shnum = u16(48);
+    const uint16_t shstrndx = u16(50);
+    if (shentsize < SHDR_SIZE || shstrndx >= shnum
+        || static_cast<uint64_t>(shoff) + static_cast<uint64_t>(shnum) * shentsize > m_size) {
+        error = path + " has an invalid section header table";
+        return false;
+    }
+    const uint32_t shstrtab = u32(shoff + shstrndx * shentsize + 16);
+    // read the sections
+    for (uint16_t i = 0; i < shnum; i++) {
+        const size_t hdr = shoff + i * shentsize;
+        Section section;
+        section.name = str(shstrtab + u32(hdr));
+        section.type = u32(hdr + 4);
+        section.addr = u32(hdr + 12);
+        section.offset = u32(hdr + 16);
+        section.size = u32(hdr + 20);
+        section.link = u32(hdr + 24);
+        section.loaded = (u32(hdr + 8) & SHF_ALLOC) != 0 && section.type != SHT_NOBITS
+            && static_cast<uint64_t>(section.offset) + section.size <= m_size;
+        m_sections.push_back(section);
+    }
+    if (read_tables)
+        LoadTables();
+    return true;
+}
+
+/* See ElfFile.h */
+void ElfFile::LoadTables() {
+    m_functions.clear();
+    m_files.clear();
+    m_lines.clear();
+    // read the function symbols
+    for (const Section& symtab : m_sections) {
+        if (symtab.type != SHT_SYMTAB || symtab.link >= m_sections.size())
+            continue;
+        const uint32_t strtab = m_sections[symtab.link].offset;
+        for (uint32_t sym = symtab.offset; sym + SYM_SIZE <= symtab.offset + symtab.size && sym + SYM_SIZE <= m_size; sym += SYM_SIZE) {
+            if ((m_data[sym + 12] & 0x0F) != STT_FUNC)
+                continue;
+            Symbol symbol;
+            symbol.name = str(strtab + u32(sym));
+            symbol.addr = u32(sym + 4) & ~1u;
+            symbol.size = u32(sym + 8);
+            m_functions.push_back(symbol);
+        }
+    }
+    std::sort(m_functions.begin(), m_functions.end(),
+        [](const Symbol& a, const Symbol& b) { return a.addr < b.addr; });
+    // line information is optional, a broken line table is treated as a missing one
+    load_lines();
+}
+
+/* See ElfFile.h */
+std::vector<uint8_t> ElfFile::BuildId() const {
+    // a single note: name size, description size, type, "GNU\0", then the ID
+    const Section* const note = find_section(".note.gnu.build-id");
+    if (note == nullptr || note->size < 16)
+        return std::vector<uint8_t>();
+    const uint32_t namesz = u32(note->offset);
+    const uint32_t descsz = u32(note->offset + 4);
+    const uint32_t desc = 12 + (namesz + 3) / 4 * 4;
+    if (u32(note->offset + 8) != NT_GNU_BUILD_ID || desc > note->size || descsz > note->size - desc)
+        return std::vector<uint8_t>();
+    return std::vector<uint8_t>(m_data + note->offset + desc, m_data + note->offset + desc + descsz);
+}
+
+/* See ElfFile.h */
+uint64_t ElfFile::ContentHash() const {
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const uint8_t* data, size_t len) {
+        for (size_t i = 0; i < len; i++)
+            hash = (hash ^ data[i]) * 1099511628211ull;
+    };
+    // the symbol tables and the sections load_lines reads, but not the rest of the
+    // debug information, which is most of the file
+    for (const Section& section : m_sections) {
+        const bool tables = section.type == SHT_SYMTAB
+            || (section.type == SHT_STRTAB && section.name != ".shstrtab")
+            || section.name == ".debug_line" || section.name == ".debug_line_str" || section.name == ".debug_str";
+        if (!tables || static_cast<uint64_t>(section.offset) + section.size > m_size)
+            continue;
+        add(reinterpret_cast<const uint8_t*>(section.name.c_str()), section.name.size() + 1);
+        add(m_data + section.offset, section.size);
+    }
+    return hash;
+}
+
+/* See ElfFile.h */
+bool ElfFile::ReadWord(uint32_t addr, uint32_t* out) const {
+    for (const Section& section : m_sections) {
+        if (!section.loaded || addr < section.addr || addr - section.addr + 4 > section.size)
+            continue;
+        *out = u32(section.offset + (addr - section.addr));
+        return true;
+    }
+    return false;
+}
+
+/* See ElfFile.h */
+bool ElfFile::FindSection(const char* name, uint32_t* addr, uint32_t* size) const {
+    for (const Section& section : m_sections) {
+        if (section.name == name) {
+            *addr = section.addr;
+            *size = section.size;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* See ElfFile.h */
+uint32_t ElfFile::FindSymbol(const char* name) const {
+    for (const Symbol& symbol : m_functions) {
+        if (symbol.name == name)
+            return symbol.addr;
+    }
+    return 0;
+}
+
+/* See ElfFile.h */
+const std::string* ElfFile::FindFunction(uint32_t addr, uint32_t* offset) const {
+    // find the last function starting at or before addr
+    auto it = std::upper_bound(m_functions.begin(), m_functions.end(), addr,
+        [](uint32_t value, const Symbol& symbol) { return value < symbol.addr; });
+    if (it == m_functions.begin())
+        return nullptr;
+    --it;
+    if (it->size != 0 && addr - it->addr >= it->size)
+        return nullptr;
+    *offset = addr - it->addr;
+    return &it->name;
+}
+
+/* See ElfFile.h */
+std::string ElfFile::Symbolize(uint32_t addr) const {
+    uint32_t offset;
+    const std::string* const name = FindFunction(addr, &offset);
+    if (name == nullptr)
+        return "??";
+    char buf[16];
+    snprintf(buf, sizeof(buf), "+0x%x", static_cast<unsigned>(offset));
+    return *name + buf;
+}
+
+/* See ElfFile.h */
+bool ElfFile::FindLine(uint32_t addr, LineRow* out) const {
+    // find the last row starting at or before addr
+    auto it = std::upper_bound(m_lines.begin(), m_lines.end(), addr,
+        [](uint32_t value, const LineRow& row) { return value < row.addr; });
+    if (it == m_lines.begin())
+        return false;
+    --it;
+    if (it->end)
+        return false;
+    *out = *it;
+    return true;
+}
+
+const ElfFile::Section* ElfFile::find_section(const char* name) const {
+    for (const Section& section : m_sections) {
+        if (section.name == name && static_cast<uint64_t>(section.offset) + section.size <= m_size)
+            return &section;
+    }
+    return nullptr;
+}
+
+/**
+ * Read every line number program in .debug_line into m_lines and m_files.
+ * Sequences starting at address 0 are left out, since they belong to
+ * functions removed by --gc-sections.
+ */
+void ElfFile::load_lines() {
+    const Section* const debug_line = find_section(".debug_line");
+    if (debug_line == nullptr)
+        return;
+    const Section* const debug_str = find_section(".debug_str");
+    const Section* const debug_line_str = find_section(".debug_line_str");
+    const uint8_t* const data = m_data;
+    // read a string from a string section, for DW_FORM_strp and DW_FORM_line_strp
+    auto section_str = [this](const Section* section, uint64_t offset) {
+        return section != nullptr && offset < section->size ? str(section->offset + offset) : std::string();
+    };
+    DwarfCursor unit = { data + debug_line->offset, data + debug_line->offset + debug_line->size, false };
+    while (unit.pos < unit.end && !unit.failed) {
+        // unit header, see section 6.2.4
+        uint64_t unit_length = unit.fixed(4);
+        size_t offset_size = 4;
+        if (unit_length == 0xFFFFFFFF) {
+            unit_length = unit.fixed(8);
+            offset_size = 8;
+        }
+        if (unit.failed || unit_length > static_cast<uint64_t>(unit.end - unit.pos))
+            break;
+        DwarfCursor cur = { unit.pos, unit.pos + unit_length, false };
+        unit.pos += unit_length;
+        const uint16_t version = static_cast<uint16_t>(cur.fixed(2));
+        if (version < 2 || version > 5)
+            continue;
+        size_t address_size = 4;
+        if (version >= 5) {
+            address_size = static_cast<size_t>(cur.fixed(1));
+            cur.fixed(1); // segment_selector_size
+        }
+        const uint64_t header_length = cur.fixed(offset_size);
+        if (cur.failed || header_length > static_cast<uint64_t>(cur.end - cur.pos))
+            continue;
+        const uint8_t* const program = cur.pos + header_length;
+        const uint8_t min_inst_length = static_cast<uint8_t>(cur.fixed(1));
+        if (version >= 4)
+            cur.fixed(1); // maximum_operations_per_instruction, always 1 on ARM
+        cur.fixed(1); // default_is_stmt, every row is used
+        const int8_t line_base = static_cast<int8_t>(cur.fixed(1));
+        const uint8_t line_range = static_cast<uint8_t>(cur.fixed(1));
+        const uint8_t opcode_base = static_cast<uint8_t>(cur.fixed(1));
+        if (cur.failed || line_range == 0 || opcode_base == 0)
+            continue;
+        std::vector<uint8_t> opcode_lengths(opcode_base);
+        for (uint8_t i = 1; i < opcode_base; i++)
+            opcode_lengths[i] = static_cast<uint8_t>(cur.fixed(1));
+        // directories and files, with the index used by the line program
+        std::vector<std::string> dirs;
+        std::vector<uint32_t> files;
+        if (version < 5) {
+            // directory 0 is the compilation directory, and file 0 is not used
+            dirs.push_back(std::string());
+            files.push_back(NO_FILE);
+            for (std::string dir = cur.cstr(); !dir.empty() && !cur.failed; dir = cur.cstr())
+                dirs.push_back(dir);
+            for (std::string name = cur.cstr(); !name.empty() && !cur.failed; name = cur.cstr()) {
+                const uint64_t dir = cur.uleb();
+                cur.uleb(); // modification time
+                cur.uleb(); // length
+                files.push_back(static_cast<uint32_t>(m_files.size()));
+                m_files.push_back({ dir < dirs.size() ? dirs[dir] : std::string(), name });
+            }
+        }
+        else {
+            // each entry is a list of (content type, form) pairs, see section 6.2.4.1
+            bool supported = true;
+            auto read_entries = [&](bool is_file) {
+                std::vector<std::pair<uint64_t, uint64_t>> format(static_cast<size_t>(cur.fixed(1)));
+                for (auto& pair : format) {
+                    pair.first = cur.uleb();
+                    pair.second = cur.uleb();
+                }
+                const uint64_t count = cur.uleb();
+                for (uint64_t i = 0; i < count && !cur.failed && supported; i++) {
+                    std::string path;
+                    uint64_t dir = 0;
+                    for (const auto& pair : format) {
+                        uint64_t value = 0;
+                        std::string string;
+                        switch (pair.second) {
+                            case DW_FORM_string: string = cur.cstr(); break;
+                            case DW_FORM_strp: string = section_str(debug_str, cur.fixed(offset_size)); break;
+                            case DW_FORM_line_strp: string = section_str(debug_line_str, cur.fixed(offset_size)); break;
+                            case DW_FORM_data1: value = cur.fixed(1); break;
+                            case DW_FORM_data2: value = cur.fixed(2); break;
+                            case DW_FORM_data4: value = cur.fixed(4); break;
+                            case DW_FORM_data8: value = cur.fixed(8); break;
+                            case DW_FORM_data16: cur.skip(16); break;
+                            case DW_FORM_udata: value = cur.uleb(); break;
+                            case DW_FORM_sdata: cur.sleb(); break;
+                            case DW_FORM_block: cur.skip(cur.uleb()); break;
+                            case DW_FORM_block1: cur.skip(cur.fixed(1)); break;
+                            case DW_FORM_block2: cur.skip(cur.fixed(2)); break;
+                            case DW_FORM_block4: cur.skip(cur.fixed(4)); break;
+                            // other forms (ex. DW_FORM_strx) need .debug_info to read
+                            default: supported = false; break;
+                        }
+                        if (pair.first == DW_LNCT_path)
+                            path = string;
+                        else if (pair.first == DW_LNCT_directory_index)
+                            dir = value;
+                    }
+                    if (is_file) {
+                        files.push_back(static_cast<uint32_t>(m_files.size()));
+                        m_files.push_back({ dir < dirs.size() ? dirs[dir] : std::string(), path });
+                    }
+                    else
+                        dirs.push_back(path);
+                }
+            };
+            read_entries(false);
+            read_entries(true);
+            if (!supported)
+                continue;
+        }
+        if (cur.failed || program > cur.end)
+            continue;
+        // run the line number program, see section 6.2.5
+        cur.pos = program;
+        uint64_t address = 0;
+        uint64_t file = 1;
+        int64_t line = 1;
+        size_t sequence_start = m_lines.size();
+        auto emit = [&](bool end) {
+            const uint32_t index = file < files.size() ? files[file] : NO_FILE;
+            if (end)
+                m_lines.push_back({ static_cast<uint32_t>(address), 0, 0, true });
+            else if (index != NO_FILE)
+                m_lines.push_back({ static_cast<uint32_t>(address), static_cast<uint32_t>(line), index, false });
+        };
+        while (cur.pos < cur.end && !cur.failed) {
+            const uint8_t opcode = static_cast<uint8_t>(cur.fixed(1));
+            if (opcode >= opcode_base) {
+                const uint8_t adjusted = static_cast<uint8_t>(opcode - opcode_base);
+                address += static_cast<uint64_t>(adjusted / line_range) * min_inst_length;
+                line += line_base + adjusted % line_range;
+                emit(false);
+            }
+            else if (opcode == 0) {
+                const uint64_t len = cur.uleb();
+                if (len == 0 || len > static_cast<uint64_t>(cur.end - cur.pos))
+                    break;
+                const uint8_t* const next = cur.pos + len;
+                const uint8_t sub = static_cast<uint8_t>(cur.fixed(1));
+                if (sub == DW_LNE_end_sequence) {
+                    emit(true);
+                    if (m_lines.size() > sequence_start && m_lines[sequence_start].addr == 0)
+                        m_lines.resize(sequence_start);
+                    sequence_start = m_lines.size();
+                    address = 0;
+                    file = 1;
+                    line = 1;
+                }
+                else if (sub == DW_LNE_set_address)
+                    address = cur.fixed(address_size);
+                else if (sub == DW_LNE_define_file && version < 5) {
+                    const std::string name = cur.cstr();
+                    const uint64_t dir = cur.uleb();
+                    files.push_back(static_cast<uint32_t>(m_files.size()));
+                    m_files.push_back({ dir < dirs.size() ? dirs[dir] : std::string(), name });
+                }
+                cur.pos = next;
+            }
+            else if (opcode == DW_LNS_copy)
+                emit(false);
+            else if (opcode == DW_LNS_advance_pc)
+                address += cur.uleb() * min_inst_length;
+            else if (opcode == DW_LNS_advance_line)
+                line += cur.sleb();
+            else if (opcode == DW_LNS_set_file)
+                file = cur.uleb();
+            else if (opcode == DW_LNS_const_add_pc)
+                address += static_cast<uint64_t>((255 - opcode_base) / line_range) * min_inst_length;
+            else if (opcode == DW_LNS_fixed_advance_pc)
+                address += cur.fixed(2);
+            else {
+                // every other standard opcode only has ULEB128 operands, which we can skip
+                for (uint8_t i = 0; i < opcode_lengths[opcode]; i++)
+                    cur.uleb();
+            }
+        }
+        // drop an unterminated sequence
+        m_lines.resize(sequence_start);
+    }
+    // ends of sequences go first, so the row after them at the same address is found
+    std::stable_sort(m_lines.begin(), m_lines.end(), [](const LineRow& a, const LineRow& b) {
+        return a.addr < b.addr || (a.addr == b.addr && a.end && !b.end);
+    });
+}
+
+uint16_t ElfFile::u16(size_t offset) const {
+    if (offset + 2 > m_size)
+        return 0;
+    return static_cast<uint16_t>(m_data[offset] | (m_data[offset + 1] << 8));
+}
+
+uint32_t ElfFile::u32(size_t offset) const {
+    if (offset + 4 > m_size)
+        return 0;
+    return static_cast<uint32_t>(m_data[offset]) | (static_cast<uint32_t>(m_data[offset + 1]) << 8)
+        | (static_cast<uint32_t>(m_data[offset + 2]) << 16) | (static_cast<uint32_t>(m_data[offset + 3]) << 24);
+}
+
+std::string ElfFile::str(size_t offset) const {
+    std::string ret;
+    while (offset < m_size && m_data[offset] != '\0')
+        ret.push_back(static_cast<char>(m_data[offset++]));
+    return ret;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "MappedFile.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/**
+ * Minimal reader for little-endian 32-bit ELF files, enough to give
+ * FeatherTrace::Unwind the contents of flash and to name the frames
+ * it finds. Only sections are used, program headers are ignored.
+ * The file is mapped (see MappedFile), not copied.
+ * The DWARF line table (.debug_line, versions 2 to 5) is read if present,
+ * to find the file and line of an address.
+ */
+class ElfFile {
+public:
+    /** A file from the line table */
+    struct SourceFile {
+        /** Directory of the file, empty if it is the compilation directory */
+        std::string dir;
+        std::string name;
+    };
+
+    /** A row of the line table, covering addresses until the next row */
+    struct LineRow {
+        uint32_t addr;
+        uint32_t line;
+        /** Index of the file, see File */
+        uint32_t file;
+        /** True if this is the end of a sequence, and the addresses after it have no line */
+        bool end;
+    };
+
+    /** A function from the symbol table */
+    struct Symbol {
+        std::string name;
+        /** Address of the function, with the thumb bit cleared */
+        uint32_t addr;
+        /** Size of the function in bytes, 0 if it is unknown */
+        uint32_t size;
+    };
+
+    ElfFile() = default;
+    ElfFile(const ElfFile&) = delete;
+    ElfFile& operator=(const ElfFile&) = delete;
+
+    /**
+     * Map and parse an ELF file.
+     * @param path Path to the ELF file.
+     * @param error[out] Set to a description of the problem on failure.
+     * @param read_tables Read the symbol and line tables, which takes most of the time
+     * for large files. If false only the section headers are read, and LoadTables
+     * can be called later.
+     * @return false if the file could not be read or is not a 32-bit little-endian ELF.
+     */
+    bool Load(const std::string& path, std::string& error, const bool read_tables = true);
+
+    /** Read the symbol and line tables of a file loaded without them */
+    void LoadTables();
+
+    /** Get the contents of the .note.gnu.build-id section (from ld --build-id), or nothing if it doesn't exist */
+    std::vector<uint8_t> BuildId() const;
+
+    /**
+     * 64-bit FNV-1a hash of the symbol and string tables and the line table sections,
+     * for files without a build ID. The rest of the debug information is not read.
+     */
+    uint64_t ContentHash() const;
+
+    /**
+     * Read a word from an allocated section (ex. .text, .ARM.exidx).
+     * @return false if addr is not inside an allocated section with contents.
+     */
+    bool ReadWord(uint32_t addr, uint32_t* out) const;
+
+    /**
+     * Get the address and size of a section by name.
+     * @return false if there is no section with that name.
+     */
+    bool FindSection(const char* name, uint32_t* addr, uint32_t* size) const;
+
+    /** Get the address of a symbol (with the thumb bit cleared), or 0 if it does not exist */
+    uint32_t FindSymbol(const char* name) const;
+
+    /**
+     * Find the function symbol containing addr.
+     * @param offset[out] Set to the offset of addr from the start of the function.
+     * @return The name of the function, or nullptr if it is unknown.
+     */
+    const std::string* FindFunction(uint32_t addr, uint32_t* offset) const;
+
+    /** Name the function containing addr, formatted as "name+0xoffset" or "??" if it is unknown */
+    std::string Symbolize(uint32_t addr) const;
+
+    /**
+     * Find the row of the line table covering addr.
+     * @return false if the ELF file has no line information for addr.
+     */
+    bool FindLine(uint32_t addr, LineRow* out) const;
+
+    /** Every function symbol, sorted by address */
+    const std::vector<Symbol>& Functions() const { return m_functions; }
+
+    /** Every row of the line table, sorted by address */
+    const std::vector<LineRow>& LineTable() const { return m_lines; }
+
+    /** Get a file of the line table, from LineRow::file */
+    const SourceFile& File(uint32_t index) const { return m_files[index]; }
+
+private:
+    struct Section {
+        std::string name;
+        uint32_t type;
+        /** sh_link, the string table of a symbol table */
+        uint32_t link;
+        uint32_t addr;
+        uint32_t size;
+        uint32_t offset;
+        bool loaded;
+    };
+
+    const Section* find_section(const char* name) const;
+    void load_lines();
+
+    uint16_t u16(size_t offset) const;
+    uint32_t u32(size_t offset) const;
+    std::string str(size_t offset) const;
+
+    MappedFile m_file;
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    std::vector<Section> m_sections;
+    /** Function symbols sorted by address */
+    std::vector<Symbol> m_functions;
+    std::vector<SourceFile> m_files;
+    /** Line table rows sorted by address, with the ends of sequences before rows at the same address */
+    std::vector<LineRow> m_lines;
+};
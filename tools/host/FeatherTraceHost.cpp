@@ -0,0 +1,249 @@
+#include "FeatherTraceHost.h"
+#include "DumpScanner.h"
+#include "ElfFile.h"
+#include "FeatherTraceRecord.h"
+#include "MappedFile.h"
+#include "SymbolIndex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/** Description of the last failure, see ft_last_error */
+static thread_local std::string last_error;
+
+struct ft_dump {
+    const uint8_t* data;
+    size_t len;
+    /** The file opened by ft_dump_open */
+    MappedFile file;
+    /** Copy of the data passed to ft_dump_open_memory if it isn't word aligned */
+    std::vector<uint8_t> buffer;
+    std::vector<DumpScanner::DumpRecord> records;
+};
+
+struct ft_symbols {
+    SymbolIndex index;
+    /** True if the index was loaded from the cache */
+    bool from_cache;
+};
+
+static void set_error(const std::string& error) {
+    last_error = error;
+}
+
+/**
+ * Find a field of a record.
+ * @return false if the record doesn't have the field, or index is out of range, and value is set to NULL.
+ */
+static bool find_field(const ft_dump* dump, size_t index, uint8_t tag, const uint8_t*& value, size_t& len) {
+    value = nullptr;
+    len = 0;
+    if (dump == nullptr || index >= dump->records.size())
+        return false;
+    const DumpScanner::DumpRecord& record = dump->records[index];
+    const uint8_t* pos = dump->data + record.offset + sizeof(RecordHeader);
+    const uint8_t* const end = pos + record.length;
+    uint8_t field_tag;
+    while (FeatherTrace::Record::NextField(pos, end, field_tag, value, len)) {
+        if (field_tag == tag)
+            return true;
+    }
+    value = nullptr;
+    len = 0;
+    return false;
+}
+
+/** Store value at out[count] if there is room, and return count + 1 */
+static size_t push_value(uint32_t* out, size_t max, size_t count, uint32_t value) {
+    if (count < max)
+        out[count] = value;
+    return count + 1;
+}
+
+/** Copy a location from SymbolIndex into the C structure */
+static void set_location(const SymbolIndex::Location& location, ft_location* out) {
+    out->function = location.function;
+    out->function_offset = location.function_offset;
+    out->dir = location.dir;
+    out->file = location.file;
+    out->line = location.line;
+}
+
+/* See FeatherTraceHost.h */
+uint32_t ft_host_version(void) {
+    return FT_HOST_API_VERSION;
+}
+
+/* See FeatherTraceHost.h */
+const char* ft_last_error(void) {
+    return last_error.c_str();
+}
+
+/* See FeatherTraceHost.h */
+ft_dump* ft_dump_open(const char* path) {
+    ft_dump* const dump = new ft_dump();
+    std::string error;
+    if (!dump->file.Open(path, error)) {
+        set_error(error);
+        delete dump;
+        return nullptr;
+    }
+    dump->data = dump->file.Data();
+    dump->len = dump->file.Size();
+    dump->records = DumpScanner::FindRecords(dump->data, dump->len);
+    return dump;
+}
+
+/* See FeatherTraceHost.h */
+ft_dump* ft_dump_open_memory(const uint8_t* data, size_t len) {
+    if (data == nullptr && len > 0) {
+        set_error("data is NULL");
+        return nullptr;
+    }
+    ft_dump* const dump = new ft_dump();
+    dump->data = data;
+    dump->len = len;
+    // CheckRecord reads the header in place, so copy data that isn't word aligned
+    if (reinterpret_cast<uintptr_t>(data) % 4 != 0) {
+        dump->buffer.assign(data, data + len);
+        dump->data = dump->buffer.data();
+    }
+    dump->records = DumpScanner::FindRecords(dump->data, dump->len);
+    return dump;
+}
+
+/* See FeatherTraceHost.h */
+void ft_dump_close(ft_dump* dump) {
+    delete dump;
+}
+
+/* See FeatherTraceHost.h */
+size_t ft_dump_count(const ft_dump* dump) {
+    return dump != nullptr ? dump->records.size() : 0;
+}
+
+/* See FeatherTraceHost.h */
+int ft_dump_record(const ft_dump* dump, size_t index, ft_record* out) {
+    if (dump == nullptr || index >= dump->records.size()) {
+        set_error("record index out of range");
+        return 0;
+    }
+    const DumpScanner::DumpRecord& record = dump->records[index];
+    out->failnum = record.failnum;
+    out->offset = record.offset;
+    out->length = record.length;
+    return 1;
+}
+
+/* See FeatherTraceHost.h */
+int ft_dump_has_field(const ft_dump* dump, size_t index, uint8_t tag) {
+    const uint8_t* value;
+    size_t len;
+    return find_field(dump, index, tag, value, len) ? 1 : 0;
+}
+
+/* See FeatherTraceHost.h */
+size_t ft_dump_values(const ft_dump* dump, size_t index, uint8_t tag, uint32_t* out, size_t max) {
+    const uint8_t* value;
+    size_t len;
+    if (!find_field(dump, index, tag, value, len))
+        return 0;
+    const uint8_t* const end = value + len;
+    size_t count = 0;
+    if (tag == TAG_STACK_WINDOW) {
+        count = push_value(out, max, count, FeatherTrace::Record::ReadVarint(value, end));
+        for (; value + 4 <= end; value += 4) {
+            count = push_value(out, max, count, static_cast<uint32_t>(value[0]) | (static_cast<uint32_t>(value[1]) << 8)
+                | (static_cast<uint32_t>(value[2]) << 16) | (static_cast<uint32_t>(value[3]) << 24));
+        }
+    }
+    else if (tag == TAG_STACKTRACE_DELTAS) {
+        uint32_t prev = STACKTRACE_BASE;
+        while (value < end) {
+            const uint32_t zigzag = FeatherTrace::Record::ReadVarint(value, end);
+            prev += (zigzag >> 1) ^ (0u - (zigzag & 1));
+            count = push_value(out, max, count, prev);
+        }
+    }
+    else {
+        while (value < end)
+            count = push_value(out, max, count, FeatherTrace::Record::ReadVarint(value, end));
+    }
+    return count;
+}
+
+/* See FeatherTraceHost.h */
+size_t ft_dump_string(const ft_dump* dump, size_t index, uint8_t tag, char* out, size_t max) {
+    const uint8_t* value;
+    size_t len;
+    find_field(dump, index, tag, value, len);
+    if (max > 0) {
+        const size_t count = std::min(len, max - 1);
+        if (count > 0)
+            memcpy(out, value, count);
+        out[count] = '\0';
+    }
+    return len;
+}
+
+/* See FeatherTraceHost.h */
+ft_symbols* ft_symbols_open(const char* path) {
+    return ft_symbols_open_cached(path, nullptr);
+}
+
+/* See FeatherTraceHost.h */
+ft_symbols* ft_symbols_open_cached(const char* path, const char* cache_dir) {
+    // only the build ID or hash is needed to find a cached index, so only read the section headers
+    ElfFile elf;
+    std::string error;
+    if (!elf.Load(path, error, false)) {
+        set_error(error);
+        return nullptr;
+    }
+    ft_symbols* const symbols = new ft_symbols();
+    const std::vector<uint8_t> key = SymbolIndex::Key(elf);
+    const std::string cache_path = cache_dir != nullptr && cache_dir[0] != '\0'
+        ? std::string(cache_dir) + "/" + SymbolIndex::CacheName(key) : std::string();
+    if (!cache_path.empty() && symbols->index.Load(cache_path, key)) {
+        symbols->from_cache = true;
+        return symbols;
+    }
+    elf.LoadTables();
+    symbols->index.Build(elf, key);
+    // the cache is only an optimization, so the symbols are still usable if it can't be written
+    if (!cache_path.empty() && !symbols->index.Save(cache_path, error))
+        set_error(error);
+    return symbols;
+}
+
+/* See FeatherTraceHost.h */
+int ft_symbols_from_cache(const ft_symbols* symbols) {
+    return symbols != nullptr && symbols->from_cache ? 1 : 0;
+}
+
+/* See FeatherTraceHost.h */
+void ft_symbols_close(ft_symbols* symbols) {
+    delete symbols;
+}
+
+/* See FeatherTraceHost.h */
+int ft_symbols_lookup(const ft_symbols* symbols, uint32_t addr, ft_location* out) {
+    *out = ft_location();
+    SymbolIndex::Location location;
+    if (symbols == nullptr || !symbols->index.Lookup(addr, &location))
+        return 0;
+    set_location(location, out);
+    return 1;
+}
+
+/* See FeatherTraceHost.h */
+int ft_symbols_find_site(const ft_symbols* symbols, uint32_t site, ft_location* out) {
+    *out = ft_location();
+    SymbolIndex::Location location;
+    if (symbols == nullptr || !symbols->index.FindSite(site, &location))
+        return 0;
+    set_location(location, out);
+    return 1;
+}
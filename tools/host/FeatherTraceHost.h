@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * libfeathertrace-host: decode FeatherTrace flash dumps and symbolize addresses
+ * on a computer, through a C interface so it can be loaded from other languages
+ * (tools/recover_trace/feathertrace_host.py uses it with ctypes).
+ *
+ * Records are read with the same code as the device (FeatherTraceRecord.h),
+ * directly from a memory mapping of the dump without copying it. Fields are
+ * read as they are found, so the library is not limited by the
+ * FeatherTraceConfig.h it was built with. Addresses are named with an index
+ * of the symbol table and DWARF line table of the ELF file (see SymbolIndex.h),
+ * which can be cached so it is only built once for each ELF file.
+ *
+ * Functions returning a pointer return NULL on failure, and functions returning
+ * int return 0 on failure. ft_last_error describes the last failure.
+ */
+
+#if defined(_WIN32)
+#define FT_HOST_API __declspec(dllexport)
+#else
+#define FT_HOST_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Version of this interface, incremented when a function or structure changes */
+#define FT_HOST_API_VERSION 2
+
+/** The fault records found in a flash dump */
+typedef struct ft_dump ft_dump;
+/** Symbols and line table from an ELF file */
+typedef struct ft_symbols ft_symbols;
+
+/** A fault record in a dump */
+typedef struct {
+    /** See RecordHeader::failnum */
+    uint32_t failnum;
+    /** Offset of the record from the start of the dump */
+    uint32_t offset;
+    /** Number of bytes of fields following the header */
+    uint32_t length;
+} ft_record;
+
+/** What is known about an address, strings are owned by the ft_symbols */
+typedef struct {
+    /** Name of the function containing the address (demangled if possible), or NULL */
+    const char* function;
+    /** Offset of the address from the start of the function */
+    uint32_t function_offset;
+    /** Directory of the source file, or NULL if there is no line information */
+    const char* dir;
+    /** Name of the source file, or NULL if there is no line information */
+    const char* file;
+    /** Line number, or 0 if there is no line information */
+    uint32_t line;
+} ft_location;
+
+/** Get FT_HOST_API_VERSION of the loaded library */
+FT_HOST_API uint32_t ft_host_version(void);
+
+/** Description of the last failure on this thread, or an empty string */
+FT_HOST_API const char* ft_last_error(void);
+
+/**
+ * Map a flash dump into memory, and find every valid record in it.
+ * @param path Path to the dump, such as the one downloaded by `recover_trace recover`.
+ * @return The records, to be freed with ft_dump_close.
+ */
+FT_HOST_API ft_dump* ft_dump_open(const char* path);
+
+/**
+ * Find every valid record in a flash dump already in memory.
+ * @param data The dump, which must stay valid until ft_dump_close.
+ * @param len Number of bytes in data.
+ */
+FT_HOST_API ft_dump* ft_dump_open_memory(const uint8_t* data, size_t len);
+
+FT_HOST_API void ft_dump_close(ft_dump* dump);
+
+/** Number of records in the dump */
+FT_HOST_API size_t ft_dump_count(const ft_dump* dump);
+
+/**
+ * Get a record, records are sorted newest (highest failnum) first.
+ * @param index Index of the record, less than ft_dump_count.
+ */
+FT_HOST_API int ft_dump_record(const ft_dump* dump, size_t index, ft_record* out);
+
+/** Check if a record has a field, tag is a RecordTag from FeatherTraceRecord.h */
+FT_HOST_API int ft_dump_has_field(const ft_dump* dump, size_t index, uint8_t tag);
+
+/**
+ * Read a field of numbers. Most fields are a list of varints, except:
+ *  - TAG_STACKTRACE_DELTAS is read as the frames it encodes.
+ *  - TAG_STACK_WINDOW is read as the address of the window, then each word.
+ * @param out[out] Buffer for up to max values, may be NULL if max is 0.
+ * @return The number of values in the field, which may be more than max.
+ */
+FT_HOST_API size_t ft_dump_values(const ft_dump* dump, size_t index, uint8_t tag, uint32_t* out, size_t max);
+
+/**
+ * Read a field of characters (TAG_FILE, TAG_STARVED_CHANNEL) as a null terminated string.
+ * @param out[out] Buffer of max bytes, may be NULL if max is 0.
+ * @return The length of the field, which may be more than max - 1.
+ */
+FT_HOST_API size_t ft_dump_string(const ft_dump* dump, size_t index, uint8_t tag, char* out, size_t max);
+
+/**
+ * Read the symbols and line table of an ELF file.
+ * @param path Path to the ELF file of the firmware running on the device.
+ * @return The symbols, to be freed with ft_symbols_close.
+ */
+FT_HOST_API ft_symbols* ft_symbols_open(const char* path);
+
+/**
+ * The same as ft_symbols_open, using an index cached in cache_dir if there is
+ * one for this ELF file (found by its build ID, or a hash of the file), and
+ * saving the index there if not. ft_last_error is set if the index could not
+ * be saved, but the symbols are still returned.
+ * @param cache_dir Existing directory to keep indexes in, or NULL to not use a cache.
+ */
+FT_HOST_API ft_symbols* ft_symbols_open_cached(const char* path, const char* cache_dir);
+
+/** Returns 1 if the symbols were loaded from the cache by ft_symbols_open_cached */
+FT_HOST_API int ft_symbols_from_cache(const ft_symbols* symbols);
+
+FT_HOST_API void ft_symbols_close(ft_symbols* symbols);
+
+/**
+ * Find the function, file, and line of an address.
+ * @return 0 if nothing is known about the address.
+ */
+FT_HOST_API int ft_symbols_lookup(const ft_symbols* symbols, uint32_t addr, ft_location* out);
+
+/**
+ * Find the file and line of a MARK site ID (see FEATHERTRACE_SITE_IDS), by
+ * hashing every file and line in the line table the same way as ShortFile.h.
+ * @return 0 if no line of the line table has this ID.
+ */
+FT_HOST_API int ft_symbols_find_site(const ft_symbols* symbols, uint32_t site, ft_location* out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,61 @@
+#include "MappedFile.h"
+
+#include <cstdio>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+/* See MappedFile.h */
+bool MappedFile::Open(const std::string& path, std::string& error) {
+    Close();
+#if !defined(_WIN32)
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* const map = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                m_data = static_cast<const uint8_t*>(map);
+                m_size = m_mapped_size = static_cast<size_t>(info.st_size);
+            }
+        }
+        close(fd);
+    }
+    if (m_mapped_size > 0)
+        return true;
+#endif
+    // the file couldn't be mapped (or is empty), so read it instead
+    FILE* const file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        error = "could not open " + path;
+        return false;
+    }
+    uint8_t buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0)
+        m_buffer.insert(m_buffer.end(), buf, buf + len);
+    fclose(file);
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+    return true;
+}
+
+/* See MappedFile.h */
+void MappedFile::Close() {
+#if !defined(_WIN32)
+    if (m_mapped_size > 0)
+        munmap(const_cast<uint8_t*>(m_data), m_mapped_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped_size = 0;
+    m_buffer.clear();
+}
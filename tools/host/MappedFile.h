@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/**
+ * A read-only file in memory, mapped where possible so it is not copied,
+ * and read into a buffer otherwise (ex. on Windows, or for empty files).
+ * The data is at least word aligned.
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * Map a file, replacing any file already open.
+     * @param error[out] Set to a description of the problem on failure.
+     * @return false if the file could not be read.
+     */
+    bool Open(const std::string& path, std::string& error);
+
+    /** Unmap the file */
+    void Close();
+
+    const uint8_t* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+
+private:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    /** Non-zero if m_data is a mapping */
+    size_t m_mapped_size = 0;
+    /** Contents of the file if it could not be mapped */
+    std::vector<uint8_t> m_buffer;
+};
@@ -0,0 +1,339 @@
+#include "SymbolIndex.h"
+#include "ShortFile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+#if defined(__GNUC__)
+#include <cxxabi.h>
+#endif
+
+#if defined(_WIN32)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+/** Value of Header::magic, "FTSI" */
+static constexpr uint32_t INDEX_MAGIC = 0x49535446;
+/** Value of Header::version, increment if the layout of the index changes */
+static constexpr uint32_t INDEX_VERSION = 1;
+/** Longest key stored in the index, build IDs are usually 20 bytes */
+static constexpr size_t MAX_KEY = 32;
+/** Index of a missing function, file, or string */
+static constexpr uint32_t NONE = 0xFFFFFFFF;
+/** First byte of a key from a build ID or from a hash of the ELF file, see SymbolIndex::Key */
+static constexpr uint8_t KEY_BUILD_ID = 'B';
+static constexpr uint8_t KEY_HASH = 'H';
+
+struct SymbolIndex::Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t key_len;
+    uint8_t key[MAX_KEY];
+    uint32_t range_count;
+    uint32_t function_count;
+    uint32_t file_count;
+    uint32_t site_count;
+    /** Number of bytes of null terminated strings at the end of the index */
+    uint32_t strings_size;
+};
+
+/** Addresses from addr until the next range, NONE if nothing is known */
+struct SymbolIndex::Range {
+    uint32_t addr;
+    uint32_t function;
+    uint32_t file;
+    uint32_t line;
+};
+
+struct SymbolIndex::Function {
+    uint32_t addr;
+    /** Offset of the demangled name in the strings */
+    uint32_t name;
+};
+
+struct SymbolIndex::File {
+    uint32_t dir;
+    uint32_t name;
+};
+
+/** The first line of the line table with a MARK site ID, sorted by site */
+struct SymbolIndex::Site {
+    uint32_t site;
+    uint32_t file;
+    uint32_t line;
+};
+
+/** Get the demangled name of a function, or the name itself if it isn't mangled */
+static std::string demangle(const std::string& name) {
+#if defined(__GNUC__)
+    int status = 0;
+    char* const result = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+    if (status == 0 && result != nullptr) {
+        std::string ret(result);
+        free(result);
+        return ret;
+    }
+    free(result);
+#endif
+    return name;
+}
+
+/** Append a table to the index being built */
+template<typename T>
+static void append(std::vector<uint8_t>& out, const std::vector<T>& table) {
+    const uint8_t* const data = reinterpret_cast<const uint8_t*>(table.data());
+    out.insert(out.end(), data, data + table.size() * sizeof(T));
+}
+
+/* See SymbolIndex.h */
+std::vector<uint8_t> SymbolIndex::Key(const ElfFile& elf) {
+    std::vector<uint8_t> key;
+    std::vector<uint8_t> id = elf.BuildId();
+    if (!id.empty()) {
+        key.push_back(KEY_BUILD_ID);
+        id.resize(std::min(id.size(), MAX_KEY - 1));
+        key.insert(key.end(), id.begin(), id.end());
+    }
+    else {
+        key.push_back(KEY_HASH);
+        const uint64_t hash = elf.ContentHash();
+        for (size_t i = 0; i < 8; i++)
+            key.push_back(static_cast<uint8_t>(hash >> (8 * i)));
+    }
+    return key;
+}
+
+/* See SymbolIndex.h */
+std::string SymbolIndex::CacheName(const std::vector<uint8_t>& key) {
+    std::string name = !key.empty() && key[0] == KEY_BUILD_ID ? "id-" : "hash-";
+    for (size_t i = 1; i < key.size(); i++) {
+        char hex[3];
+        snprintf(hex, sizeof(hex), "%02x", key[i]);
+        name += hex;
+    }
+    return name + ".ftsi";
+}
+
+/* See SymbolIndex.h */
+void SymbolIndex::Build(const ElfFile& elf, const std::vector<uint8_t>& key) {
+    static_assert(sizeof(Header) == 64, "Index header must not be padded");
+    std::vector<Range> ranges;
+    std::vector<Function> functions;
+    std::vector<File> files;
+    std::vector<Site> sites;
+    std::string strings;
+    std::unordered_map<std::string, uint32_t> string_offsets;
+    auto intern = [&](const std::string& str) {
+        const auto it = string_offsets.find(str);
+        if (it != string_offsets.end())
+            return it->second;
+        const uint32_t offset = static_cast<uint32_t>(strings.size());
+        strings.append(str.c_str(), str.size() + 1);
+        string_offsets.emplace(str, offset);
+        return offset;
+    };
+    // functions and files are only added to the index if an address uses them
+    std::map<std::pair<uint32_t, const std::string*>, uint32_t> function_index;
+    std::vector<uint32_t> file_index;
+    auto add_file = [&](uint32_t file) {
+        if (file >= file_index.size())
+            file_index.resize(file + 1, NONE);
+        if (file_index[file] == NONE) {
+            const ElfFile::SourceFile& source = elf.File(file);
+            file_index[file] = static_cast<uint32_t>(files.size());
+            files.push_back({ intern(source.dir), intern(source.name) });
+        }
+        return file_index[file];
+    };
+    // the function and line only change at the start and end of a function, or at a row of the line table
+    std::vector<uint32_t> bounds;
+    for (const ElfFile::Symbol& symbol : elf.Functions()) {
+        bounds.push_back(symbol.addr);
+        if (symbol.size != 0)
+            bounds.push_back(symbol.addr + symbol.size);
+    }
+    for (const ElfFile::LineRow& row : elf.LineTable())
+        bounds.push_back(row.addr);
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+    for (const uint32_t addr : bounds) {
+        Range range = { addr, NONE, NONE, 0 };
+        uint32_t offset;
+        const std::string* const name = elf.FindFunction(addr, &offset);
+        if (name != nullptr) {
+            const auto id = std::make_pair(addr - offset, name);
+            auto it = function_index.find(id);
+            if (it == function_index.end()) {
+                it = function_index.emplace(id, static_cast<uint32_t>(functions.size())).first;
+                functions.push_back({ addr - offset, intern(demangle(*name)) });
+            }
+            range.function = it->second;
+        }
+        ElfFile::LineRow row;
+        if (elf.FindLine(addr, &row)) {
+            range.file = add_file(row.file);
+            range.line = row.line;
+        }
+        // merge ranges that are the same
+        if (!ranges.empty() && ranges.back().function == range.function
+            && ranges.back().file == range.file && ranges.back().line == range.line)
+            continue;
+        ranges.push_back(range);
+    }
+    // keep the first row of the line table with each site ID
+    std::unordered_map<uint32_t, size_t> site_rows;
+    const std::vector<ElfFile::LineRow>& lines = elf.LineTable();
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (!lines[i].end)
+            site_rows.emplace(_ShortFilePrivate::site_id(elf.File(lines[i].file).name.c_str(), lines[i].line), i);
+    }
+    for (const auto& entry : site_rows)
+        sites.push_back({ entry.first, add_file(lines[entry.second].file), lines[entry.second].line });
+    std::sort(sites.begin(), sites.end(), [](const Site& a, const Site& b) { return a.site < b.site; });
+    // pad the strings so the next index starts word aligned
+    strings.resize((strings.size() + 3) / 4 * 4, '\0');
+
+    Header header = {};
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.key_len = static_cast<uint32_t>(std::min(key.size(), MAX_KEY));
+    memcpy(header.key, key.data(), header.key_len);
+    header.range_count = static_cast<uint32_t>(ranges.size());
+    header.function_count = static_cast<uint32_t>(functions.size());
+    header.file_count = static_cast<uint32_t>(files.size());
+    header.site_count = static_cast<uint32_t>(sites.size());
+    header.strings_size = static_cast<uint32_t>(strings.size());
+    m_file.Close();
+    m_built.clear();
+    const uint8_t* const header_data = reinterpret_cast<const uint8_t*>(&header);
+    m_built.insert(m_built.end(), header_data, header_data + sizeof(header));
+    append(m_built, ranges);
+    append(m_built, functions);
+    append(m_built, files);
+    append(m_built, sites);
+    m_built.insert(m_built.end(), strings.begin(), strings.end());
+    attach(m_built.data(), m_built.size());
+}
+
+/* See SymbolIndex.h */
+bool SymbolIndex::Load(const std::string& path, const std::vector<uint8_t>& key) {
+    std::string error;
+    if (!m_file.Open(path, error))
+        return false;
+    if (!attach(m_file.Data(), m_file.Size())
+        || m_header->key_len != key.size() || memcmp(m_header->key, key.data(), key.size()) != 0) {
+        m_file.Close();
+        m_header = nullptr;
+        return false;
+    }
+    m_built.clear();
+    return true;
+}
+
+/* See SymbolIndex.h */
+bool SymbolIndex::Save(const std::string& path, std::string& error) const {
+    if (m_header == nullptr) {
+        error = "no index to save";
+        return false;
+    }
+    const std::string temp = path + ".tmp" + std::to_string(getpid());
+    FILE* const file = fopen(temp.c_str(), "wb");
+    if (file == nullptr) {
+        error = "could not create " + temp;
+        return false;
+    }
+    const bool written = fwrite(m_data, 1, m_size, file) == m_size;
+    if (fclose(file) != 0 || !written) {
+        remove(temp.c_str());
+        error = "could not write " + temp;
+        return false;
+    }
+    if (rename(temp.c_str(), path.c_str()) != 0) {
+        remove(temp.c_str());
+        error = "could not rename " + temp + " to " + path;
+        return false;
+    }
+    return true;
+}
+
+/* See SymbolIndex.h */
+bool SymbolIndex::Lookup(uint32_t addr, Location* out) const {
+    *out = Location();
+    if (m_header == nullptr)
+        return false;
+    // find the last range starting at or before addr
+    const Range* const end = m_ranges + m_header->range_count;
+    const Range* range = std::upper_bound(m_ranges, end, addr,
+        [](uint32_t value, const Range& r) { return value < r.addr; });
+    if (range == m_ranges)
+        return false;
+    --range;
+    if (range->function < m_header->function_count) {
+        const Function& function = m_functions[range->function];
+        out->function = string(function.name);
+        out->function_offset = addr - function.addr;
+    }
+    set_file(range->file, range->line, out);
+    return out->function != nullptr || out->file != nullptr;
+}
+
+/* See SymbolIndex.h */
+bool SymbolIndex::FindSite(uint32_t site, Location* out) const {
+    *out = Location();
+    if (m_header == nullptr)
+        return false;
+    const Site* const end = m_sites + m_header->site_count;
+    const Site* const it = std::lower_bound(m_sites, end, site,
+        [](const Site& s, uint32_t value) { return s.site < value; });
+    if (it == end || it->site != site)
+        return false;
+    set_file(it->file, it->line, out);
+    return out->file != nullptr;
+}
+
+bool SymbolIndex::attach(const uint8_t* data, size_t size) {
+    m_header = nullptr;
+    if (size < sizeof(Header))
+        return false;
+    const Header* const header = reinterpret_cast<const Header*>(data);
+    if (header->magic != INDEX_MAGIC || header->version != INDEX_VERSION || header->key_len > MAX_KEY)
+        return false;
+    const uint64_t expected = sizeof(Header)
+        + static_cast<uint64_t>(header->range_count) * sizeof(Range)
+        + static_cast<uint64_t>(header->function_count) * sizeof(Function)
+        + static_cast<uint64_t>(header->file_count) * sizeof(File)
+        + static_cast<uint64_t>(header->site_count) * sizeof(Site)
+        + header->strings_size;
+    // the strings must end with a null terminator, so string() can't run off the end
+    if (expected != size || (header->strings_size > 0 && data[size - 1] != '\0'))
+        return false;
+    m_data = data;
+    m_size = size;
+    m_header = header;
+    m_ranges = reinterpret_cast<const Range*>(data + sizeof(Header));
+    m_functions = reinterpret_cast<const Function*>(m_ranges + header->range_count);
+    m_files = reinterpret_cast<const File*>(m_functions + header->function_count);
+    m_sites = reinterpret_cast<const Site*>(m_files + header->file_count);
+    m_strings = reinterpret_cast<const char*>(m_sites + header->site_count);
+    return true;
+}
+
+const char* SymbolIndex::string(uint32_t offset) const {
+    return offset < m_header->strings_size ? m_strings + offset : nullptr;
+}
+
+void SymbolIndex::set_file(uint32_t file, uint32_t line, Location* out) const {
+    if (file >= m_header->file_count)
+        return;
+    out->dir = string(m_files[file].dir);
+    out->file = string(m_files[file].name);
+    out->line = line;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "ElfFile.h"
+#include "MappedFile.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/**
+ * An index of everything needed to name addresses in an ELF file: sorted
+ * address ranges, each with its function and source line, and the MARK site
+ * ID of every source line. The index is built from an ElfFile once, and can
+ * be saved to a cache file and mapped back into memory, so later lookups are
+ * a binary search without reading the ELF file's symbols or DWARF again.
+ *
+ * The cache file is the in-memory layout (little endian, word aligned): an
+ * IndexHeader, then the ranges, functions, files, and sites, then the strings.
+ * Cache files are named after the key of the ELF file (see Key), and checked
+ * against it when loaded.
+ */
+class SymbolIndex {
+public:
+    /** What is known about an address, strings are owned by the SymbolIndex */
+    struct Location {
+        /** Name of the function (demangled), or nullptr */
+        const char* function;
+        uint32_t function_offset;
+        /** Directory and name of the source file, or nullptr */
+        const char* dir;
+        const char* file;
+        /** Line number, or 0 */
+        uint32_t line;
+    };
+
+    SymbolIndex() = default;
+    SymbolIndex(const SymbolIndex&) = delete;
+    SymbolIndex& operator=(const SymbolIndex&) = delete;
+
+    /**
+     * Get the key identifying an ELF file: its build ID if it has one (see
+     * ElfFile::BuildId), otherwise a hash of the tables the index is built
+     * from (see ElfFile::ContentHash).
+     */
+    static std::vector<uint8_t> Key(const ElfFile& elf);
+
+    /** Name of the cache file for a key, ex. "id-<hex>.ftsi" */
+    static std::string CacheName(const std::vector<uint8_t>& key);
+
+    /**
+     * Build the index of an ELF file loaded with its line table.
+     * @param key Key of the ELF file, from Key.
+     */
+    void Build(const ElfFile& elf, const std::vector<uint8_t>& key);
+
+    /**
+     * Map an index saved by Save.
+     * @param key Key of the ELF file the index must be for.
+     * @return false if the file is missing, invalid, or for another ELF file.
+     */
+    bool Load(const std::string& path, const std::vector<uint8_t>& key);
+
+    /**
+     * Save the index so it can be loaded with Load. The file is written next to
+     * path then renamed, so other processes never see a partial index.
+     * @param error[out] Set to a description of the problem on failure.
+     */
+    bool Save(const std::string& path, std::string& error) const;
+
+    /** Find the function and source line of addr, returns false if nothing is known about it */
+    bool Lookup(uint32_t addr, Location* out) const;
+
+    /** Find the source line with a MARK site ID, returns false if no line has this ID */
+    bool FindSite(uint32_t site, Location* out) const;
+
+private:
+    struct Header;
+    struct Range;
+    struct Function;
+    struct File;
+    struct Site;
+
+    /** Point the tables at data, returns false if it isn't a valid index */
+    bool attach(const uint8_t* data, size_t size);
+    const char* string(uint32_t offset) const;
+    void set_file(uint32_t file, uint32_t line, Location* out) const;
+
+    /** Index built by Build */
+    std::vector<uint8_t> m_built;
+    /** Index loaded by Load */
+    MappedFile m_file;
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    const Header* m_header = nullptr;
+    const Range* m_ranges = nullptr;
+    const Function* m_functions = nullptr;
+    const File* m_files = nullptr;
+    const Site* m_sites = nullptr;
+    const char* m_strings = nullptr;
+};
@@ -0,0 +1,130 @@
+/**
+ * ft_bench: time FeatherTrace::Fault and MARK on a computer, using the emulated
+ * hardware in FeatherTraceHAL_Linux.cpp and the stage timing from FEATHERTRACE_BENCHMARK.
+ *
+ * Usage: ft_bench [faults] [marks]
+ *
+ * Every stage of FeatherTrace::Fault is timed over many faults, both called
+ * directly and from an emulated hard fault, and the minimum, median, and
+ * maximum of each stage is printed in nanoseconds. The flash log wraps around
+ * many times, so rows are erased in some of the faults. The emulated flash is
+ * far faster than the SAMD21's, so compare runs on the same computer to catch
+ * regressions, and use examples/FaultBenchmark to time the device.
+ */
+
+#include "FeatherTrace.h"
+#include "FeatherTraceHAL.h"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if !FEATHERTRACE_BENCHMARK
+#error ft_bench must be built with FEATHERTRACE_BENCHMARK=1
+#endif
+
+/** Number of faults to time for each kind of fault, if not given */
+static constexpr size_t DEFAULT_FAULTS = 2000;
+/** Number of MARKs to time, if not given */
+static constexpr size_t DEFAULT_MARKS = 1000000;
+
+static const char* const STAGE_NAMES[FeatherTrace::STAGE_COUNT] = {
+    "stop_wdt", "capture", "build", "encode", "find", "erase", "write", "callback"
+};
+
+/** Where the emulated reset jumps to, back out of FeatherTrace::Fault */
+static jmp_buf reset_jump;
+/** Prevents the timed loops from being optimized away */
+static volatile uint32_t sink = 0;
+
+static void on_reset() {
+    longjmp(reset_jump, 1);
+}
+
+/** Call FeatherTrace::Fault, returning after the emulated reset */
+static void fault_and_reset() {
+    if (setjmp(reset_jump) == 0)
+        FeatherTrace::Fault(FeatherTrace::FAULT_USER);
+}
+
+/** Print the minimum, median, and maximum of samples in nanoseconds */
+static void print_row(const char* name, std::vector<uint32_t>& samples) {
+    std::sort(samples.begin(), samples.end());
+    printf("  %-10s %10lu %10lu %10lu\n", name,
+        static_cast<unsigned long>(samples.front()),
+        static_cast<unsigned long>(samples[samples.size() / 2]),
+        static_cast<unsigned long>(samples.back()));
+}
+
+/**
+ * Time count faults with the watchdog running.
+ * @param name Name of this kind of fault, to print.
+ * @param interrupt Exception to emulate, see HAL::SCBFaultType.
+ * @param count Number of faults to time.
+ * @return false if a fault wasn't timed.
+ */
+static bool time_faults(const char* name, const uint32_t interrupt, const size_t count) {
+    std::vector<uint32_t> stages[FeatherTrace::STAGE_COUNT];
+    std::vector<uint32_t> totals;
+    for (size_t i = 0; i < count; i++) {
+        FeatherTrace::StartWDT(FeatherTrace::WDTTimeout::WDT_8S);
+        MARK;
+        FeatherTrace::HAL::Emulator::SetActiveInterrupt(interrupt);
+        fault_and_reset();
+        FeatherTrace::HAL::Emulator::SetActiveInterrupt(FeatherTrace::HAL::SCB_NONE);
+        FeatherTrace::FaultTiming timing;
+        if (!FeatherTrace::GetFaultTiming(timing))
+            return false;
+        for (size_t s = 0; s < FeatherTrace::STAGE_COUNT; s++)
+            stages[s].push_back(timing.cycles[s]);
+        totals.push_back(timing.total);
+    }
+    printf("%s, %lu faults (ns)\n", name, static_cast<unsigned long>(count));
+    printf("  %-10s %10s %10s %10s\n", "stage", "min", "median", "max");
+    for (size_t s = 0; s < FeatherTrace::STAGE_COUNT; s++)
+        print_row(STAGE_NAMES[s], stages[s]);
+    print_row("total", totals);
+    return true;
+}
+
+/** Run fn count times and return the average time per call in nanoseconds */
+template<typename F>
+static double time_ns(F fn, const size_t count) {
+    const uint32_t start = FeatherTrace::GetCycles();
+    for (size_t i = 0; i < count; i++)
+        fn();
+    const uint32_t end = FeatherTrace::GetCycles();
+    return static_cast<double>(end - start) / count;
+}
+
+int main(int argc, char** argv) {
+    const size_t faults = argc > 1 ? strtoul(argv[1], nullptr, 0) : DEFAULT_FAULTS;
+    const size_t marks = argc > 2 ? strtoul(argv[2], nullptr, 0) : DEFAULT_MARKS;
+    if (faults == 0 || marks == 0) {
+        fprintf(stderr, "Usage: %s [faults] [marks]\n", argv[0]);
+        return 2;
+    }
+    FeatherTrace::HAL::Emulator::EraseFlashLog();
+    FeatherTrace::HAL::Emulator::SetResetHandler(&on_reset);
+
+    if (!time_faults("FeatherTrace::Fault", FeatherTrace::HAL::SCB_NONE, faults)
+        || !time_faults("Hard fault", FeatherTrace::HAL::SCB_HARDFAULT, faults)) {
+        fprintf(stderr, "A fault was not timed\n");
+        return 1;
+    }
+    printf("Flash log: %lu bytes, %lu faults\n",
+        static_cast<unsigned long>(FLASH_LOG_SIZE), static_cast<unsigned long>(FeatherTrace::GetFaultCount()));
+
+    const double loop_ns = time_ns([]() { sink = sink + 1; }, marks);
+    const double mark_ns = time_ns([]() { sink = sink + 1; MARK; }, marks);
+    printf("MARK, %lu calls (ns)\n", static_cast<unsigned long>(marks));
+    printf("  %-10s %10.1f\n", "loop", loop_ns);
+    printf("  %-10s %10.1f\n", "mark", mark_ns - loop_ns);
+#if FEATHERTRACE_LOG_ENTRIES > 0
+    const double log_ns = time_ns([]() { sink = sink + 1; FT_LOG("bench %u", sink); }, marks);
+    printf("  %-10s %10.1f\n", "ft_log", log_ns - loop_ns);
+#endif
+    return 0;
+}
@@ -0,0 +1,167 @@
+/**
+ * ft_unwind: unwind the stack windows saved by FEATHERTRACE_STACK_WINDOW on a computer.
+ *
+ * Usage: ft_unwind <firmware.elf> <flash.bin>
+ *
+ * flash.bin is a dump of the device flash, such as the one downloaded by
+ * `recover_trace recover`. Every fault record with a stack window is unwound
+ * with the same unwinder FeatherTrace uses on the device (FeatherTraceUnwind.h),
+ * reading the stack from the record and everything else from the ELF file.
+ */
+
+#include "DumpScanner.h"
+#include "ElfFile.h"
+#include "FeatherTraceRecord.h"
+#include "FeatherTraceUnwind.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace FeatherTrace::Unwind;
+
+/** Maximum number of frames to unwind, much deeper than MAX_STRACE */
+static constexpr size_t MAX_FRAMES = 256;
+/** Unwinder budget, there is no reason to be stingy on a computer */
+static constexpr uint32_t MAX_INSTRUCTIONS = 1000000;
+
+static const char* const RESULT_STRINGS[] = {
+    "end of stack",
+    "too many frames",
+    "no unwind table entry",
+    "invalid unwind instruction",
+    "read outside of the stack window and ELF file",
+    "ran out of budget",
+    "stack did not change"
+};
+
+/** Registers and stack window from a single fault record */
+struct StackImage {
+    uint32_t failnum;
+    uint32_t regs[16];
+    uint32_t window_addr;
+    std::vector<uint32_t> window;
+};
+
+/** Memory of the device at the time of the fault, for FeatherTrace::Unwind::ReadFn */
+struct DeviceMemory {
+    const ElfFile& elf;
+    const StackImage& image;
+};
+
+static uint32_t read_u32(const std::vector<uint8_t>& data, size_t offset) {
+    return static_cast<uint32_t>(data[offset]) | (static_cast<uint32_t>(data[offset + 1]) << 8)
+        | (static_cast<uint32_t>(data[offset + 2]) << 16) | (static_cast<uint32_t>(data[offset + 3]) << 24);
+}
+
+/**
+ * Find every fault record in a flash dump with a stack window. The fields are read
+ * directly instead of with FeatherTrace::Record::DecodeRecord, so the stack window
+ * isn't limited by the FEATHERTRACE_STACK_WINDOW ft_unwind was built with.
+ */
+static std::vector<StackImage> find_stack_images(const std::vector<uint8_t>& data) {
+    // newest first, the same as recover_trace
+    std::vector<StackImage> images;
+    for (const DumpScanner::DumpRecord& record : DumpScanner::FindRecords(data.data(), data.size())) {
+        StackImage image = {};
+        image.failnum = record.failnum;
+        bool has_window = false;
+        const uint8_t* pos = &data[record.offset + sizeof(RecordHeader)];
+        const uint8_t* const end = pos + record.length;
+        uint8_t tag;
+        const uint8_t* value;
+        size_t len;
+        while (FeatherTrace::Record::NextField(pos, end, tag, value, len)) {
+            const uint8_t* const value_end = value + len;
+            if (tag == TAG_REGS) {
+                for (size_t r = 0; r < 16; r++)
+                    image.regs[r] = FeatherTrace::Record::ReadVarint(value, value_end);
+            }
+            else if (tag == TAG_STACK_WINDOW) {
+                has_window = true;
+                image.window_addr = FeatherTrace::Record::ReadVarint(value, value_end);
+                for (; value + 4 <= value_end; value += 4)
+                    image.window.push_back(read_u32(data, static_cast<size_t>(value - data.data())));
+            }
+        }
+        if (has_window)
+            images.push_back(image);
+    }
+    return images;
+}
+
+/** FeatherTrace::Unwind::ReadFn for DeviceMemory, reading the stack window first then the ELF file */
+static bool read_device_memory(void* ctx, uint32_t addr, uint32_t* out) {
+    const DeviceMemory& memory = *static_cast<const DeviceMemory*>(ctx);
+    const uint32_t offset = addr - memory.image.window_addr;
+    if (addr >= memory.image.window_addr && offset / 4 < memory.image.window.size()) {
+        *out = memory.image.window[offset / 4];
+        return true;
+    }
+    return memory.elf.ReadWord(addr, out);
+}
+
+static bool read_file(const char* path, std::vector<uint8_t>& data) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr)
+        return false;
+    uint8_t buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0)
+        data.insert(data.end(), buf, buf + len);
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <firmware.elf> <flash.bin>\n", argv[0]);
+        return 2;
+    }
+    ElfFile elf;
+    std::string error;
+    if (!elf.Load(argv[1], error)) {
+        fprintf(stderr, "Error: %s\n", error.c_str());
+        return 1;
+    }
+    uint32_t exidx_addr;
+    uint32_t exidx_size;
+    if (!elf.FindSection(".ARM.exidx", &exidx_addr, &exidx_size)) {
+        fprintf(stderr, "Error: %s has no .ARM.exidx section, was it built with -fasynchronous-unwind-tables?\n", argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> dump;
+    if (!read_file(argv[2], dump)) {
+        fprintf(stderr, "Error: could not open %s\n", argv[2]);
+        return 1;
+    }
+    const std::vector<StackImage> images = find_stack_images(dump);
+    if (images.empty()) {
+        printf("No fault records with a stack window found, was FeatherTrace built with FEATHERTRACE_STACK_WINDOW?\n");
+        return 0;
+    }
+    for (const StackImage& image : images) {
+        printf("Fault #%u (SP 0x%08x, %u bytes of stack):\n", static_cast<unsigned>(image.failnum),
+            static_cast<unsigned>(image.window_addr), static_cast<unsigned>(image.window.size() * 4));
+        if (image.window.empty()) {
+            printf("\tNo stack was saved\n");
+            continue;
+        }
+        DeviceMemory memory = { elf, image };
+        const UnwindConfig config = {
+            &read_device_memory,
+            &memory,
+            exidx_addr,
+            exidx_addr + exidx_size,
+            elf.FindSymbol("main"),
+            MAX_INSTRUCTIONS
+        };
+        uint32_t frames[MAX_FRAMES];
+        Result result;
+        const size_t len = Backtrace(config, image.regs, frames, MAX_FRAMES, &result);
+        for (size_t i = 0; i < len; i++)
+            printf("\t#%-3u 0x%08x %s\n", static_cast<unsigned>(i), static_cast<unsigned>(frames[i]), elf.Symbolize(frames[i]).c_str());
+        printf("\tStopped: %s\n", RESULT_STRINGS[result]);
+    }
+    return 0;
+}
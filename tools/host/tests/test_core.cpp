@@ -0,0 +1,410 @@
+/**
+ * test_core: check the portable FeatherTrace core on the emulated hardware in
+ * FeatherTraceHAL_Linux.cpp: the flash log, the cause of a fault, MARK, the
+ * printed record, and the watchdog state machine.
+ *
+ * This is built twice, against the core with and without FEATHERTRACE_SITE_IDS
+ * (see tools/host/CMakeLists.txt), so MARK is checked in both forms. The second
+ * build also uses FEATHERTRACE_MEMCHECK_CANARY, whose guard word can't be placed
+ * on the emulator, so it checks the fallback to the heap check, and
+ * FEATHERTRACE_COMMIT_MANUAL.
+ */
+
+#include "FeatherTrace.h"
+#include "FeatherTraceCore.h"
+#include "FeatherTraceHAL.h"
+
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using namespace FeatherTrace;
+
+/** Must match FLASH_ROW_SIZE in FeatherTraceCore.cpp */
+static constexpr size_t FLASH_ROW_SIZE = 256;
+
+static unsigned failures = 0;
+
+#define CHECK(_cond) check((_cond), #_cond, __LINE__)
+
+static void check(const bool ok, const char* what, const int line) {
+    if (ok)
+        return;
+    failures++;
+    printf("FAIL line %d: %s\n", line, what);
+}
+
+/** Where the emulated reset jumps to, back out of FeatherTrace::Fault */
+static jmp_buf reset_jump;
+
+static void on_reset() {
+    longjmp(reset_jump, 1);
+}
+
+/** Call FeatherTrace::Fault from an emulated interrupt, returning true if it reset the device */
+static bool fault_from(const uint32_t interrupt, const FaultCause cause) {
+    HAL::Emulator::SetActiveInterrupt(interrupt);
+    bool reset = true;
+    if (setjmp(reset_jump) == 0) {
+        Fault(cause);
+        reset = false;
+    }
+    HAL::Emulator::SetActiveInterrupt(HAL::SCB_NONE);
+    return reset;
+}
+
+/** Read the newest record in the log, after writing a deferred fault to it */
+static bool newest_fault(FaultDataFlash_t& out) {
+#if FEATHERTRACE_DEFERRED_COMMIT
+    CommitFault();
+#endif
+    return Core::GetRecord(0, out);
+}
+
+/** A record with only the fields the tests compare set */
+static FaultDataFlash_t make_record(const uint32_t cause, const int32_t line, const char* file) {
+    FaultDataFlash_t trace = { {} };
+    trace.data.cause = cause;
+    trace.data.line = line;
+    strncpy(trace.data.file, file, sizeof(trace.data.file) - 1);
+    trace.data.stacktrace[0] = 0x1000 + static_cast<uint32_t>(line);
+    return trace;
+}
+
+/** Check the log holds count records with consecutive failnums ending at newest, each with line == failnum */
+static void check_log(const size_t count, const uint32_t newest) {
+    CHECK(Core::GetRecordCount() == count);
+    for (size_t i = 0; i < count; i++) {
+        FaultDataFlash_t out = { {} };
+        CHECK(Core::GetRecord(i, out));
+        CHECK(out.data.failnum == newest - i);
+        CHECK(out.data.line == static_cast<int32_t>(out.data.failnum));
+        CHECK(out.data.stacktrace[0] == 0x1000 + out.data.failnum);
+        CHECK(strcmp(out.data.file, "log.cpp") == 0);
+    }
+    FaultDataFlash_t out = { {} };
+    CHECK(!Core::GetRecord(count, out));
+}
+
+static void test_flash_log() {
+    HAL::Emulator::EraseFlashLog();
+    FaultDataFlash_t out = { {} };
+    CHECK(Core::GetRecordCount() == 0);
+    CHECK(!Core::GetRecord(0, out));
+
+    // append
+    for (uint32_t n = 1; n <= 3; n++) {
+        FaultDataFlash_t trace = make_record(FAULT_USER, static_cast<int32_t>(n), "log.cpp");
+        Core::CommitRecord(trace);
+        CHECK(trace.data.failnum == n);
+    }
+    check_log(3, 3);
+
+    // a record with a bad CRC is skipped, and numbering continues from the newest valid record
+    const uint32_t zero = 0;
+    HAL::WriteFlash(sizeof(RecordHeader), &zero, 1);
+    CHECK(Core::GetRecordCount() == 2);
+    CHECK(Core::GetRecord(1, out) && out.data.failnum == 2);
+
+    // the same for the newest record, which is the only one a commit checks the CRC of
+    FaultDataFlash_t fourth = make_record(FAULT_USER, 4, "log.cpp");
+    Core::CommitRecord(fourth);
+    CHECK(fourth.data.failnum == 4);
+    size_t newest = 0;
+    while (reinterpret_cast<const RecordHeader*>(HAL::GetFlashLog() + newest)->failnum != 4
+        || reinterpret_cast<const RecordHeader*>(HAL::GetFlashLog() + newest)->head != FEATHERTRACE_HEAD)
+        newest += 4;
+    HAL::WriteFlash(newest + sizeof(RecordHeader), &zero, 1);
+    CHECK(Core::GetRecordCount() == 2);
+    CHECK(Core::GetRecord(0, out) && out.data.failnum == 3);
+    FaultDataFlash_t fifth = make_record(FAULT_USER, 4, "log.cpp");
+    Core::CommitRecord(fifth);
+    CHECK(fifth.data.failnum == 4);
+    CHECK(Core::GetRecordCount() == 3);
+    CHECK(Core::GetRecord(0, out) && out.data.failnum == 4 && out.data.line == 4);
+
+    // fill the log until it wraps, which erases the first row and the oldest records in it
+    HAL::Emulator::EraseFlashLog();
+    const RecordHeader& first = *reinterpret_cast<const RecordHeader*>(HAL::GetFlashLog());
+    size_t most = 0;
+    uint32_t n = 0;
+    bool wrapped = false;
+    while (!wrapped) {
+        FaultDataFlash_t trace = make_record(FAULT_USER, static_cast<int32_t>(++n), "log.cpp");
+        Core::CommitRecord(trace);
+        const size_t count = Core::GetRecordCount();
+        wrapped = count <= most;
+        if (!wrapped) {
+            CHECK(count == n);
+            most = count;
+        }
+    }
+    CHECK(n > 1);
+    CHECK(first.head == FEATHERTRACE_HEAD && first.failnum == n);
+    const size_t kept = Core::GetRecordCount();
+    CHECK(kept < most);
+    check_log(kept, n);
+    // the rest of the first row was erased, not left with pieces of old records
+    const size_t first_len = (sizeof(RecordHeader) + first.length + 3) / 4 * 4;
+    for (size_t i = first_len; i < FLASH_ROW_SIZE; i++)
+        CHECK(HAL::GetFlashLog()[i] == 0xFF);
+
+    // keep wrapping, the log must always hold the newest records in order
+    const size_t total = n + 3 * most;
+    while (n < total) {
+        FaultDataFlash_t trace = make_record(FAULT_USER, static_cast<int32_t>(++n), "log.cpp");
+        Core::CommitRecord(trace);
+        const size_t count = Core::GetRecordCount();
+        CHECK(count > 0 && count <= most);
+        if (n % most == 0)
+            check_log(count, n);
+    }
+    check_log(Core::GetRecordCount(), n);
+}
+
+static void test_decide_cause() {
+    CHECK(Core::DecideCause(FAULT_UNKNOWN, HAL::SCB_NONE) == FAULT_UNKNOWN);
+    CHECK(Core::DecideCause(FAULT_UNKNOWN, HAL::SCB_HARDFAULT) == FAULT_HARDFAULT);
+    CHECK(Core::DecideCause(FAULT_UNKNOWN, HAL::SCB_WDTEW) == FAULT_HUNG);
+    // a known cause is kept, whatever the interrupt
+    CHECK(Core::DecideCause(FAULT_USER, HAL::SCB_NONE) == FAULT_USER);
+    CHECK(Core::DecideCause(FAULT_USER, HAL::SCB_HARDFAULT) == FAULT_USER);
+    CHECK(Core::DecideCause(FAULT_OUTOFMEMORY, HAL::SCB_WDTEW) == FAULT_OUTOFMEMORY);
+
+    // and through FeatherTrace::Fault
+    HAL::Emulator::EraseFlashLog();
+    CHECK(fault_from(HAL::SCB_HARDFAULT, FAULT_UNKNOWN));
+    FaultDataFlash_t out = { {} };
+    CHECK(newest_fault(out));
+    CHECK(out.data.cause == FAULT_HARDFAULT);
+    CHECK(out.data.interrupt_type == HAL::SCB_HARDFAULT);
+}
+
+static void test_mark() {
+    HAL::Emulator::EraseFlashLog();
+    MARK; const int line = __LINE__;
+    CHECK(fault_from(HAL::SCB_NONE, FAULT_USER));
+    FaultDataFlash_t out = { {} };
+    CHECK(newest_fault(out));
+    CHECK(out.data.cause == FAULT_USER);
+    CHECK(out.data.is_corrupted == 0);
+#if FEATHERTRACE_USE_SITE_IDS
+    CHECK(out.data.site == _ShortFilePrivate::site_id(__FILE__, static_cast<uint32_t>(line)));
+    CHECK(out.data.site != 0);
+    CHECK(out.data.line == 0);
+    CHECK(out.data.file[0] == '\0');
+#else
+    CHECK(out.data.site == 0);
+    CHECK(out.data.line == line);
+    CHECK(strcmp(out.data.file, "test_core.cpp") == 0);
+#endif
+
+#if FEATHERTRACE_MARK_HISTORY > 0
+    // fill the history, so the entries from before this test are pushed out
+    uint32_t loop_line = 0;
+    for (size_t i = 0; i < FEATHERTRACE_MARK_HISTORY; i++) {
+        MARK; loop_line = __LINE__;
+    }
+    MARK; const uint32_t last = __LINE__;
+    CHECK(fault_from(HAL::SCB_NONE, FAULT_USER));
+    CHECK(newest_fault(out));
+    CHECK(out.data.mark_history_len == FEATHERTRACE_MARK_HISTORY);
+    for (size_t i = 0; i < FEATHERTRACE_MARK_HISTORY; i++) {
+        const uint32_t expected = i + 1 < FEATHERTRACE_MARK_HISTORY ? loop_line : last;
+#if FEATHERTRACE_USE_SITE_IDS
+        CHECK(out.data.mark_history[i] == _ShortFilePrivate::site_id(__FILE__, expected));
+#else
+        // the line is in the low 14 bits, see mark_history_entry in FeatherTraceCore.cpp
+        CHECK((out.data.mark_history[i] & 0x3FFF) == expected);
+#endif
+    }
+#endif
+}
+
+static void test_memory_check() {
+    HAL::Emulator::EraseFlashLog();
+    MARK;
+    CHECK(Core::GetRecordCount() == 0);
+    // the heap has run into the stack, so the next MARK faults
+    HAL::Emulator::SetFreeMemory(-1);
+    bool reset = true;
+    if (setjmp(reset_jump) == 0) {
+        MARK;
+        reset = false;
+    }
+    HAL::Emulator::SetFreeMemory(16384);
+    CHECK(reset);
+    FaultDataFlash_t out = { {} };
+    CHECK(newest_fault(out));
+    CHECK(out.data.cause == FAULT_OUTOFMEMORY);
+}
+
+#if FEATHERTRACE_DEFERRED_COMMIT
+static void test_deferred_commit() {
+    HAL::Emulator::EraseFlashLog();
+    CHECK(!CommitFault());
+    MARK; const int first = __LINE__;
+    CHECK(fault_from(HAL::SCB_NONE, FAULT_USER));
+    CHECK(Core::GetRecordCount() == 0);
+    // the first fault is kept, the next two are only counted
+    for (int i = 0; i < 2; i++) {
+        MARK;
+        CHECK(fault_from(HAL::SCB_HARDFAULT, FAULT_UNKNOWN));
+    }
+    CHECK(CommitFault());
+    CHECK(!CommitFault());
+    FaultDataFlash_t out = { {} };
+    CHECK(Core::GetRecordCount() == 1);
+    CHECK(Core::GetRecord(0, out));
+    CHECK(out.data.cause == FAULT_USER);
+    CHECK(out.data.failnum == 3);
+#if !FEATHERTRACE_USE_SITE_IDS
+    CHECK(out.data.line == first);
+#else
+    (void)first;
+#endif
+    // numbering continues after the dropped faults
+    CHECK(fault_from(HAL::SCB_NONE, FAULT_USER));
+    CHECK(newest_fault(out));
+    CHECK(out.data.failnum == 4);
+    CHECK(Core::GetRecordCount() == 2);
+}
+#endif
+
+/** Print into a string, to compare with the expected output */
+class StringPrint : public Print {
+public:
+    size_t write(uint8_t c) override {
+        text += static_cast<char>(c);
+        return 1;
+    }
+
+    std::string text;
+};
+
+static void test_print_record() {
+    FaultDataFlash_t trace = make_record(FAULT_HARDFAULT, 42, "main.cpp");
+    trace.data.interrupt_type = HAL::SCB_HARDFAULT;
+    trace.data.stacktrace[1] = 0x2000;
+    trace.data.failnum = 7;
+#if FEATHERTRACE_SAVE_REGISTERS
+    for (uint32_t i = 0; i < 16; i++)
+        trace.data.regs[i] = i;
+    trace.data.xpsr = 0x61000003;
+#endif
+#if FEATHERTRACE_MARK_HISTORY > 0
+    trace.data.mark_history_len = 0;
+#endif
+    StringPrint print;
+    Core::PrintRecord(print, trace);
+    std::string expected =
+        "Fault! Cause: HARDFAULT\r\n"
+        "Fault during recording: No\r\n"
+        "Line: 42\r\n"
+        "File: main.cpp\r\n"
+        "Interrupt type: 3\r\n"
+        "Stacktrace: 0x0000102a, 0x00002000\r\n";
+#if FEATHERTRACE_SAVE_REGISTERS
+    expected +=
+        "Registers: \r\n"
+        "\tR0: 0x00000000\tR1: 0x00000001\tR2: 0x00000002\tR3: 0x00000003\tR4: 0x00000004"
+        "\tR5: 0x00000005\tR6: 0x00000006\tR7: 0x00000007\tR8: 0x00000008\tR9: 0x00000009"
+        "\tR10: 0x0000000a\tR11: 0x0000000b\tR12: 0x0000000c"
+        "\tSP: 0x0000000d\tLR: 0x0000000e\tPC: 0x0000000f\txPSR: 0x61000003\r\n";
+#endif
+#if FEATHERTRACE_MARK_HISTORY > 0
+    expected += "Mark history (oldest first): \r\n";
+#endif
+    expected += "Failures since upload: 7\r\n";
+    CHECK(print.text == expected);
+    if (print.text != expected)
+        printf("Printed:\n%s\nExpected:\n%s\n", print.text.c_str(), expected.c_str());
+
+    // a site ID replaces the line and file
+    trace.data.site = 0x12345678;
+    print.text.clear();
+    Core::PrintRecord(print, trace);
+    CHECK(print.text.find("Site: 0x12345678\r\n") != std::string::npos);
+    CHECK(print.text.find("Line: ") == std::string::npos);
+}
+
+/** Let time pass with no MARKs, polling the watchdog like a sketch would */
+static void wait_ready() {
+    for (int i = 0; i < 1000 && !WDTReady(); i++)
+        HAL::Emulator::AdvanceMicros(100);
+    CHECK(WDTReady());
+}
+
+static void test_watchdog() {
+    HAL::Emulator::EraseFlashLog();
+    StartWDT(WDTTimeout::WDT_2S);
+    CHECK(HAL::Emulator::IsWatchdogRunning());
+    CHECK(HAL::Emulator::GetWatchdogStalls() == 0);
+
+    // MARK between each early warning, so each one feeds the watchdog instead of faulting
+    uint32_t feeds = HAL::Emulator::GetWatchdogFeeds();
+    for (int i = 0; i < 10; i++) {
+        MARK;
+        HAL::Emulator::AdvanceMicros(1000000);
+        CHECK(!fault_from(HAL::SCB_WDTEW, FAULT_UNKNOWN));
+        CHECK(HAL::Emulator::GetWatchdogFeeds() == ++feeds);
+    }
+    CHECK(HAL::Emulator::GetWatchdogStalls() == 0);
+
+    // a second feed while the first is synchronizing is left for later, instead of stalling
+    HAL::Emulator::AdvanceMicros(1000000);
+    MARK;
+    CHECK(!fault_from(HAL::SCB_WDTEW, FAULT_UNKNOWN));
+    MARK;
+    CHECK(!fault_from(HAL::SCB_WDTEW, FAULT_UNKNOWN));
+    CHECK(HAL::Emulator::GetWatchdogFeeds() == feeds + 1);
+    wait_ready();
+    CHECK(HAL::Emulator::GetWatchdogFeeds() == feeds + 2);
+    CHECK(HAL::Emulator::GetWatchdogStalls() == 0);
+
+    // change the timeout while running, one write per step
+    StartWDTAsync(WDTTimeout::WDT_4S);
+    wait_ready();
+    CHECK(HAL::Emulator::IsWatchdogRunning());
+    CHECK(HAL::Emulator::GetWatchdogStalls() == 0);
+
+    StopWDT();
+    CHECK(!HAL::Emulator::IsWatchdogRunning());
+    StartWDTAsync(WDTTimeout::WDT_1S);
+    wait_ready();
+    CHECK(HAL::Emulator::IsWatchdogRunning());
+    CHECK(HAL::Emulator::GetWatchdogStalls() == 0);
+
+    // no MARK since the last early warning, so the next one faults
+    MARK;
+    HAL::Emulator::AdvanceMicros(1000000);
+    CHECK(!fault_from(HAL::SCB_WDTEW, FAULT_UNKNOWN));
+    HAL::Emulator::AdvanceMicros(1000000);
+    CHECK(fault_from(HAL::SCB_WDTEW, FAULT_UNKNOWN));
+    CHECK(!HAL::Emulator::IsWatchdogRunning());
+    FaultDataFlash_t out = { {} };
+    CHECK(newest_fault(out));
+    CHECK(out.data.cause == FAULT_HUNG);
+    CHECK(out.data.interrupt_type == HAL::SCB_WDTEW);
+    CHECK(HAL::Emulator::GetWatchdogStalls() == 0);
+}
+
+int main() {
+    HAL::Emulator::SetResetHandler(&on_reset);
+    test_flash_log();
+    test_decide_cause();
+    test_mark();
+    test_memory_check();
+#if FEATHERTRACE_DEFERRED_COMMIT
+    test_deferred_commit();
+#endif
+    test_print_record();
+    test_watchdog();
+    if (failures != 0) {
+        printf("%u failed\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,147 @@
+/**
+ * test_record: encode records with FeatherTrace::Record::EncodeRecord and
+ * SealRecord, and check that DecodeRecord and the host library
+ * (ft_dump_open_memory and ft_dump_values) both read them back the same way.
+ *
+ * This is built with MAX_STRACE=64 (see tools/host/CMakeLists.txt), so traces
+ * can be deeper than the 32 frames FEATHERTRACE_STRACE_BYTES always fits, and
+ * the deepest frames are dropped when the deltas don't fit.
+ */
+
+#include "FeatherTraceRecord.h"
+#include "FeatherTraceHost.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static_assert(MAX_STRACE > 32, "test_record must be built with a MAX_STRACE larger than 32");
+
+static unsigned failures = 0;
+
+#define CHECK(_cond) check((_cond), #_cond, __LINE__)
+
+static void check(const bool ok, const char* what, const int line) {
+    if (ok)
+        return;
+    failures++;
+    printf("FAIL line %d: %s\n", line, what);
+}
+
+/** A record with every field encoded before and after the stacktrace set */
+static FaultDataFlash_t make_record(const std::vector<uint32_t>& frames) {
+    FaultDataFlash_t trace = { {} };
+    trace.data.cause = 3;
+    trace.data.interrupt_type = 3;
+    trace.data.line = 1234;
+    strcpy(trace.data.file, "record.cpp");
+    for (size_t i = 0; i < frames.size() && i < MAX_STRACE; i++)
+        trace.data.stacktrace[i] = frames[i];
+#if FEATHERTRACE_SAVE_REGISTERS
+    for (uint32_t i = 0; i < 16; i++)
+        trace.data.regs[i] = 0x20000000u + i * 0x1111;
+    trace.data.xpsr = 0x61000003;
+#endif
+    return trace;
+}
+
+/** Number of bytes TAG_STACKTRACE_DELTAS takes for frames, stopping at FEATHERTRACE_STRACE_BYTES like EncodeRecord */
+static size_t count_kept(const std::vector<uint32_t>& frames, size_t& bytes) {
+    uint32_t prev = STACKTRACE_BASE;
+    size_t kept = 0;
+    bytes = 0;
+    for (; kept < frames.size() && kept < MAX_STRACE; kept++) {
+        const uint32_t delta = frames[kept] - prev;
+        const uint32_t zigzag = (delta << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(delta) >> 31);
+        if (bytes + varint_size(zigzag) > FEATHERTRACE_STRACE_BYTES)
+            break;
+        bytes += varint_size(zigzag);
+        prev = frames[kept];
+    }
+    return kept;
+}
+
+/**
+ * Encode and seal a record with frames, decode it both ways, and check the first
+ * expected_frames frames survive.
+ * @param long_length True if the length of the stacktrace field should need more than one byte.
+ */
+static void check_round_trip(const char* name, const std::vector<uint32_t>& frames,
+    const size_t expected_frames, const bool long_length)
+{
+    printf("%s\n", name);
+    size_t bytes;
+    CHECK(count_kept(frames, bytes) == expected_frames);
+    CHECK((bytes >= 0x80) == long_length);
+
+    const FaultDataFlash_t trace = make_record(frames);
+    EncodedRecord_t record;
+    FeatherTrace::Record::EncodeRecord(trace, record);
+    FeatherTrace::Record::SealRecord(record, 42);
+    const uint8_t* const data = reinterpret_cast<const uint8_t*>(record.raw_u32);
+    const size_t size = FeatherTrace::Record::CheckRecord(data, sizeof(record));
+    CHECK(size != 0);
+
+    FaultDataFlash_t out;
+    FeatherTrace::Record::DecodeRecord(data, out);
+    CHECK(out.data.failnum == 42);
+    CHECK(out.data.cause == trace.data.cause);
+    CHECK(out.data.line == trace.data.line);
+    CHECK(strcmp(out.data.file, trace.data.file) == 0);
+    for (size_t i = 0; i < MAX_STRACE; i++)
+        CHECK(out.data.stacktrace[i] == (i < expected_frames ? frames[i] : 0));
+#if FEATHERTRACE_SAVE_REGISTERS
+    // the registers follow the stacktrace, so are moved when its length takes more than one byte
+    CHECK(memcmp(out.data.regs, trace.data.regs, sizeof(out.data.regs)) == 0);
+    CHECK(out.data.xpsr == trace.data.xpsr);
+#endif
+
+    // the same record in an erased flash dump, not at the start
+    std::vector<uint8_t> dump(FLASH_LOG_SIZE + 64, 0xFF);
+    memcpy(dump.data() + 64, data, size);
+    ft_dump* const ft = ft_dump_open_memory(dump.data(), dump.size());
+    CHECK(ft != nullptr);
+    if (ft == nullptr)
+        return;
+    ft_record found = {};
+    CHECK(ft_dump_count(ft) == 1);
+    CHECK(ft_dump_record(ft, 0, &found) && found.failnum == 42 && found.offset == 64);
+    std::vector<uint32_t> values(MAX_STRACE + 1);
+    CHECK(ft_dump_values(ft, 0, TAG_STACKTRACE_DELTAS, values.data(), values.size()) == expected_frames);
+    for (size_t i = 0; i < expected_frames; i++)
+        CHECK(values[i] == frames[i]);
+    CHECK(ft_dump_values(ft, 0, TAG_LINE, values.data(), values.size()) == 1 && values[0] == 1234);
+#if FEATHERTRACE_SAVE_REGISTERS
+    CHECK(ft_dump_values(ft, 0, TAG_REGS, values.data(), values.size()) == 17 && values[16] == trace.data.xpsr);
+#endif
+    ft_dump_close(ft);
+}
+
+int main() {
+    // 48 frames in flash, each call site close to the one before it in either direction
+    std::vector<uint32_t> deep;
+    for (uint32_t i = 0; i < 48; i++)
+        deep.push_back(0x4000 + (i % 2 == 0 ? i * 0x90 : 0x2000 - i * 0x40));
+    check_round_trip("deeper than 32 frames, backward jumps", deep, deep.size(), false);
+
+    // the same, with every third frame far away, so the deltas take 128 bytes
+    std::vector<uint32_t> far = deep;
+    for (uint32_t i = 3; i < far.size(); i += 3)
+        far[i] = 0x30000 + i * 4;
+    far[40] = 0xFFFFFFF0;
+    check_round_trip("far jumps, long length", far, far.size(), true);
+
+    // frames jumping across the whole address space take 5 bytes each, so only 32 fit
+    std::vector<uint32_t> wide;
+    for (uint32_t i = 0; i < MAX_STRACE; i++)
+        wide.push_back(i % 2 == 0 ? 0xF0000000u + i : 0x1000 + i);
+    check_round_trip("truncated at FEATHERTRACE_STRACE_BYTES", wide, FEATHERTRACE_STRACE_BYTES / VARINT_MAX, true);
+    CHECK(FEATHERTRACE_STRACE_BYTES / VARINT_MAX < wide.size());
+
+    if (failures != 0) {
+        printf("%u failed\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
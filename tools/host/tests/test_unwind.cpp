@@ -0,0 +1,245 @@
+/**
+ * test_unwind: run FeatherTrace::Unwind::Backtrace on the fixed memory image
+ * below and check the frames and stop reason of each case.
+ *
+ * The image is a hand-built .ARM.exidx, .ARM.extab, and stack, laid out the
+ * way the linker and a Cortex-M0+ would. Code is never read by the unwinder,
+ * so only the function addresses matter:
+ *
+ *   MAIN    0x1000  extab, generic model (personality routine + opcodes)
+ *   FUNC_A  0x1100  inline in exidx, personality 0 (short form)
+ *   FUNC_B  0x1200  extab, personality 0 (short form)
+ *   FUNC_C  0x1300  extab, personality 1 (long form, opcodes span two words)
+ *   CANT    0x1400  EXIDX_CANTUNWIND
+ *   LOOP    0x1500  inline, sets vsp from r4 so a corrupt stack can loop
+ *   REFUSE  0x1600  inline, "refuse to unwind" (0x8000)
+ *   END     0x1700  EXIDX_CANTUNWIND, the sentinel the linker adds
+ *
+ * The unwind instructions used are described in EHABI section 10.3.
+ */
+
+#include "FeatherTraceUnwind.h"
+
+#include <cstdio>
+#include <vector>
+
+using namespace FeatherTrace::Unwind;
+
+static constexpr uint32_t MAIN = 0x1000;
+static constexpr uint32_t FUNC_A = 0x1100;
+static constexpr uint32_t FUNC_B = 0x1200;
+static constexpr uint32_t FUNC_C = 0x1300;
+static constexpr uint32_t CANT = 0x1400;
+static constexpr uint32_t LOOP = 0x1500;
+static constexpr uint32_t REFUSE = 0x1600;
+static constexpr uint32_t END = 0x1700;
+/** Where the personality routine of MAIN would be, never read */
+static constexpr uint32_t PERSONALITY = 0xA000;
+
+static constexpr uint32_t EXIDX_ADDR = 0x8000;
+static constexpr uint32_t UNSORTED_ADDR = 0x8100;
+static constexpr uint32_t EXTAB_ADDR = 0x9000;
+static constexpr uint32_t STACK_ADDR = 0x20000E00;
+
+/** Encode target as a place-relative 31-bit offset from place */
+static constexpr uint32_t prel31(uint32_t place, uint32_t target) {
+    return (target - place) & 0x7FFFFFFF;
+}
+
+/** Address of the first word of an exidx entry */
+static constexpr uint32_t exidx(uint32_t index) {
+    return EXIDX_ADDR + index * 8;
+}
+
+static const uint32_t EXTAB[] = {
+    // 0x9000 FUNC_B, personality 0: vsp += 8, pop {r4, r14}, finish
+    0x8001A8B0,
+    // 0x9004 FUNC_C, personality 1 with 1 more word: vsp += 12, pop {r14} (0x84 0x00), finish
+    0x81010284,
+    0x00B0B0B0,
+    // 0x900C MAIN, generic model: personality routine, then 0 more words: pop {r4, r14}, finish
+    prel31(EXTAB_ADDR + 0x0C, PERSONALITY),
+    0x00A8B0B0
+};
+
+static const uint32_t EXIDX[] = {
+    prel31(exidx(0), MAIN),     prel31(exidx(0) + 4, EXTAB_ADDR + 0x0C),
+    prel31(exidx(1), FUNC_A),   0x80A8B0B0, // pop {r4, r14}, finish
+    prel31(exidx(2), FUNC_B),   prel31(exidx(2) + 4, EXTAB_ADDR),
+    prel31(exidx(3), FUNC_C),   prel31(exidx(3) + 4, EXTAB_ADDR + 0x04),
+    prel31(exidx(4), CANT),     1,
+    prel31(exidx(5), LOOP),     0x8094A8B0, // vsp = r4, pop {r4, r14}, finish
+    prel31(exidx(6), REFUSE),   0x808000B0, // refuse to unwind
+    prel31(exidx(7), END),      1
+};
+
+/** The same kind of entries as EXIDX, but out of order */
+static const uint32_t UNSORTED[] = {
+    prel31(UNSORTED_ADDR, CANT),        1,
+    prel31(UNSORTED_ADDR + 8, FUNC_C),  0x80A8B0B0,
+    prel31(UNSORTED_ADDR + 16, FUNC_A), 0x80A8B0B0
+};
+
+/** Saved stack, return addresses have the thumb bit set like on the device */
+static const uint32_t STACK[] = {
+    // 0x20000E00 a corrupt stack, each frame of LOOP points r4 at the other
+    STACK_ADDR + 0x10, LOOP | 0x09, 0, 0,
+    // 0x20000E10
+    STACK_ADDR + 0x00, LOOP | 0x09, 0, 0,
+    // 0x20000E20 a frame of LOOP that points r4 at itself, which doesn't change the stack
+    STACK_ADDR + 0x20, LOOP | 0x09, 0, 0,
+    // 0x20000E30 FUNC_A called from CANT
+    0x44444444, CANT | 0x11, 0, 0,
+    // 0x20000E40 the normal call chain: FUNC_C, 12 bytes of locals, return into FUNC_B
+    0xCCCCCCCC, 0xCCCCCCCC, 0xCCCCCCCC, FUNC_B | 0x21,
+    // 0x20000E50 FUNC_B, 8 bytes of locals, r4, return into FUNC_A
+    0xBBBBBBBB, 0xBBBBBBBB, 0x44444444, FUNC_A | 0x41,
+    // 0x20000E60 FUNC_A: r4, return into MAIN
+    0x44444444, MAIN | 0x09,
+    // 0x20000E68 MAIN: r4, and lr was zero at reset
+    0x44444444, 0
+};
+
+/** A region of target memory */
+struct Region {
+    uint32_t addr;
+    const uint32_t* words;
+    size_t count;
+};
+
+static const Region MEMORY[] = {
+    { EXIDX_ADDR, EXIDX, sizeof(EXIDX) / 4 },
+    { UNSORTED_ADDR, UNSORTED, sizeof(UNSORTED) / 4 },
+    { EXTAB_ADDR, EXTAB, sizeof(EXTAB) / 4 },
+    { STACK_ADDR, STACK, sizeof(STACK) / 4 }
+};
+
+/** FeatherTrace::Unwind::ReadFn for MEMORY, counting the reads in ctx */
+static bool read_memory(void* ctx, uint32_t addr, uint32_t* out) {
+    (*static_cast<uint32_t*>(ctx))++;
+    for (const Region& region : MEMORY) {
+        const uint32_t offset = addr - region.addr;
+        if (addr >= region.addr && offset / 4 < region.count) {
+            *out = region.words[offset / 4];
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Number of reads by the unwinder, so a test can check it stopped on the budget */
+static uint32_t reads = 0;
+static unsigned failures = 0;
+
+static UnwindConfig make_config() {
+    return { &read_memory, &reads, EXIDX_ADDR, EXIDX_ADDR + sizeof(EXIDX), 0, 1000 };
+}
+
+/**
+ * Unwind from pc, sp, and r4, and check the frames and result.
+ * @param max_frames Size of the frame buffer given to Backtrace.
+ */
+static void check(const char* name, const UnwindConfig& config, uint32_t pc, uint32_t sp, uint32_t r4,
+    size_t max_frames, const std::vector<uint32_t>& expected, Result expected_result)
+{
+    uint32_t regs[16] = {};
+    regs[4] = r4;
+    regs[13] = sp;
+    regs[15] = pc;
+    std::vector<uint32_t> frames(max_frames);
+    Result result;
+    reads = 0;
+    frames.resize(Backtrace(config, regs, frames.data(), max_frames, &result));
+    if (frames == expected && result == expected_result) {
+        printf("ok   %s\n", name);
+        return;
+    }
+    failures++;
+    printf("FAIL %s: result %u (expected %u), frames", name,
+        static_cast<unsigned>(result), static_cast<unsigned>(expected_result));
+    for (uint32_t frame : frames)
+        printf(" 0x%04x", static_cast<unsigned>(frame));
+    printf(" (expected");
+    for (uint32_t frame : expected)
+        printf(" 0x%04x", static_cast<unsigned>(frame));
+    printf(")\n");
+}
+
+int main() {
+    const UnwindConfig config = make_config();
+    const std::vector<uint32_t> chain = { FUNC_C | 0x10, FUNC_B | 0x20, FUNC_A | 0x40, MAIN | 0x08 };
+
+    // FUNC_C (long form) -> FUNC_B (extab short form) -> FUNC_A (inline) -> MAIN (generic model)
+    check("personality forms", config, FUNC_C | 0x11, STACK_ADDR + 0x40, 0, 16,
+        chain, UNWIND_END_OF_STACK);
+
+    UnwindConfig stop = config;
+    stop.stop_function = MAIN | 1;
+    check("stop function", stop, FUNC_C | 0x11, STACK_ADDR + 0x40, 0, 16,
+        chain, UNWIND_END_OF_STACK);
+
+    check("max frames", config, FUNC_C | 0x11, STACK_ADDR + 0x40, 0, 2,
+        { FUNC_C | 0x10, FUNC_B | 0x20 }, UNWIND_MAX_FRAMES);
+
+    check("cantunwind", config, FUNC_A | 0x05, STACK_ADDR + 0x30, 0, 16,
+        { FUNC_A | 0x04, CANT | 0x10 }, UNWIND_NO_ENTRY);
+
+    check("refuse to unwind", config, REFUSE | 0x05, STACK_ADDR + 0x40, 0, 16,
+        { REFUSE | 0x04 }, UNWIND_BAD_OPCODE);
+
+    check("before first entry", config, 0x0801, STACK_ADDR + 0x40, 0, 16,
+        { 0x0800 }, UNWIND_NO_ENTRY);
+
+    check("stack out of range", config, FUNC_A | 0x05, 0x30000000, 0, 16,
+        { FUNC_A | 0x04 }, UNWIND_BAD_MEMORY);
+
+    check("self-referencing frame", config, LOOP | 0x05, STACK_ADDR + 0x20, STACK_ADDR + 0x20, 16,
+        { LOOP | 0x04, LOOP | 0x08 }, UNWIND_NO_PROGRESS);
+
+    // the two frames at STACK_ADDR point at each other, so only the budget stops the unwind
+    UnwindConfig budget = config;
+    budget.max_instructions = 100;
+    std::vector<uint32_t> looped;
+    uint32_t regs[16] = {};
+    regs[4] = STACK_ADDR;
+    regs[13] = STACK_ADDR;
+    regs[15] = LOOP | 0x05;
+    uint32_t frames[256];
+    Result result;
+    reads = 0;
+    const size_t len = Backtrace(budget, regs, frames, 256, &result);
+    looped.push_back(LOOP | 0x04);
+    looped.resize(len, LOOP | 0x08);
+    check("corrupt stack budget", budget, LOOP | 0x05, STACK_ADDR, STACK_ADDR, 256,
+        looped, UNWIND_BUDGET);
+    if (len < 2 || len >= 256 || reads > budget.max_instructions) {
+        failures++;
+        printf("FAIL corrupt stack budget: %u frames and %u reads with a budget of %u\n",
+            static_cast<unsigned>(len), static_cast<unsigned>(reads),
+            static_cast<unsigned>(budget.max_instructions));
+    }
+
+    // exidx_end past the end of the table, so the binary search reads outside of it
+    UnwindConfig past_end = config;
+    past_end.exidx_end = EXIDX_ADDR + 0x1000;
+    check("index out of range", past_end, FUNC_A | 0x05, STACK_ADDR + 0x60, 0, 16,
+        { FUNC_A | 0x04 }, UNWIND_BAD_MEMORY);
+
+    UnwindConfig reversed = config;
+    reversed.exidx_end = EXIDX_ADDR - 8;
+    check("index end before start", reversed, FUNC_A | 0x05, STACK_ADDR + 0x60, 0, 16,
+        { FUNC_A | 0x04 }, UNWIND_BAD_MEMORY);
+
+    // the binary search passes over FUNC_A's entry, so it is treated like a function without one
+    UnwindConfig unsorted = config;
+    unsorted.exidx_start = UNSORTED_ADDR;
+    unsorted.exidx_end = UNSORTED_ADDR + sizeof(UNSORTED);
+    check("unsorted index", unsorted, FUNC_A | 0x05, STACK_ADDR + 0x60, 0, 16,
+        { FUNC_A | 0x04 }, UNWIND_NO_ENTRY);
+
+    if (failures != 0) {
+        printf("%u failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+# ctypes bindings for libfeathertrace-host (see tools/host/FeatherTraceHost.h), used by
+# recover_trace.py to decode flash dumps and symbolize addresses without pyocd.
+#
+# Build the library with:
+#   cmake -S tools/host -B tools/host/build -DCMAKE_BUILD_TYPE=Release
+#   cmake --build tools/host/build
+# It is found in FEATHERTRACE_HOST_LIB if set, next to this script, or in tools/host/build.
+
+import ctypes
+import os
+import sys
+
+# This must match FT_HOST_API_VERSION in FeatherTraceHost.h
+FT_HOST_API_VERSION = 2
+
+class _Record(ctypes.Structure):
+    _fields_ = [ ('failnum', ctypes.c_uint32), ('offset', ctypes.c_uint32), ('length', ctypes.c_uint32) ]
+
+class _Location(ctypes.Structure):
+    _fields_ = [
+        ('function', ctypes.c_char_p),
+        ('function_offset', ctypes.c_uint32),
+        ('dir', ctypes.c_char_p),
+        ('file', ctypes.c_char_p),
+        ('line', ctypes.c_uint32) ]
+
+def _library_names():
+    if sys.platform == 'win32':
+        return [ 'feathertrace-host.dll', 'libfeathertrace-host.dll' ]
+    if sys.platform == 'darwin':
+        return [ 'libfeathertrace-host.dylib' ]
+    return [ 'libfeathertrace-host.so' ]
+
+def _find_library():
+    if 'FEATHERTRACE_HOST_LIB' in os.environ:
+        return [ os.environ['FEATHERTRACE_HOST_LIB'] ]
+    here = os.path.dirname(os.path.abspath(__file__))
+    dirs = [ here, os.path.join(here, '..', 'host', 'build') ]
+    return [ os.path.join(d, name) for d in dirs for name in _library_names() ]
+
+def _load():
+    for path in _find_library():
+        if not os.path.isfile(path):
+            continue
+        lib = ctypes.CDLL(path)
+        lib.ft_host_version.restype = ctypes.c_uint32
+        if lib.ft_host_version() != FT_HOST_API_VERSION:
+            continue
+        lib.ft_last_error.restype = ctypes.c_char_p
+        lib.ft_dump_open.restype = ctypes.c_void_p
+        lib.ft_dump_open.argtypes = [ ctypes.c_char_p ]
+        lib.ft_dump_open_memory.restype = ctypes.c_void_p
+        lib.ft_dump_open_memory.argtypes = [ ctypes.c_void_p, ctypes.c_size_t ]
+        lib.ft_dump_close.argtypes = [ ctypes.c_void_p ]
+        lib.ft_dump_count.restype = ctypes.c_size_t
+        lib.ft_dump_count.argtypes = [ ctypes.c_void_p ]
+        lib.ft_dump_record.argtypes = [ ctypes.c_void_p, ctypes.c_size_t, ctypes.POINTER(_Record) ]
+        lib.ft_dump_has_field.argtypes = [ ctypes.c_void_p, ctypes.c_size_t, ctypes.c_uint8 ]
+        lib.ft_dump_values.restype = ctypes.c_size_t
+        lib.ft_dump_values.argtypes = [ ctypes.c_void_p, ctypes.c_size_t, ctypes.c_uint8, ctypes.POINTER(ctypes.c_uint32), ctypes.c_size_t ]
+        lib.ft_dump_string.restype = ctypes.c_size_t
+        lib.ft_dump_string.argtypes = [ ctypes.c_void_p, ctypes.c_size_t, ctypes.c_uint8, ctypes.c_char_p, ctypes.c_size_t ]
+        lib.ft_symbols_open_cached.restype = ctypes.c_void_p
+        lib.ft_symbols_open_cached.argtypes = [ ctypes.c_char_p, ctypes.c_char_p ]
+        lib.ft_symbols_from_cache.argtypes = [ ctypes.c_void_p ]
+        lib.ft_symbols_close.argtypes = [ ctypes.c_void_p ]
+        lib.ft_symbols_lookup.argtypes = [ ctypes.c_void_p, ctypes.c_uint32, ctypes.POINTER(_Location) ]
+        lib.ft_symbols_find_site.argtypes = [ ctypes.c_void_p, ctypes.c_uint32, ctypes.POINTER(_Location) ]
+        return lib
+    return None
+
+# None if the library could not be found, recover_trace.py falls back to Python
+lib = _load()
+
+def _decode(value):
+    return value.decode(errors='replace') if value is not None else None
+
+class Dump:
+    """The fault records in a flash dump, newest first"""
+    def __init__(self, path=None, buffer=None):
+        # buffer is a writable buffer already holding the dump, such as an ACCESS_COPY mmap,
+        # which is read in place and must stay open until the dump is closed
+        self._buffer = None
+        if buffer is not None:
+            self._buffer = (ctypes.c_char * len(buffer)).from_buffer(buffer)
+            self._handle = lib.ft_dump_open_memory(ctypes.addressof(self._buffer), len(buffer))
+        else:
+            self._handle = lib.ft_dump_open(os.fsencode(path))
+        if not self._handle:
+            raise OSError(lib.ft_last_error().decode())
+
+    def close(self):
+        if self._handle:
+            lib.ft_dump_close(self._handle)
+            self._handle = None
+        # release the buffer so its mmap can be closed
+        self._buffer = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __len__(self):
+        return lib.ft_dump_count(self._handle)
+
+    def failnum(self, index):
+        record = _Record()
+        if not lib.ft_dump_record(self._handle, index, ctypes.byref(record)):
+            raise IndexError(lib.ft_last_error().decode())
+        return record.failnum
+
+    def has_field(self, index, tag):
+        return lib.ft_dump_has_field(self._handle, index, tag) != 0
+
+    def values(self, index, tag):
+        # the first call counts the values, the second reads them
+        count = lib.ft_dump_values(self._handle, index, tag, None, 0)
+        if count == 0:
+            return []
+        buf = (ctypes.c_uint32 * count)()
+        lib.ft_dump_values(self._handle, index, tag, buf, count)
+        return list(buf)
+
+    def string(self, index, tag):
+        length = lib.ft_dump_string(self._handle, index, tag, None, 0)
+        buf = ctypes.create_string_buffer(length + 1)
+        lib.ft_dump_string(self._handle, index, tag, buf, length + 1)
+        return buf.raw[:length].decode('ascii', errors='replace')
+
+class Symbols:
+    """Symbols and line table of an ELF file"""
+    def __init__(self, path, cache_dir=None):
+        # with cache_dir, the index of the ELF file is saved there and reused by later runs
+        if cache_dir is not None:
+            os.makedirs(cache_dir, exist_ok=True)
+        self._handle = lib.ft_symbols_open_cached(os.fsencode(path), os.fsencode(cache_dir) if cache_dir is not None else None)
+        if not self._handle:
+            raise OSError(lib.ft_last_error().decode())
+
+    @property
+    def from_cache(self):
+        return lib.ft_symbols_from_cache(self._handle) != 0
+
+    def close(self):
+        if self._handle:
+            lib.ft_symbols_close(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()
+
+    def lookup(self, addr):
+        # returns (function, dir, file, line), with None for anything unknown
+        location = _Location()
+        lib.ft_symbols_lookup(self._handle, addr, ctypes.byref(location))
+        return (_decode(location.function), _decode(location.dir), _decode(location.file),
+            location.line if location.file is not None else None)
+
+    def find_site(self, site):
+        # returns (file, line), or None if no line has this site ID
+        location = _Location()
+        if not lib.ft_symbols_find_site(self._handle, site, ctypes.byref(location)):
+            return None
+        return _decode(location.file), location.line
@@ -11,7 +11,8 @@
 #   Python 3.x - Available on windows, linux and mac. See https://realpython.com/installing-python/
 #   click - Install with 'sudo pip3 install click' (omit sudo on windows)
 #   pyserial - Install with 'sudo pip3 install pyserial' (omit sudo on windows)
-#   pyocd - Install with 'sudo pip3 install pyocd' (omit sudo on windows)
+#   pyocd - Install with 'sudo pip3 install pyocd' (omit sudo on windows), not needed if
+#       libfeathertrace-host is built (see feathertrace_host.py), which is also much faster
 #   bossac - You will need to install BOSSA (https://www.shumatech.com/web/products/bossa), and locate
 #       bossac from the installation (In windows: C:\Program Files (x86)\BOSSA\bossac.exe). From there, you 
 #       can either copy the binary into the same directory as this script, or add the BOSSA folder to your path.
@@ -25,12 +26,21 @@ from serial.tools import list_ports
 import mmap
 import struct
 import array
+import zlib
 from collections import namedtuple
 import os
 import shutil
 import re
+import json
+import hashlib
+import glob
+import concurrent.futures
 from elftools.elf.elffile import ELFFile
-from pyocd.debug.elf.decoder import DwarfAddressDecoder
+import feathertrace_host
+try:
+    from pyocd.debug.elf.decoder import DwarfAddressDecoder
+except ImportError:
+    DwarfAddressDecoder = None
 
 # These values are specific to the Adafruit Feather M0 USB configuration
 PID_SKETCH = (0x800b, 0x801B)
@@ -39,11 +49,40 @@ VID = 0x239a
 
 # These values indicate where and what FeatherTrace trace data is stored in flash
 FEATHERTRACE_HEAD = 0xFEFE2A2A
-FEATHERTRACE_STRING = b'FeatherTrace Data Here:\0'
-# This must be changed to reflect changes in the FeatherTraceFlash struct
-FEATHERTRACE_STRUCT_FMT = '< I 24s I 8s I 8s I 8s 32I 8s 16I I 8s I 8s I 8s i 8s 64s 4s'
-FEATHERTRACE_STRUCT_FIELDS = 'value_head marker version marker1 cause marker2 interrupt_type marker3 stacktrace marker4 regs xpsr marker5 is_corrupted marker6 failnum marker7 line marker8 file marker9'
-FEATHERTRACE_STRUCT_NAMEDTUPLE = namedtuple('FeatherTraceData', FEATHERTRACE_STRUCT_FIELDS)
+# This must be changed to reflect changes to the record format in FeatherTraceRecord.h
+FEATHERTRACE_RECORD_VERSION = 1
+# head, version, length, failnum, crc
+FEATHERTRACE_HEADER_FMT = '< I H H I I'
+FEATHERTRACE_HEADER_SIZE = struct.calcsize(FEATHERTRACE_HEADER_FMT)
+# tags of the fields following the header, see RecordTag in FeatherTraceRecord.h
+class RecordTag(enum.IntEnum):
+    CAUSE = 1
+    INTERRUPT_TYPE = 2
+    IS_CORRUPTED = 3
+    LINE = 4
+    FILE = 5
+    SITE = 6
+    STACKTRACE = 7
+    REGS = 8
+    MARK_HISTORY = 9
+    STACK_WINDOW = 10
+    STARVED_CHANNEL = 11
+    STACK_HIGH_WATER = 12
+    HEAP_STATS = 13
+    HEAP_SITES = 14
+    EVENT_LOG = 15
+    STACKTRACE_DELTAS = 16
+    WAKE_COUNT = 17
+    SIGNATURE = 18
+# Address the first frame of STACKTRACE_DELTAS is relative to
+FEATHERTRACE_STACKTRACE_BASE = 0
+FEATHERTRACE_RECORD_FIELDS = 'failnum cause interrupt_type is_corrupted line file site stacktrace regs xpsr mark_history stack_window_addr stack_window starved_channel stack_high_water heap_stats heap_sites event_log wake_count signature'
+FEATHERTRACE_RECORD_NAMEDTUPLE = namedtuple('FeatherTraceData', FEATHERTRACE_RECORD_FIELDS)
+FEATHERTRACE_HEAP_STATS = [ 'Live', 'Peak', 'Allocs', 'Frees', 'Failed', 'Largest free' ]
+# This must be changed to reflect FEATHERTRACE_LOG_MAX_ARGS
+FEATHERTRACE_LOG_MAX_ARGS = 4
+# printf conversions supported by FT_LOG, every argument is stored as a 32 bit word
+FEATHERTRACE_LOG_SPEC = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|z|j|t)?([diuxXcsfFeEgGp%])')
 
 class FaultCause(enum.Enum):
     FAULT_NONE = 0
@@ -81,32 +120,675 @@ def download_board_flash(port, bossac, tmpfilepath):
     else:
         return False
 
-def get_fault_data(byte_data):
-    # todo: fix struct unpacking to collate arrays
-    unpacked = struct.unpack(FEATHERTRACE_STRUCT_FMT, byte_data)
-    # group together the stacktrace and regs arrays
-    stacktrace = unpacked[8:40]
-    regs = unpacked[41:57]
-    # recreate the tuple with these new arrays
-    true_unpacked = unpacked[:8] + (stacktrace, unpacked[40], regs) + unpacked[57:]
-    return FEATHERTRACE_STRUCT_NAMEDTUPLE._make(true_unpacked)
+def read_varint(data, pos):
+    # little endian base 128, returns the value and the position after it
+    value = 0
+    shift = 0
+    while pos < len(data) and shift < 35:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if byte & 0x80 == 0:
+            return value & 0xFFFFFFFF, pos
+        shift += 7
+    return 0, len(data)
+
+def read_varints(data):
+    values = []
+    pos = 0
+    while pos < len(data):
+        value, pos = read_varint(data, pos)
+        values.append(value)
+    return values
+
+def read_stacktrace_deltas(data):
+    # each frame is a zigzag encoded difference from the frame before it
+    stacktrace = []
+    prev = FEATHERTRACE_STACKTRACE_BASE
+    for value in read_varints(data):
+        prev = (prev + ((value >> 1) ^ -(value & 1))) & 0xFFFFFFFF
+        stacktrace.append(prev)
+    return stacktrace
+
+def check_record(fmap, idx):
+    # returns the header and fields of a complete record of the current version at idx, or None
+    if idx + FEATHERTRACE_HEADER_SIZE > len(fmap):
+        return None
+    head, version, length, failnum, crc = struct.unpack(FEATHERTRACE_HEADER_FMT, fmap[idx:(idx + FEATHERTRACE_HEADER_SIZE)])
+    if head != FEATHERTRACE_HEAD or version != FEATHERTRACE_RECORD_VERSION or idx + FEATHERTRACE_HEADER_SIZE + length > len(fmap):
+        return None
+    body = fmap[(idx + FEATHERTRACE_HEADER_SIZE):(idx + FEATHERTRACE_HEADER_SIZE + length)]
+    # the CRC covers everything in the header after head, except the CRC itself
+    if zlib.crc32(body, zlib.crc32(fmap[(idx + 4):(idx + 12)])) != crc:
+        return None
+    return failnum, body
+
+def read_fields(body):
+    # split the body into fields, skipping any tags this version doesn't know about
+    fields = {}
+    pos = 0
+    while pos < len(body):
+        tag = body[pos]
+        length, pos = read_varint(body, pos + 1)
+        fields[tag] = body[pos:(pos + length)]
+        pos += length
+    return fields
+
+def read_field_values(tag, data):
+    # the numbers in a field, the same as ft_dump_values in tools/host/FeatherTraceHost.h
+    if tag == RecordTag.STACKTRACE_DELTAS:
+        return read_stacktrace_deltas(data)
+    if tag == RecordTag.STACK_WINDOW:
+        # the address of the window, then each word
+        window_addr, pos = read_varint(data, 0)
+        count = (len(data) - pos) // 4
+        return [ window_addr ] + list(struct.unpack(f'< { count }I', data[pos:(pos + count * 4)]))
+    return read_varints(data)
+
+def get_fault_data(failnum, has_field, values, string):
+    # has_field(tag), values(tag), and string(tag) read the fields of the record,
+    # see read_field_values and ft_dump_values in tools/host/FeatherTraceHost.h
+    def varint(tag):
+        field = values(tag)
+        return field[0] if len(field) > 0 else 0
+    line = varint(RecordTag.LINE)
+    regs = values(RecordTag.REGS) + [ 0 for x in range(17) ]
+    window_addr, window = None, []
+    if has_field(RecordTag.STACK_WINDOW):
+        window_values = values(RecordTag.STACK_WINDOW)
+        window_addr, window = window_values[0], window_values[1:]
+    heap_stats = tuple(values(RecordTag.HEAP_STATS)) if has_field(RecordTag.HEAP_STATS) else None
+    heap_sites = values(RecordTag.HEAP_SITES)
+    # each event log entry is a header (format address | argument count << 28) followed by the arguments
+    event_log = []
+    log_values = values(RecordTag.EVENT_LOG)
+    i = 0
+    while i < len(log_values):
+        header = log_values[i]
+        count = min(header >> 28, FEATHERTRACE_LOG_MAX_ARGS)
+        event_log.append((header & 0x0FFFFFFF, log_values[(i + 1):(i + 1 + count)]))
+        i += 1 + count
+    return FEATHERTRACE_RECORD_NAMEDTUPLE(
+        failnum=failnum,
+        cause=varint(RecordTag.CAUSE),
+        interrupt_type=varint(RecordTag.INTERRUPT_TYPE),
+        is_corrupted=varint(RecordTag.IS_CORRUPTED),
+        line=line - (1 << 32) if line & 0x80000000 else line,
+        file=string(RecordTag.FILE),
+        site=varint(RecordTag.SITE),
+        stacktrace=values(RecordTag.STACKTRACE_DELTAS) if has_field(RecordTag.STACKTRACE_DELTAS)
+            else values(RecordTag.STACKTRACE),
+        regs=regs[:16],
+        xpsr=regs[16],
+        mark_history=values(RecordTag.MARK_HISTORY),
+        stack_window_addr=window_addr,
+        stack_window=window,
+        starved_channel=string(RecordTag.STARVED_CHANNEL),
+        stack_high_water=varint(RecordTag.STACK_HIGH_WATER) if has_field(RecordTag.STACK_HIGH_WATER) else None,
+        heap_stats=heap_stats,
+        heap_sites=list(zip(heap_sites[0::2], heap_sites[1::2])),
+        event_log=event_log,
+        wake_count=varint(RecordTag.WAKE_COUNT) if has_field(RecordTag.WAKE_COUNT) else None,
+        signature=varint(RecordTag.SIGNATURE) if has_field(RecordTag.SIGNATURE) else None)
+
+def read_elf_string(elffile, addr):
+    # find the section containing addr, and read a null terminated string from it
+    for section in elffile.iter_sections():
+        start = section['sh_addr']
+        if section['sh_type'] == 'SHT_PROGBITS' and start <= addr < start + section['sh_size']:
+            data = section.data()[(addr - start):]
+            return data.split(b'\0', 1)[0].decode(errors='replace')
+    return None
+
+def format_log_entry(elffile, token, args):
+    # the token is the address of the format string, so read it from the ELF and
+    # substitute the arguments ourselves, since they were stored as raw words
+    fmt = read_elf_string(elffile, token) if elffile != None else None
+    hex_args = ' '.join([ f'{ arg:#010x}' for arg in args ])
+    if fmt is None:
+        return f'<format at { format(token, "#010x") }> { hex_args }'.rstrip()
+    remaining = list(args)
+    def substitute(match):
+        flags, conv = match.group(1), match.group(2)
+        if conv == '%':
+            return '%'
+        if len(remaining) == 0:
+            return match.group(0)
+        word = remaining.pop(0)
+        if conv in 'di':
+            value = struct.unpack('< i', struct.pack('< I', word))[0]
+        elif conv in 'fFeEgG':
+            value = struct.unpack('< f', struct.pack('< I', word))[0]
+        elif conv == 's':
+            value = read_elf_string(elffile, word)
+            if value is None:
+                value = f'<string at { word:#010x}>'
+        elif conv == 'p':
+            return f'{ word:#010x}'
+        else:
+            value = word
+        try:
+            return ('%' + flags + conv) % value
+        except (TypeError, ValueError, OverflowError):
+            return f'{ word:#010x}'
+    return FEATHERTRACE_LOG_SPEC.sub(substitute, fmt)
+
+def print_event_log(elf_path, entries, indent):
+    indent_str = ''.join(['\t' for x in range(indent)])
+    elffile = ELFFile(elf_path) if elf_path != None else None
+    for token, args in entries:
+        click.echo(f'{ indent_str }{ format_log_entry(elffile, token, args) }')
+    if elf_path != None:
+        elf_path.seek(0)
+
+def print_mark_history(elf_path, history, is_site, indent):
+    indent_str = ''.join(['\t' for x in range(indent)])
+    # site IDs can be decoded directly from the line table
+    if is_site:
+        if elf_path != None:
+            print_mark_sites(elf_path, history, indent)
+            elf_path.seek(0)
+        else:
+            for entry in history:
+                click.echo(f'{ indent_str }{ entry:#010x}')
+        return
+    # else the entries are packed line/filename pointer pairs (see mark_history_entry in FeatherTraceCore.cpp)
+    elffile = ELFFile(elf_path) if elf_path != None else None
+    for entry in history:
+        line = entry & 0x3FFF
+        file_ptr = entry >> 14
+        filename = read_elf_string(elffile, file_ptr) if elffile != None else None
+        if filename is None:
+            filename = f'<file at { file_ptr:#010x}>'
+        click.echo(f'{ indent_str }{ filename }:{ line }')
+    if elf_path != None:
+        elf_path.seek(0)
+
+FNV1A_BASIS = 2166136261
+
+def fnv1a(hash, data):
+    # 32-bit FNV-1a over the bytes of data continuing from hash, the same as the
+    # fnv1a_* functions in ShortFile.h that the device uses for site IDs and signatures
+    for byte in data:
+        hash = ((hash ^ byte) * 16777619) & 0xFFFFFFFF
+    return hash
+
+def u32_bytes(value):
+    return (value & 0xFFFFFFFF).to_bytes(4, byteorder='little')
+
+def get_site_id(filename, line):
+    # must match _ShortFilePrivate::site_id in ShortFile.h: FNV-1a over the
+    # filename after the last slash, followed by the line number as 4 little endian bytes
+    short_name = re.split(r'[/\\]', filename)[-1]
+    return fnv1a(FNV1A_BASIS, short_name.encode() + u32_bytes(line))
+
+def decode_mark_sites(elf_path, sites):
+    # MARK site IDs are hashes, so search every file:line in the DWARF line table for a match
+    symbols = get_native_symbols(elf_path)
+    if symbols is not None:
+        found = {}
+        for site in sites:
+            location = symbols.find_site(site)
+            if location is not None:
+                found[site] = f'{ location[0] }:{ location[1] }'
+        return found
+    remaining = set(sites)
+    found = {}
+    elffile = ELFFile(elf_path)
+    dwarfinfo = elffile.get_dwarf_info()
+    for cu in dwarfinfo.iter_CUs():
+        lineprog = dwarfinfo.line_program_for_CU(cu)
+        if lineprog is None:
+            continue
+        file_entries = lineprog['file_entry']
+        # file numbers start at 1 before DWARF 5, and at 0 from DWARF 5 on
+        first_file = 0 if lineprog.header.version >= 5 else 1
+        for entry in lineprog.get_entries():
+            if entry.state is None or not (0 <= entry.state.file - first_file < len(file_entries)):
+                continue
+            filename = file_entries[entry.state.file - first_file].name.decode()
+            site = get_site_id(filename, entry.state.line)
+            if site in remaining:
+                found[site] = f'{ filename }:{ entry.state.line }'
+                remaining.discard(site)
+                if len(remaining) == 0:
+                    return found
+    return found
+
+def print_mark_sites(elf_path, sites, indent):
+    try:
+        found = decode_mark_sites(elf_path, sites)
+        indent_str = ''.join(['\t' for x in range(indent)])
+        for site in sites:
+            click.echo(f'{ indent_str }{ format(site, "#010x") }: { found.get(site, "unknown") }')
+    except Exception as ex:
+        click.echo(f'Error while decoding MARK site: {ex}')
+
+# libfeathertrace-host symbols for each ELF path, so the line table is only read once
+native_symbols = {}
+# Where libfeathertrace-host keeps the symbol index of each ELF file, so later runs don't read the
+# line table at all. Set FEATHERTRACE_SYMBOL_CACHE to another directory, or to nothing to disable it.
+SYMBOL_CACHE_DIR = os.environ.get('FEATHERTRACE_SYMBOL_CACHE', os.path.join(os.path.expanduser('~'), '.cache', 'feathertrace'))
+
+def get_native_symbols(elf_path):
+    # returns feathertrace_host.Symbols for the ELF file, or None if the library isn't built
+    if feathertrace_host.lib is None:
+        return None
+    if elf_path.name not in native_symbols:
+        native_symbols[elf_path.name] = feathertrace_host.Symbols(elf_path.name, SYMBOL_CACHE_DIR if SYMBOL_CACHE_DIR else None)
+    return native_symbols[elf_path.name]
+
+def get_address_decoder(elf_path):
+    # returns a function taking an address and returning (function, dir, file, line),
+    # with None for anything unknown
+    symbols = get_native_symbols(elf_path)
+    if symbols is not None:
+        return symbols.lookup
+    if DwarfAddressDecoder is None:
+        raise RuntimeError('decoding addresses needs pyocd or libfeathertrace-host, see feathertrace_host.py')
+    decoder = DwarfAddressDecoder(ELFFile(elf_path))
+    def lookup(addr):
+        function = decoder.get_function_for_address(addr)
+        line = decoder.get_line_for_address(addr)
+        if line is None:
+            return function.name.decode() if function is not None else None, None, None, None
+        return (function.name.decode() if function is not None else None,
+            line.dirname.decode(), line.filename.decode(), line.line)
+    return lookup
+
+def format_function(funcname):
+    # demangled names from libfeathertrace-host already have their parameters
+    if funcname is None:
+        return 'unknown()'
+    return funcname if funcname.endswith(')') else f'{ funcname }()'
 
 def print_stack_trace(elf_path, addresses, indent):
     try:
-        elffile = ELFFile(elf_path)
-        decoder = DwarfAddressDecoder(elffile)
+        lookup = get_address_decoder(elf_path)
         for addr in addresses:
-            function = decoder.get_function_for_address(addr)
-            line = decoder.get_line_for_address(addr)
+            funcname, dirname, filename, linenum = lookup(addr)
             indent_str = ''.join(['\t' for x in range(indent)])
-            funcname = function.name.decode() if function is not None else 'unknown'
-            dirname = line.dirname.decode() if line is not None else 'unknown'
-            filename = line.filename.decode() if line is not None else 'unknown'
-            linenum = line.line if line is not None else 'unknown'
-            click.echo(f'{ indent_str }{ format(addr, "#010x") }: { funcname }() at { dirname }/{ filename }:{ linenum }')
+            dirname = dirname if dirname else 'unknown'
+            filename = filename if filename is not None else 'unknown'
+            linenum = linenum if linenum is not None else 'unknown'
+            click.echo(f'{ indent_str }{ format(addr, "#010x") }: { format_function(funcname) } at { dirname }/{ filename }:{ linenum }')
     except Exception as ex:
         click.echo(f'Error while decoding stacktrace: {ex}')
 
+def find_fault_records(fmap):
+    # seek to the special binary sequence feathertrace uses to indicate a record,
+    # returning every valid record found sorted newest first
+    records = []
+    start = 0
+    while True:
+        idx = fmap.find(FEATHERTRACE_HEAD.to_bytes(4, byteorder='little'), start)
+        if idx == -1:
+            break
+        # records are word aligned, and the CRC must match
+        checked = check_record(fmap, idx) if idx % 4 == 0 else None
+        if checked is not None:
+            failnum, body = checked
+            fields = read_fields(body)
+            records.append(get_fault_data(failnum,
+                lambda tag: tag in fields,
+                lambda tag: read_field_values(tag, fields.get(tag, b'')),
+                lambda tag: fields.get(tag, b'').decode('ascii', errors='replace')))
+            start = idx + FEATHERTRACE_HEADER_SIZE + len(body)
+        # else keep going
+        else:
+            start = idx + 1
+    # failnum doubles as the sequence number of the record
+    records.sort(key=lambda record: record.failnum, reverse=True)
+    return records
+
+def find_fault_records_native(path=None, buffer=None):
+    # the same as find_fault_records, using libfeathertrace-host to read the dump from
+    # path, or from buffer if the dump is already mapped (see feathertrace_host.Dump)
+    records = []
+    with feathertrace_host.Dump(path, buffer) as dump:
+        for i in range(len(dump)):
+            records.append(get_fault_data(dump.failnum(i),
+                lambda tag: dump.has_field(i, tag),
+                lambda tag: dump.values(i, tag),
+                lambda tag: dump.string(i, tag)))
+    return records
+
+def print_fault_data(data, elf_path):
+    click.echo(f'Fault #{ data.failnum }:')
+    click.echo(f'\tFault: { FaultCause(data.cause) }')
+    click.echo(f'\tFaulted during recording: { "Yes" if data.is_corrupted > 0 else "No" }')
+    if data.site != 0:
+        if elf_path != None:
+            click.echo('\tLast Marked Site: ')
+            print_mark_sites(elf_path, [ data.site ], 2)
+            elf_path.seek(0)
+        else:
+            click.echo(f'\tLast Marked Site: { format(data.site, "#010x") }')
+    else:
+        click.echo(f'\tLast Marked Line: { data.line }')
+        click.echo(f'\tLast Marked File: { data.file }')
+    if data.starved_channel:
+        click.echo(f'\tStarved watchdog channel: { data.starved_channel }')
+    click.echo(f'\tInterrupt type: { data.interrupt_type }')
+    # print decoded stacktrace if all tools needed are present
+    hexfmt = '{:#010x}'
+    if elf_path != None:
+        click.echo('\tDecoded Stacktrace (may take a moment): ')
+        print_stack_trace(elf_path, [ addr for addr in data.stacktrace if addr != 0 ], 2)
+    # else print the normal stacktrace
+    else:
+        fmted_trace = ', '.join([ hexfmt.format(addr) for addr in data.stacktrace if addr != 0 ])
+        click.echo(f'\tStacktrace: { fmted_trace }')
+    # if the interrupt was asynchrounous, read the saved registers
+    if data.interrupt_type != 0:
+        click.echo('\tRegisters:')
+        # print the first 13 registers
+        first_regs = [ 'R{:} {:#010x}'.format(i, regval) for i,regval in enumerate(data.regs[:13]) ]
+        fmted_regs_line1 = ', '.join(first_regs[:7])
+        click.echo(f'\t\t{ fmted_regs_line1 }\t')
+        fmted_regs_line2 = ', '.join(first_regs[7:])
+        click.echo(f'\t\t{ fmted_regs_line2 }\t')
+        # print the special ones
+        click.echo(f'\t\tSP: { hexfmt.format(data.regs[13]) }\tLR: { hexfmt.format(data.regs[14]) }\tPC: { hexfmt.format(data.regs[15]) }\txPSR: { hexfmt.format(data.xpsr) }')
+    if len(data.mark_history) > 0:
+        click.echo('\tMark history (oldest first):')
+        print_mark_history(elf_path, data.mark_history, data.site != 0, 2)
+    if len(data.stack_window) > 0:
+        click.echo(f'\tStack window: { len(data.stack_window) * 4 } bytes at { hexfmt.format(data.stack_window_addr) } (unwind with tools/host/ft_unwind)')
+    if data.heap_stats is not None:
+        click.echo('\tHeap:')
+        for name, value in zip(FEATHERTRACE_HEAP_STATS, data.heap_stats):
+            click.echo(f'\t\t{ name }: { value }')
+        if len(data.heap_sites) > 0:
+            click.echo('\tRecent allocations (oldest first):')
+            for caller, size in data.heap_sites:
+                click.echo(f'\t\t{ hexfmt.format(caller) }: { size } bytes')
+            if elf_path != None:
+                click.echo('\tDecoded allocation callers:')
+                print_stack_trace(elf_path, sorted(set(caller for caller, size in data.heap_sites)), 2)
+                elf_path.seek(0)
+    if len(data.event_log) > 0:
+        click.echo('\tLog (oldest first):')
+        print_event_log(elf_path, data.event_log, 2)
+    if data.stack_high_water is not None:
+        click.echo(f'\tStack high water: { data.stack_high_water } bytes')
+    if data.wake_count is not None:
+        click.echo(f'\tWakes since boot: { data.wake_count }')
+    if data.signature is not None:
+        click.echo(f'\tSignature: { data.signature:#010x}')
+    click.echo(f'\tFailures since upload: { data.failnum }')
+
+# PrintFault output, see FeatherTrace::Core::PrintRecord in FeatherTraceCore.cpp
+PRINT_FAULT_START = re.compile(r'Fault! Cause: (\w+)')
+PRINT_FAULT_FIELD = re.compile(r'^(Fault during recording|Site|Line|File|Starved channel|Interrupt type|Stacktrace|Stack high water|Wakes since boot|Signature|Failures since upload): ?(.*)$')
+PRINT_FAULT_HEX = re.compile(r'0x([0-9A-Fa-f]{1,8})')
+PRINT_FAULT_REG = re.compile(r'(R\d+|SP|LR|PC|xPSR): 0x([0-9A-Fa-f]{1,8})')
+PRINT_FAULT_REG_INDEX = { 'SP': 13, 'LR': 14, 'PC': 15 }
+# headers of the indented sections, and the field they fill in
+PRINT_FAULT_SECTIONS = [
+    ('Registers:', 'regs'),
+    ('Mark history (oldest first):', 'mark_history'),
+    ('Stack window at ', 'stack_window'),
+    ('Heap:', 'heap_stats'),
+    ('Recent allocations (oldest first):', 'heap_sites'),
+    ('Log (oldest first):', 'event_log') ]
+# extensions of the files decode-dumps reads from a directory
+DUMP_EXTENSIONS = ( '.bin', '.txt', '.log' )
+
+def cause_name(cause):
+    # the same as FeatherTrace::GetCauseString
+    try:
+        return FaultCause(cause).name[len('FAULT_'):]
+    except ValueError:
+        return 'Corrupted'
+
+def parse_print_fault(lines):
+    # parse the lines of a single FeatherTrace::PrintFault into the same namedtuple as get_fault_data,
+    # except that mark history entries printed as file:line are kept as strings
+    fault = { 'failnum': 0, 'cause': -1, 'interrupt_type': 0, 'is_corrupted': 0, 'line': 0, 'file': '',
+        'site': 0, 'stacktrace': [], 'regs': [ 0 for x in range(16) ], 'xpsr': 0, 'mark_history': [],
+        'stack_window_addr': None, 'stack_window': [], 'starved_channel': '', 'stack_high_water': None,
+        'heap_stats': None, 'heap_sites': [], 'event_log': [], 'wake_count': None,
+        'signature': None }
+    section = None
+    for line in lines:
+        # entries of a section are indented with a tab
+        if line.startswith('\t') and section is not None:
+            text = line.strip()
+            if section == 'regs':
+                for reg, value in PRINT_FAULT_REG.findall(text):
+                    if reg == 'xPSR':
+                        fault['xpsr'] = int(value, 16)
+                    else:
+                        fault['regs'][PRINT_FAULT_REG_INDEX[reg] if reg in PRINT_FAULT_REG_INDEX else int(reg[1:])] = int(value, 16)
+            elif section == 'mark_history':
+                fault['mark_history'].append(int(text, 16) if text.startswith('0x') else text)
+            elif section == 'stack_window':
+                fault['stack_window'] += [ int(word, 16) for word in text.split() ]
+            elif section == 'heap_stats':
+                fault['heap_stats'] = (fault['heap_stats'] or ()) + (int(text.rsplit(': ', 1)[1]),)
+            elif section == 'heap_sites':
+                caller, size = text.split(': ', 1)
+                fault['heap_sites'].append((int(caller, 16), int(size.split()[0])))
+            elif section == 'event_log':
+                values = [ int(value, 16) for value in PRINT_FAULT_HEX.findall(text) ]
+                fault['event_log'].append((values[0], values[1:]))
+            continue
+        section = next((name for header, name in PRINT_FAULT_SECTIONS if line.startswith(header)), None)
+        if section == 'stack_window':
+            fault['stack_window_addr'] = int(PRINT_FAULT_HEX.search(line).group(1), 16)
+        match = PRINT_FAULT_START.match(line)
+        if match is not None:
+            name = 'FAULT_' + match.group(1)
+            fault['cause'] = FaultCause[name].value if name in FaultCause.__members__ else -1
+        match = PRINT_FAULT_FIELD.match(line)
+        if match is None:
+            continue
+        label, value = match.group(1), match.group(2).strip()
+        if label == 'Fault during recording':
+            fault['is_corrupted'] = 1 if value == 'Yes' else 0
+        elif label == 'Site':
+            fault['site'] = int(value, 16)
+        elif label == 'Line':
+            fault['line'] = int(value)
+        elif label == 'File':
+            fault['file'] = value
+        elif label == 'Starved channel':
+            fault['starved_channel'] = value
+        elif label == 'Interrupt type':
+            fault['interrupt_type'] = int(value)
+        elif label == 'Stacktrace':
+            fault['stacktrace'] = [ int(addr, 16) for addr in PRINT_FAULT_HEX.findall(value) ]
+        elif label == 'Stack high water':
+            fault['stack_high_water'] = int(value.split()[0])
+        elif label == 'Wakes since boot':
+            fault['wake_count'] = int(value)
+        elif label == 'Signature':
+            fault['signature'] = int(value, 16)
+        elif label == 'Failures since upload':
+            fault['failnum'] = int(value)
+    return FEATHERTRACE_RECORD_NAMEDTUPLE(**fault)
+
+def find_print_faults(text):
+    # find every PrintFault in a serial log. Anything a serial monitor added before the
+    # first line (ex. a timestamp) is assumed to be the same length on every line.
+    records = []
+    lines = None
+    for line in text.splitlines():
+        match = PRINT_FAULT_START.search(line)
+        if match is not None:
+            prefix, lines = match.start(), []
+        if lines is None:
+            continue
+        lines.append(line[prefix:])
+        if line[prefix:].startswith('Failures since upload:'):
+            records.append(parse_print_fault(lines))
+            lines = None
+    return records
+
+def get_device_signature(data):
+    # must match FeatherTrace::Core::ComputeSignature in FeatherTraceCore.cpp, so the signature
+    # sent by a device with FEATHERTRACE_SIGNATURE can be matched to faults read from any record
+    hash = fnv1a(FNV1A_BASIS, u32_bytes(data.cause))
+    if data.site != 0:
+        hash = fnv1a(hash, u32_bytes(data.site))
+    else:
+        hash = fnv1a(hash, data.file.encode('ascii', errors='replace') + u32_bytes(data.line))
+    for addr in data.stacktrace:
+        if addr == 0:
+            break
+        hash = fnv1a(hash, u32_bytes(addr))
+    return hash
+
+def get_fault_signature(fault):
+    # hash the cause, MARK location, and the functions in the stacktrace of a fault from
+    # fault_to_json, so the same bug has the same signature in every build. Parameters and
+    # repeated frames (recursion) are dropped, so they don't split a bug into several signatures.
+    # Without an ELF file, the addresses are hashed instead of the functions. pyocd only names
+    # functions without their namespace or class, so use the same decoder for every fault.
+    if 'site' in fault:
+        location = fault['site']
+    else:
+        location = re.split(r'[/\\]', fault['file'])[-1] + f':{ fault["line"] }'
+    functions = []
+    for frame in fault['stacktrace']:
+        name = frame.get('function', frame['addr'])
+        name = name.split('(', 1)[0] if name is not None else '?'
+        if len(functions) == 0 or functions[-1] != name:
+            functions.append(name)
+    key = '\n'.join([ fault['cause'], location ] + functions)
+    return hashlib.sha1(key.encode()).hexdigest()[:16], functions
+
+def fault_to_json(data, source, source_type, source_time, elffile, lookup, sites):
+    # a fault as a dict for decode-dumps, decoding addresses if lookup isn't None.
+    # sites maps MARK site IDs to file:line, for the sites that could be found.
+    hexfmt = '{:#010x}'
+    def location(addr):
+        if lookup is None:
+            return { 'addr': hexfmt.format(addr) }
+        funcname, dirname, filename, linenum = lookup(addr)
+        return { 'addr': hexfmt.format(addr), 'function': funcname,
+            'file': (f'{ dirname }/{ filename }' if dirname else filename) if filename is not None else None,
+            'line': linenum }
+    def mark(entry):
+        if not isinstance(entry, int):
+            return entry
+        if data.site != 0:
+            return sites.get(entry, hexfmt.format(entry))
+        filename = read_elf_string(elffile, entry >> 14) if elffile is not None else None
+        return f'{ filename }:{ entry & 0x3FFF }' if filename is not None else hexfmt.format(entry)
+    fault = { 'source': source, 'source_type': source_type, 'source_time': source_time, 'failnum': data.failnum,
+        'cause': cause_name(data.cause), 'is_corrupted': data.is_corrupted != 0,
+        'interrupt_type': data.interrupt_type }
+    if data.site != 0:
+        fault['site'] = hexfmt.format(data.site)
+        fault['site_location'] = sites.get(data.site)
+    else:
+        fault['line'] = data.line
+        fault['file'] = data.file
+    fault['starved_channel'] = data.starved_channel if data.starved_channel else None
+    fault['stacktrace'] = [ location(addr) for addr in data.stacktrace if addr != 0 ]
+    if data.interrupt_type != 0:
+        names = [ f'r{ i }' for i in range(13) ] + [ 'sp', 'lr', 'pc' ]
+        fault['registers'] = dict(zip(names, [ hexfmt.format(reg) for reg in data.regs ]))
+        fault['registers']['xpsr'] = hexfmt.format(data.xpsr)
+    fault['mark_history'] = [ mark(entry) for entry in data.mark_history ]
+    fault['stack_window'] = { 'addr': hexfmt.format(data.stack_window_addr),
+        'words': [ hexfmt.format(word) for word in data.stack_window ] } if data.stack_window_addr is not None else None
+    fault['heap'] = dict(zip([ name.lower().replace(' ', '_') for name in FEATHERTRACE_HEAP_STATS ], data.heap_stats)) if data.heap_stats is not None else None
+    fault['heap_sites'] = [ dict(location(caller), size=size) for caller, size in data.heap_sites ]
+    fault['log'] = [ { 'format': hexfmt.format(token), 'args': [ hexfmt.format(arg) for arg in args ],
+        'message': format_log_entry(elffile, token, args) if elffile is not None else None } for token, args in data.event_log ]
+    fault['stack_high_water'] = data.stack_high_water
+    fault['wake_count'] = data.wake_count
+    fault['signature'], fault['functions'] = get_fault_signature(fault)
+    fault['device_signature'] = hexfmt.format(data.signature if data.signature is not None else get_device_signature(data))
+    return fault
+
+# The ELF file (opened, and parsed by pyelftools) and address decoder of each decode-dumps worker process
+decode_worker = { 'elffile': None, 'lookup': None, 'elf_path': None }
+
+def init_decode_worker(elf_path):
+    if elf_path is None:
+        return
+    elf_file = open(elf_path, 'rb')
+    decode_worker['elf_path'] = elf_file
+    decode_worker['elffile'] = ELFFile(elf_file)
+    decode_worker['lookup'] = get_address_decoder(elf_file)
+
+def decode_dump_file(path):
+    # decode every fault in a flash dump or serial log, see fault_to_json
+    try:
+        # map the file once and read it in place, whichever kind it is (ACCESS_COPY so
+        # ctypes can take its address, nothing is written)
+        with open(path, 'rb') as file:
+            if os.fstat(file.fileno()).st_size == 0:
+                source_type, records = 'dump', []
+            else:
+                with mmap.mmap(file.fileno(), 0, access=mmap.ACCESS_COPY) as contents:
+                    if contents.find(b'Fault! Cause: ') != -1:
+                        source_type = 'log'
+                        records = find_print_faults(contents[:].decode('utf-8', errors='replace'))
+                    else:
+                        source_type = 'dump'
+                        if feathertrace_host.lib is not None:
+                            records = find_fault_records_native(buffer=contents)
+                        else:
+                            records = find_fault_records(contents)
+        sites = set()
+        for data in records:
+            if data.site != 0:
+                sites.add(data.site)
+                sites.update(entry for entry in data.mark_history if isinstance(entry, int))
+        found = decode_mark_sites(decode_worker['elf_path'], sites) if decode_worker['elf_path'] is not None and len(sites) > 0 else {}
+        # the time the file was saved, since records have no clock
+        source_time = time.strftime('%Y-%m-%dT%H:%M:%SZ', time.gmtime(os.path.getmtime(path)))
+        return [ fault_to_json(data, path, source_type, source_time, decode_worker['elffile'], decode_worker['lookup'], found)
+            for data in records ]
+    except Exception as ex:
+        return [ { 'source': path, 'error': str(ex) } ]
+
+def group_faults(faults, examples):
+    # group faults from decode-dumps by signature, most common first
+    buckets = {}
+    for fault in faults:
+        bucket = buckets.get(fault['signature'])
+        if bucket is None:
+            bucket = buckets[fault['signature']] = { 'signature': fault['signature'], 'count': 0,
+                'cause': fault['cause'],
+                'location': (fault.get('site_location') or fault['site']) if 'site' in fault else f'{ fault["file"] }:{ fault["line"] }',
+                'functions': fault['functions'], 'device_signatures': set(), 'sources': set(),
+                'first_seen': None, 'last_seen': None, 'examples': [] }
+        bucket['count'] += 1
+        bucket['device_signatures'].add(fault['device_signature'])
+        bucket['sources'].add(fault['source'])
+        # records have no clock, so faults are ordered by when the file was saved, then by failnum
+        seen = { 'time': fault.get('source_time'), 'source': fault['source'], 'failnum': fault['failnum'] }
+        order = lambda seen: (seen['time'] or '', seen['failnum'])
+        if bucket['first_seen'] is None or order(seen) < order(bucket['first_seen']):
+            bucket['first_seen'] = seen
+        if bucket['last_seen'] is None or order(seen) > order(bucket['last_seen']):
+            bucket['last_seen'] = seen
+        if len(bucket['examples']) < examples:
+            bucket['examples'].append(fault)
+    for bucket in buckets.values():
+        bucket['device_signatures'] = sorted(bucket['device_signatures'])
+        bucket['sources'] = len(bucket['sources'])
+    return sorted(buckets.values(), key=lambda bucket: (-bucket['count'], bucket['signature']))
+
+def find_dump_files(patterns):
+    # expand directories (recursively, see DUMP_EXTENSIONS) and globs into a sorted list of files
+    paths = set()
+    for pattern in patterns:
+        if os.path.isdir(pattern):
+            for root, dirs, files in os.walk(pattern):
+                paths.update(os.path.join(root, name) for name in files if name.lower().endswith(DUMP_EXTENSIONS))
+        else:
+            # a pattern matching nothing is kept, so decode_dump_file reports it as missing
+            matches = [ path for path in glob.glob(pattern, recursive=True) if os.path.isfile(path) ]
+            paths.update(matches if len(matches) > 0 else [ pattern ])
+    return sorted(paths)
+
 # Click setup and commands:
 @click.group()
 def recover_trace():
@@ -217,50 +899,20 @@ def recover(force, bossac_path, elf_path, bin_path, port):
         exit(1)
     # read the temporary file, looking for a feathertrace trace
     exit_status = 1
-    with open(bin_path, 'rb') as binfile, mmap.mmap(binfile.fileno(), 0, access=mmap.ACCESS_READ) as fmap:
-        start = 0
-        # seek to the special binary sequence feathertrace uses to indicate a trace block
-        while True:
-            idx = fmap.find(bytearray(FEATHERTRACE_HEAD.to_bytes(4, byteorder='little')), start)
-            if idx == -1:
-                click.echo('Could not find FeatherTrace data! Did the device fault?', err=True)
-                exit_status = 1
-                break
-            # unpack, and check that the result makes sense
-            data = get_fault_data(fmap[idx:(idx + struct.calcsize(FEATHERTRACE_STRUCT_FMT))])
-            if data.value_head == FEATHERTRACE_HEAD and data.marker == FEATHERTRACE_STRING:
-                click.echo('Found trace data!')
-                click.echo(f'\tFault: { FaultCause(data.cause) }')
-                click.echo(f'\tFaulted during recording: { "Yes" if data.is_corrupted > 0 else "No" }')
-                click.echo(f'\tLast Marked Line: { data.line }')
-                click.echo(f'\tLast Marked File: { data.file.split(bytes.fromhex("00"), 1)[0] }')
-                click.echo(f'\tInterrupt type: { data.interrupt_type }')
-                # print decoded stacktrace if all tools needed are present
-                hexfmt = '{:#010x}'
-                if elf_path != None:
-                    click.echo('\tDecoded Stacktrace (may take a moment): ')
-                    print_stack_trace(elf_path, [ addr for addr in data.stacktrace if addr != 0 ], 2)
-                # else print the normal stacktrace
-                else:
-                    fmted_trace = ', '.join([ hexfmt.format(addr) for addr in data.stacktrace if addr != 0 ])
-                    click.echo(f'\tStacktrace: { fmted_trace }')
-                # if the interrupt was asynchrounous, read the saved registers
-                if data.interrupt_type != 0:
-                    click.echo('\tRegisters:')
-                    # print the first 13 registers
-                    first_regs = [ 'R{:} {:#010x}'.format(i, regval) for i,regval in enumerate(data.regs[:13]) ]
-                    fmted_regs_line1 = ', '.join(first_regs[:7])
-                    click.echo(f'\t\t{ fmted_regs_line1 }\t')
-                    fmted_regs_line2 = ', '.join(first_regs[7:])
-                    click.echo(f'\t\t{ fmted_regs_line2 }\t')
-                    # print the special ones
-                    click.echo(f'\t\tSP: { hexfmt.format(data.regs[13]) }\tLR: { hexfmt.format(data.regs[14]) }\tPC: { hexfmt.format(data.regs[15]) }\txPSR: { hexfmt.format(data.xpsr) }')
-                click.echo(f'\tFailures since upload: { data.failnum }')
-                # exit success
-                exit_status = 0
-                break
-            # else keep going
-            start = idx + 4
+    if feathertrace_host.lib is not None:
+        records = find_fault_records_native(bin_path)
+    else:
+        with open(bin_path, 'rb') as binfile, mmap.mmap(binfile.fileno(), 0, access=mmap.ACCESS_READ) as fmap:
+            records = find_fault_records(fmap)
+    if len(records) == 0:
+        click.echo('Could not find FeatherTrace data! Did the device fault?', err=True)
+        exit_status = 1
+    else:
+        click.echo(f'Found { len(records) } fault(s), newest first:')
+        for data in records:
+            print_fault_data(data, elf_path)
+        # exit success
+        exit_status = 0
     # delete the temporary file
     os.remove(bin_path)
     exit(exit_status)
@@ -294,5 +946,169 @@ def decode(elf_path, stacktrace):
     print_stack_trace(elf_path, stripped_addrs, 1)
     exit(0)
 
+@recover_trace.command(short_help='Decodes MARK site IDs into line/file information')
+@click.option('--elf-path', '-e', type=click.File(mode='rb'), required=True,
+    help='Location of the ELF file to read line information from. Must be from the same build as is running on the Feather M0 for site decoding to work correctly.')
+@click.argument('sites', nargs=-1)
+def decode_site(elf_path, sites):
+    """
+    Decode MARK site IDs outputted from FeatherTrace built with FEATHERTRACE_SITE_IDS
+    into line/file information. Requires the ELF file from the exact build currently
+    running on the device being debugged.
+
+    Site IDs must be hexidecimal and space seperated, but may also contain commas and
+    prefixes.
+    """
+    if sites is None or len(sites) == 0:
+        exit(0)
+    SITE_FMT = r'^[,\s]{0,2}(?:0x)?([0-9A-Fa-f]{1,8})[,\s]{0,2}$'
+    stripped_sites = []
+    for site in sites:
+        match = re.match(SITE_FMT, site)
+        if match is None:
+            click.echo(f'Discarding invalid site { site }')
+        else:
+            stripped_sites.append(int(match.group(1), 16))
+    click.echo('Decoded MARK sites (may take a moment):')
+    print_mark_sites(elf_path, stripped_sites, 1)
+    exit(0)
+
+@recover_trace.command(short_help='Decodes profiler output into a per-function profile')
+@click.option('--elf-path', '-e', type=click.File(mode='rb'), required=True,
+    help='Location of the ELF file to read debug symbols from. Must be from the same build as is running on the Feather M0 for profile decoding to work correctly.')
+@click.argument('profile', type=click.File(mode='r'), default='-')
+def decode_profile(elf_path, profile):
+    """
+    Decode the output of FeatherTrace::PrintProfile (read from a file, or stdin if
+    not specified) into a flat profile, grouping samples by function. Requires the ELF
+    file from the exact build currently running on the device being profiled.
+    """
+    PROFILE_FMT = r'^\s*0x([0-9A-Fa-f]{1,8}),\s*(\d+),\s*(\d+)\s*$'
+    samples = []
+    for line in profile:
+        match = re.match(PROFILE_FMT, line)
+        if match is not None:
+            samples.append((int(match.group(1), 16), int(match.group(2)), int(match.group(3))))
+    if len(samples) == 0:
+        click.echo('No profile entries found', err=True)
+        exit(1)
+    click.echo('Decoded profile (may take a moment):')
+    try:
+        lookup = get_address_decoder(elf_path)
+        # group by function, note that inclusive counts may be counted more than once
+        # if a function appears on the stack at more than one address
+        functions = {}
+        for addr, self_count, inclusive in samples:
+            funcname = lookup(addr)[0]
+            funcname = format_function(funcname) if funcname is not None else f'unknown ({ addr:#010x})()'
+            total = functions.get(funcname, (0, 0))
+            functions[funcname] = (total[0] + self_count, total[1] + inclusive)
+        total_self = sum(count for count, _ in functions.values())
+        click.echo('\t   Self  Inclusive  Function')
+        for funcname, (self_count, inclusive) in sorted(functions.items(), key=lambda item: item[1][0], reverse=True):
+            percent = 100.0 * self_count / total_self if total_self > 0 else 0.0
+            click.echo(f'\t{ percent:6.2f}% { inclusive:10d}  { funcname }')
+    except Exception as ex:
+        click.echo(f'Error while decoding profile: {ex}')
+        exit(1)
+    exit(0)
+
+@recover_trace.command(short_help='Decodes FT_LOG output into formatted messages')
+@click.option('--elf-path', '-e', type=click.File(mode='rb'), required=True,
+    help='Location of the ELF file to read format strings from. Must be from the same build as is running on the Feather M0 for log decoding to work correctly.')
+@click.argument('log', type=click.File(mode='r'), default='-')
+def decode_log(elf_path, log):
+    """
+    Decode the output of FeatherTrace::PrintLog or the log section of FeatherTrace::PrintFault
+    (read from a file, or stdin if not specified) into formatted messages. Requires the ELF
+    file from the exact build currently running on the device.
+    """
+    LOG_FMT = r'^\s*0x([0-9A-Fa-f]{1,8}):((?:\s+0x[0-9A-Fa-f]{1,8})*)\s*$'
+    entries = []
+    for line in log:
+        match = re.match(LOG_FMT, line)
+        if match is not None:
+            entries.append((int(match.group(1), 16), [ int(arg, 16) for arg in match.group(2).split() ]))
+    if len(entries) == 0:
+        click.echo('No log entries found', err=True)
+        exit(1)
+    try:
+        print_event_log(elf_path, entries, 0)
+    except Exception as ex:
+        click.echo(f'Error while decoding log: {ex}')
+        exit(1)
+    exit(0)
+
+@recover_trace.command(short_help='Decodes many flash dumps and serial logs into JSON lines')
+@click.option('--elf-path', '-e', type=click.Path(exists=True, dir_okay=False), default=None,
+    help='Location of the ELF file to decode addresses with. Must be from the same build as is running on every device.')
+@click.option('--jobs', '-j', type=int, default=None,
+    help='Number of processes to decode with  [default: the number of CPUs]')
+@click.option('--output', '-o', type=click.File(mode='w'), default='-',
+    help='File to write the JSON lines to  [default: stdout]')
+@click.argument('dumps', nargs=-1, required=True)
+def decode_dumps(elf_path, jobs, output, dumps):
+    """
+    Decode every fault in a set of flash dumps (such as the one downloaded by recover), and serial
+    logs containing the output of FeatherTrace::PrintFault, writing one JSON object per fault.
+    Arguments may be files, globs, or directories, which are searched for .bin, .txt, and .log files.
+
+    Files are decoded in parallel. With libfeathertrace-host, the symbol index of the ELF file is
+    built once and shared by every process (see feathertrace_host.py).
+    """
+    paths = find_dump_files(dumps)
+    if len(paths) == 0:
+        click.echo('No flash dumps or logs found', err=True)
+        exit(1)
+    # build the symbol index before starting the workers, so they all load it from the cache
+    if elf_path is not None and feathertrace_host.lib is not None:
+        with open(elf_path, 'rb') as elf_file:
+            get_native_symbols(elf_file)
+    faults = 0
+    with concurrent.futures.ProcessPoolExecutor(max_workers=jobs, initializer=init_decode_worker, initargs=(elf_path,)) as executor:
+        # map keeps the order of the files, so the output doesn't depend on the number of jobs
+        for records in executor.map(decode_dump_file, paths, chunksize=max(1, len(paths) // (4 * (jobs or os.cpu_count() or 1)))):
+            for record in records:
+                output.write(json.dumps(record) + '\n')
+                if 'error' in record:
+                    click.echo(f'Error while decoding { record["source"] }: { record["error"] }', err=True)
+                else:
+                    faults += 1
+    click.echo(f'Decoded { faults } fault(s) from { len(paths) } file(s)', err=True)
+    exit(0 if faults > 0 else 1)
+
+@recover_trace.command(short_help='Groups faults from decode-dumps by signature')
+@click.option('--examples', '-n', type=int, default=3, show_default=True,
+    help='Number of faults to include with each bucket')
+@click.option('--output', '-o', type=click.File(mode='w'), default='-',
+    help='File to write the JSON lines to  [default: stdout]')
+@click.argument('faults', nargs=-1, type=click.File(mode='r'))
+def bucket_faults(examples, output, faults):
+    """
+    Group the faults written by decode-dumps (read from FAULTS, or stdin) into buckets of the same
+    signature, and write one JSON object per bucket, most common first. Each bucket has the number
+    of faults, the first and last time they were seen, the device signatures they had (see
+    FEATHERTRACE_SIGNATURE), and example faults.
+
+    The signature is a hash of the cause, MARK location, and functions in the stacktrace,
+    so faults from the same bug are grouped together even if they come from different builds.
+    """
+    records = []
+    skipped = 0
+    for file in (faults if len(faults) > 0 else [ click.get_text_stream('stdin') ]):
+        for line in file:
+            if line.strip() == '':
+                continue
+            record = json.loads(line)
+            if 'signature' in record:
+                records.append(record)
+            else:
+                skipped += 1
+    buckets = group_faults(records, examples)
+    for bucket in buckets:
+        output.write(json.dumps(bucket) + '\n')
+    click.echo(f'{ len(records) } fault(s) in { len(buckets) } bucket(s), skipped { skipped } record(s) without a signature', err=True)
+    exit(0 if len(buckets) > 0 else 1)
+
 if __name__ == '__main__':
     recover_trace()